@@ -0,0 +1,53 @@
+// Battery/link history shared between the background worker (which writes it)
+// and the watchface (which reads, renders and uploads it).
+//
+// The log is a ring of BATTLOG_BLOCKS persistent blocks, each holding
+// BATTLOG_BLOCK_RECORDS fixed-size records.  Record number `seq` lives in
+// block BATTLOG_BLOCK_KEY(seq) at slot seq % BATTLOG_BLOCK_RECORDS.
+// PK_LOG_HEAD is only written by the worker, PK_LOG_SENT only by the face.
+
+#define PK_LOG_HEAD          4  // seq of the next record to be written
+#define PK_LOG_SENT          5  // seq of the first record not yet uploaded
+#define PK_LOG_FEATURES      6  // FEAT_* mask for the worker to log
+#define PK_LOG_BLOCK0       16  // first of BATTLOG_BLOCKS consecutive keys
+
+#define BATTLOG_BLOCKS        4  // a day of samples; the face uploads hourly
+#define BATTLOG_BLOCK_RECORDS 32 // 32 * 8 bytes = one 256 byte persist value
+#define BATTLOG_RECORDS      (BATTLOG_BLOCKS * BATTLOG_BLOCK_RECORDS)
+// The worker clears a whole block when it writes the block's first slot, so
+// of the last BATTLOG_RECORDS only the newest BATTLOG_VALID are safe to read.
+#define BATTLOG_VALID        (BATTLOG_RECORDS - BATTLOG_BLOCK_RECORDS)
+// the blocks and PK_LOG_HEAD/SENT/FEATURES, against the persist budget
+#define BATTLOG_BYTES        (BATTLOG_RECORDS * sizeof(battlog_record) + 3 * sizeof(int32_t))
+#define BATTLOG_BLOCK_KEY(seq) (PK_LOG_BLOCK0 + ((seq) / BATTLOG_BLOCK_RECORDS) % BATTLOG_BLOCKS)
+#define BATTLOG_INTERVAL_MIN 15 // fixed sampling rate, in minutes
+
+// battlog_record.state bits
+#define BATTLOG_CHARGING     0x01
+#define BATTLOG_PLUGGED      0x02
+#define BATTLOG_LINKED       0x04
+
+// battlog_record.reason
+#define BATTLOG_REASON_START    0
+#define BATTLOG_REASON_INTERVAL 1
+#define BATTLOG_REASON_BATTERY  2
+#define BATTLOG_REASON_LINK     3
+
+// AppWorkerMessage types
+#define BATTLOG_MSG_APPENDED  0 // worker -> face: data0 = reason
+#define BATTLOG_MSG_FEATURES  1 // face -> worker: data0 = FEAT_* mask
+
+// feature bits used to attribute battery drain to a configuration
+#define FEAT_VIBE_HOUR      0x01
+#define FEAT_TRACK_BATTERY  0x02
+#define FEAT_INVERTED       0x04
+#define FEAT_SUBTEXT        0x08 // show_day or show_week
+#define FEAT_CONFIGS        16   // one drain estimate per combination of the above
+
+typedef struct battlog_record { // 8 bytes
+  uint32_t time;                  // watch local time, seconds
+  uint8_t percent;                // charge percent
+  uint8_t state;                  // BATTLOG_CHARGING | BATTLOG_PLUGGED | BATTLOG_LINKED
+  uint8_t features;               // FEAT_* mask in effect
+  uint8_t reason;                 // BATTLOG_REASON_*
+} __attribute__((__packed__)) battlog_record;
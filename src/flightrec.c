@@ -0,0 +1,87 @@
+#include <pebble.h>
+#include "flightrec.h"
+
+#define FLIGHTREC_BLOCK_KEY(seq) \
+  (PK_FLIGHTREC_BLOCK0 + ((seq) / FLIGHTREC_BLOCK_RECORDS) % FLIGHTREC_BLOCKS)
+
+static uint32_t head = 0;
+static flightrec_record block[FLIGHTREC_BLOCK_RECORDS]; // the one head - 1 is in
+static bool dirty = false;
+static AppTimer *flush_timer = NULL;
+
+void flightrec_init(void) {
+  if (persist_exists(PK_FLIGHTREC_HEAD)) {
+    head = persist_read_int(PK_FLIGHTREC_HEAD);
+  }
+  memset(block, 0, sizeof(block));
+  if (head > 0 && persist_exists(FLIGHTREC_BLOCK_KEY(head - 1))) {
+    persist_read_data(FLIGHTREC_BLOCK_KEY(head - 1), block, sizeof(block));
+  }
+}
+
+void flightrec_flush(void) {
+  if (flush_timer != NULL) {
+    app_timer_cancel(flush_timer);
+    flush_timer = NULL;
+  }
+  if (!dirty) {
+    return;
+  }
+  // the block first, so the head never points past records that aren't stored;
+  // if either doesn't make it, we try again on the next flush
+  if (persist_write_data(FLIGHTREC_BLOCK_KEY(head - 1), block, sizeof(block)) >= 0 &&
+      persist_write_int(PK_FLIGHTREC_HEAD, head) >= 0) {
+    dirty = false;
+  }
+}
+
+static void flush_later(void *data) {
+  flush_timer = NULL;
+  flightrec_flush();
+}
+
+void flightrec_log(uint8_t event, uint8_t message, uint16_t result) {
+  if (head % FLIGHTREC_BLOCK_RECORDS == 0) {
+    flightrec_flush(); // the previous block is full
+    memset(block, 0, sizeof(block));
+  }
+  block[head % FLIGHTREC_BLOCK_RECORDS] = (flightrec_record) {
+    .time = time(NULL), .event = event, .message = message, .result = result,
+  };
+  head++;
+  dirty = true;
+  if (flush_timer == NULL) {
+    flush_timer = app_timer_register(FLIGHTREC_FLUSH_MS, &flush_later, NULL);
+  }
+}
+
+uint32_t flightrec_head(void) {
+  return head;
+}
+
+uint8_t flightrec_read(uint32_t *seq, flightrec_record *records, uint8_t max) {
+  // the ring holds the block in RAM and the FLIGHTREC_BLOCKS - 1 before it
+  uint32_t newest = head > 0 ? (head - 1) / FLIGHTREC_BLOCK_RECORDS : 0;
+  uint32_t first = newest >= FLIGHTREC_BLOCKS - 1 ?
+                   (newest - (FLIGHTREC_BLOCKS - 1)) * FLIGHTREC_BLOCK_RECORDS : 0;
+  if (*seq < first) {
+    *seq = first;
+  }
+  if (*seq >= head) {
+    return 0;
+  }
+  uint32_t count = head - *seq;
+  uint8_t offset = *seq % FLIGHTREC_BLOCK_RECORDS;
+  if (count > (uint32_t)(FLIGHTREC_BLOCK_RECORDS - offset)) { count = FLIGHTREC_BLOCK_RECORDS - offset; }
+  if (count > max) { count = max; }
+  if (*seq / FLIGHTREC_BLOCK_RECORDS == newest) {
+    memcpy(records, &block[offset], count * sizeof(flightrec_record));
+  } else {
+    flightrec_record stored[FLIGHTREC_BLOCK_RECORDS];
+    if (persist_read_data(FLIGHTREC_BLOCK_KEY(*seq), stored, sizeof(stored)) != sizeof(stored)) {
+      return 0;
+    }
+    memcpy(records, &stored[offset], count * sizeof(flightrec_record));
+  }
+  return count;
+}
@@ -0,0 +1,42 @@
+// Flight recorder: a small persistent ring of communication events (drops,
+// send failures, outbox-busy skips, link changes), so the phone can fetch
+// and decode what happened in the field without a debug build.
+//
+// As with the battery log, records are kept in a ring of blocks of
+// FLIGHTREC_BLOCK_RECORDS, one persist value each.  The newest block is kept
+// in RAM and written back a few seconds after an event, when it fills up, or
+// on flightrec_flush(), so a burst of events costs one write.
+
+#define PK_FLIGHTREC_HEAD    11 // seq of the next record to be written
+#define PK_FLIGHTREC_BLOCK0  12 // first of FLIGHTREC_BLOCKS consecutive keys
+
+#define FLIGHTREC_BLOCKS         2
+#define FLIGHTREC_BLOCK_RECORDS 32 // 32 * 8 bytes = one 256 byte persist value
+#define FLIGHTREC_FLUSH_MS    5000
+
+// flightrec_record.event
+#define FLIGHTREC_START          1 // the face started
+#define FLIGHTREC_IN_DROPPED     2 // result = AppMessageResult, message unknown
+#define FLIGHTREC_OUT_FAILED     3 // result = AppMessageResult
+#define FLIGHTREC_OUT_BUSY       4 // a send was skipped, result = app_message_outbox_begin's
+#define FLIGHTREC_LINK_UP        5
+#define FLIGHTREC_LINK_DOWN      6
+#define FLIGHTREC_CONFIG         7 // configuration received
+
+typedef struct flightrec_record { // 8 bytes
+  uint32_t time;                  // watch local time, seconds
+  uint8_t event;                  // FLIGHTREC_*
+  uint8_t message;                // MSG_* id involved, 0 if none
+  uint16_t result;                // AppMessageResult, if any
+} __attribute__((__packed__)) flightrec_record;
+
+// the blocks and PK_FLIGHTREC_HEAD, against the persist budget
+#define FLIGHTREC_BYTES (FLIGHTREC_BLOCKS * FLIGHTREC_BLOCK_RECORDS * sizeof(flightrec_record) + sizeof(int32_t))
+
+void flightrec_init(void);
+void flightrec_log(uint8_t event, uint8_t message, uint16_t result);
+uint32_t flightrec_head(void);
+// up to max records from *seq on, within one block; *seq is moved up to the
+// oldest record still held if it's older than that
+uint8_t flightrec_read(uint32_t *seq, flightrec_record *records, uint8_t max);
+void flightrec_flush(void);
@@ -0,0 +1,82 @@
+#include <pebble.h>
+#include "goal_store.h"
+#include "goal_alert.h"
+#define DEBUGLOG 0
+
+#define GOAL_ALERT_NEVER 0x7FFFFFFF
+
+static uint32_t warn_s = 0;
+static uint32_t urgent_s = 0;
+static time_t next_due = 0; // 0 = a pass is needed right away
+
+static uint8_t level_of(const goal_record *goal, time_t now) {
+  int32_t left = (int32_t)goal->losedate - (int32_t)now;
+  if (goal->losedate == 0 || left <= 0) { return GOAL_ALERT_NONE; } // derailed, wait for the phone
+  if (urgent_s && left <= (int32_t)urgent_s) { return GOAL_ALERT_URGENT; }
+  if (warn_s && left <= (int32_t)warn_s) { return GOAL_ALERT_WARN; }
+  return GOAL_ALERT_NONE;
+}
+
+// when level_of() next changes for this goal
+static time_t next_change(const goal_record *goal, time_t now) {
+  int32_t left = (int32_t)goal->losedate - (int32_t)now;
+  if (goal->losedate == 0 || left <= 0) { return GOAL_ALERT_NEVER; }
+  // the nearest threshold still ahead, or the derail that ends the alert
+  uint32_t ahead = 0;
+  if (warn_s && left > (int32_t)warn_s) { ahead = warn_s; }
+  if (urgent_s && left > (int32_t)urgent_s && urgent_s > ahead) { ahead = urgent_s; }
+  return now + left - ahead;
+}
+
+static uint8_t flags_for(uint8_t level) {
+  switch (level) {
+  case GOAL_ALERT_URGENT: return GOAL_FLAG_WARNED | GOAL_FLAG_URGENT;
+  case GOAL_ALERT_WARN:   return GOAL_FLAG_WARNED;
+  default:                return 0;
+  }
+}
+
+void goal_alert_configure(uint32_t warn, uint32_t urgent) {
+  if (warn != warn_s || urgent != urgent_s) {
+    warn_s = warn;
+    urgent_s = urgent;
+    next_due = 0;
+  }
+}
+
+uint8_t goal_alert_evaluate(time_t now, uint8_t *alerting) {
+  uint8_t raised = GOAL_ALERT_NONE;
+  bool changed = false;
+  *alerting = 0;
+  next_due = GOAL_ALERT_NEVER;
+  for (int slot = goal_store_next(-1); slot >= 0; slot = goal_store_next(slot)) {
+    const goal_record *goal = goal_store_get(slot);
+    if (goal == NULL) { continue; }
+    uint8_t level = level_of(goal, now);
+    uint8_t flags = flags_for(level);
+    if (level != GOAL_ALERT_NONE) { (*alerting)++; }
+    if (flags & ~goal->flags & GOAL_FLAG_ALERTS) {
+      raised = level > raised ? level : raised;
+    }
+    time_t at = next_change(goal, now);
+    if (at < next_due) { next_due = at; }
+    if ((goal->flags & GOAL_FLAG_ALERTS) != flags) {
+      // only written back if it changed, so a quiet pass costs no writes
+      goal_record record = *goal;
+      record.flags = (record.flags & ~GOAL_FLAG_ALERTS) | flags;
+      goal_store_put(&record);
+      changed = true;
+    }
+  }
+  if (changed) {
+    // now, not whenever the cache next evicts it, or a restart fires it again
+    goal_store_flush();
+  }
+  if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "goal alerts: %d alerting, raised %d, next in %ld s",
+                          *alerting, raised, (long)(next_due - now)); }
+  return raised;
+}
+
+bool goal_alert_due(time_t now) {
+  return now >= next_due;
+}
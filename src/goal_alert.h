@@ -0,0 +1,20 @@
+// Derailment alerts, worked out on the watch from the goal store.
+//
+// A goal's urgency is the time left to its losedate (safe days are just that
+// time in whole days, and losedate doesn't go stale the way the phone's
+// safebuf does).  Crossing the warn or urgent threshold raises that goal's
+// alert level, which is kept in the goal's flags (GOAL_FLAG_WARNED and
+// GOAL_FLAG_URGENT) and flushed as soon as it changes, so an alert fires once
+// per losedate, across restarts.  Each pass also works out when the next goal
+// crosses its next threshold, and nothing is looked at again before then.
+
+#define GOAL_ALERT_NONE    0
+#define GOAL_ALERT_WARN    1
+#define GOAL_ALERT_URGENT  2
+
+// thresholds in seconds before the losedate, 0 = that alert is off
+void goal_alert_configure(uint32_t warn_s, uint32_t urgent_s);
+// a pass over every goal: the highest level newly reached, GOAL_ALERT_NONE if
+// nothing new, and how many goals are alerting right now
+uint8_t goal_alert_evaluate(time_t now, uint8_t *alerting);
+bool goal_alert_due(time_t now); // does anything need a pass yet?
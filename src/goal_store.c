@@ -0,0 +1,223 @@
+#include <pebble.h>
+#include "goal_store.h"
+#define DEBUGLOG 0
+
+#define GOAL_NO_SLOT 0xFF
+
+typedef struct goal_index { // 66 bytes
+  uint8_t count;
+  uint8_t active;                 // GOAL_NO_SLOT if none
+  uint16_t hash[GOAL_MAX];        // slug hash per slot, 0 = free
+} __attribute__((__packed__)) goal_index;
+
+typedef struct goal_cache_entry {
+  uint8_t slot;                   // GOAL_NO_SLOT if unused
+  bool dirty;
+  uint16_t used;                  // goal_cache_clock when last touched
+  goal_record record;
+} goal_cache_entry;
+
+static goal_index store_index = { .count = 0, .active = GOAL_NO_SLOT };
+static goal_cache_entry cache[GOAL_CACHE_SIZE];
+static uint16_t goal_cache_clock = 0;
+static bool index_dirty = false;
+static bool store_failed = false; // a write didn't make it since the last flush
+
+static uint16_t slug_hash(const char *slug) {
+  // FNV-1a folded to 16 bits, never 0 since that marks a free slot
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < GOAL_SLUG_LEN && slug[i]; i++) {
+    hash = (hash ^ (uint8_t)slug[i]) * 16777619u;
+  }
+  hash = (hash >> 16) ^ (hash & 0xFFFF);
+  return hash ? hash : 1;
+}
+
+static void write_index() {
+  if (!index_dirty) {
+    return;
+  }
+  if (persist_write_data(PK_GOAL_INDEX, &store_index, sizeof(store_index)) < 0) {
+    store_failed = true; // still dirty, the next flush tries again
+    return;
+  }
+  index_dirty = false;
+}
+
+static void write_back(goal_cache_entry *entry) {
+  if (entry->slot == GOAL_NO_SLOT || !entry->dirty) {
+    return;
+  }
+  if (persist_write_data(PK_GOAL_BASE + entry->slot, &entry->record, sizeof(goal_record)) < 0) {
+    store_failed = true; // kept dirty while it's cached, lost if it's evicted
+    if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__,
+                            "goal %d not written back", entry->slot); }
+    return;
+  }
+  entry->dirty = false;
+  if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__,
+                          "goal %d written back", entry->slot); }
+}
+
+// forget a slot, say because its record is gone
+static void drop_slot(int slot) {
+  for (int i = 0; i < GOAL_CACHE_SIZE; i++) {
+    if (cache[i].slot == slot) { cache[i].slot = GOAL_NO_SLOT; }
+  }
+  store_index.hash[slot] = 0;
+  store_index.count--;
+  if (store_index.active == slot) { store_index.active = GOAL_NO_SLOT; }
+  index_dirty = true;
+}
+
+// the cache entry for slot, loading it (and evicting the LRU entry) if
+// needed; NULL if the record couldn't be loaded
+static goal_cache_entry *cache_entry(int slot, bool load) {
+  goal_cache_entry *victim = &cache[0];
+  for (int i = 0; i < GOAL_CACHE_SIZE; i++) {
+    if (cache[i].slot == slot) {
+      cache[i].used = ++goal_cache_clock;
+      return &cache[i];
+    }
+    if (cache[i].slot == GOAL_NO_SLOT ||
+        (victim->slot != GOAL_NO_SLOT && cache[i].used < victim->used)) {
+      victim = &cache[i];
+    }
+  }
+  write_back(victim);
+  victim->slot = slot;
+  victim->dirty = false;
+  victim->used = ++goal_cache_clock;
+  memset(&victim->record, 0, sizeof(goal_record));
+  if (load && (persist_read_data(PK_GOAL_BASE + slot, &victim->record, sizeof(goal_record))
+                != (int)sizeof(goal_record) ||
+               slug_hash(victim->record.slug) != store_index.hash[slot])) {
+    // the index was stored but the record wasn't, or it's been deleted since
+    victim->slot = GOAL_NO_SLOT;
+    return NULL;
+  }
+  return victim;
+}
+
+void goal_store_init(void) {
+  for (int i = 0; i < GOAL_CACHE_SIZE; i++) {
+    cache[i].slot = GOAL_NO_SLOT;
+  }
+  if (persist_exists(PK_GOAL_INDEX)) {
+    persist_read_data(PK_GOAL_INDEX, &store_index, sizeof(store_index));
+  }
+  for (int slot = 0; slot < GOAL_MAX; slot++) {
+    if (!store_index.hash[slot] && persist_exists(PK_GOAL_BASE + slot)) {
+      persist_delete(PK_GOAL_BASE + slot); // stored, but the index with it wasn't
+    }
+  }
+}
+
+uint8_t goal_store_count(void) {
+  return store_index.count;
+}
+
+int goal_store_next(int after) {
+  for (int slot = after + 1; slot < GOAL_MAX; slot++) {
+    if (store_index.hash[slot]) { return slot; }
+  }
+  return -1;
+}
+
+int goal_store_find(const char *slug) {
+  uint16_t hash = slug_hash(slug);
+  for (int slot = 0; slot < GOAL_MAX; slot++) {
+    if (store_index.hash[slot] != hash) { continue; }
+    const goal_record *record = goal_store_get(slot);
+    if (record != NULL && strncmp(record->slug, slug, GOAL_SLUG_LEN) == 0) {
+      return slot;
+    }
+  }
+  return -1;
+}
+
+int goal_store_active(void) {
+  return store_index.active == GOAL_NO_SLOT ? -1 : store_index.active;
+}
+
+const goal_record *goal_store_get(int slot) {
+  if (slot < 0 || slot >= GOAL_MAX || !store_index.hash[slot]) { return NULL; }
+  goal_cache_entry *entry = cache_entry(slot, true);
+  if (entry == NULL) {
+    drop_slot(slot);
+    return NULL;
+  }
+  return &entry->record;
+}
+
+// the goal the face can best do without, to make room for the active one:
+// the one due last, or one whose record is gone (and so now free)
+static int least_pressing(void) {
+  int least = -1;
+  uint32_t latest = 0;
+  for (int slot = goal_store_next(-1); slot >= 0; slot = goal_store_next(slot)) {
+    if (slot == store_index.active) { continue; }
+    const goal_record *record = goal_store_get(slot);
+    if (record == NULL) { return slot; } // dropped
+    if (least < 0 || record->losedate >= latest) {
+      least = slot;
+      latest = record->losedate;
+    }
+  }
+  return least;
+}
+
+int goal_store_put(const goal_record *record) {
+  int slot = goal_store_find(record->slug);
+  goal_cache_entry *entry;
+  if (slot < 0) {
+    for (slot = 0; slot < GOAL_MAX && store_index.hash[slot]; slot++) { }
+    if (slot == GOAL_MAX && (record->flags & GOAL_FLAG_ACTIVE)) {
+      slot = least_pressing();
+      goal_store_remove(slot);
+      if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__,
+                              "goal %d evicted for the active goal", slot); }
+    }
+    if (slot < 0 || slot == GOAL_MAX) { return -1; }
+    // written through, so the index never has a slot without its record
+    if (persist_write_data(PK_GOAL_BASE + slot, record, sizeof(goal_record)) < 0) {
+      store_failed = true;
+      return -1;
+    }
+    store_index.hash[slot] = slug_hash(record->slug);
+    store_index.count++;
+    index_dirty = true;
+    entry = cache_entry(slot, false);
+    entry->record = *record;
+  } else {
+    entry = cache_entry(slot, true); // just found, so it's loaded
+  }
+  if (memcmp(&entry->record, record, sizeof(goal_record)) != 0) {
+    entry->record = *record;
+    entry->dirty = true; // written back later, see write_back
+  }
+  if ((record->flags & GOAL_FLAG_ACTIVE) && store_index.active != slot) {
+    store_index.active = slot;
+    index_dirty = true;
+  } else if (!(record->flags & GOAL_FLAG_ACTIVE) && store_index.active == slot) {
+    store_index.active = GOAL_NO_SLOT;
+    index_dirty = true;
+  }
+  return slot;
+}
+
+void goal_store_remove(int slot) {
+  if (slot < 0 || slot >= GOAL_MAX || !store_index.hash[slot]) { return; }
+  drop_slot(slot);
+  persist_delete(PK_GOAL_BASE + slot);
+}
+
+bool goal_store_flush(void) {
+  for (int i = 0; i < GOAL_CACHE_SIZE; i++) {
+    write_back(&cache[i]);
+  }
+  write_index();
+  bool stored = !store_failed;
+  store_failed = false;
+  return stored;
+}
@@ -0,0 +1,53 @@
+// Paged persistent store for Beeminder goals.
+//
+// There's no room to hold every goal in RAM, so each goal is one fixed-size
+// record under its own persistent key (PK_GOAL_BASE + slot), found through a
+// small index record of slug hashes.  Only the goals being looked at are
+// loaded, into a GOAL_CACHE_SIZE entry LRU cache; changed records are written
+// back when they're evicted or on goal_store_flush(), and only if they
+// actually changed.  The index is only written by goal_store_flush().
+//
+// Every write is checked, since the app's whole persistent storage is about
+// 4 KB: a new goal is written through and only enters the index once it's
+// stored, a record or index that didn't make it stays dirty for the next
+// flush, and a slot whose record can't be read back is dropped.
+//
+// When all GOAL_MAX slots are taken a new goal is refused, unless it's the
+// active one: that takes the slot of the goal due last, since the face has
+// to be able to show it.
+
+#define PK_GOAL_INDEX     9
+#define PK_GOAL_BASE     64 // through PK_GOAL_BASE + GOAL_MAX - 1
+
+#define GOAL_MAX         32 // limited by the ~4 KB persist budget, see GOAL_STORE_BYTES
+#define GOAL_CACHE_SIZE   3
+#define GOAL_SLUG_LEN    24
+
+#define GOAL_FLAG_ACTIVE  0x01 // the goal the face shows
+#define GOAL_FLAG_DELETED 0x02 // from the phone: forget this goal
+#define GOAL_FLAG_WARNED  0x04 // the warn alert has fired for this losedate, see goal_alert.h
+#define GOAL_FLAG_URGENT  0x08 // and the urgent one
+#define GOAL_FLAG_ALERTS  (GOAL_FLAG_WARNED | GOAL_FLAG_URGENT)
+
+typedef struct goal_record { // 40 bytes
+  char slug[GOAL_SLUG_LEN];       // Beeminder goal slug, NUL padded
+  uint32_t losedate;              // derail deadline, watch local time
+  uint32_t updated_at;            // Beeminder's updated_at, so the phone can skip unchanged goals
+  int32_t rate;                   // commitment rate, in thousandths per runits
+  int16_t safebuf;                // safe days
+  uint8_t runits;                 // rate units: 'y', 'm', 'w', 'd' or 'h'
+  uint8_t flags;                  // GOAL_FLAG_*
+} __attribute__((__packed__)) goal_record;
+
+// the index (a count, the active slot and a hash per slot) and every record
+#define GOAL_STORE_BYTES (2 + 2 * GOAL_MAX + GOAL_MAX * sizeof(goal_record))
+
+void goal_store_init(void);
+uint8_t goal_store_count(void);
+int goal_store_next(int after);   // next used slot after `after` (-1 to start), or -1
+int goal_store_find(const char *slug);
+int goal_store_active(void);      // slot of the GOAL_FLAG_ACTIVE goal, or -1
+const goal_record *goal_store_get(int slot); // NULL if free or unreadable
+int goal_store_put(const goal_record *record); // slot stored in, or -1 if full or not stored
+void goal_store_remove(int slot);
+bool goal_store_flush(void);      // false if anything since the last flush wasn't stored
@@ -0,0 +1,137 @@
+// The configuration page, built here and opened as a data: URL so it shows
+// at once, offline too: no remote page, no libraries.  It's plain HTML with
+// the current settings already selected, and a few lines of script to send
+// the form back to the webviewclosed handler.
+
+var vibePatterns = [[0, "None"], [1, "Single short"], [2, "Double short"], [3, "Triple"],
+                    [4, "Long"], [5, "Subtle"], [6, "Less subtle"], [7, "Not subtle"]];
+
+// In page order.  The watch's own defaults, for when nothing's been saved yet.
+var configFields = [
+  { section: "Beeminder" },
+  { key: "buser", label: "Username", type: "text", value: "" },
+  { key: "bgoal", label: "Goal slug", type: "text", value: "" },
+  { key: "btoken", label: "Auth token", type: "password", value: "" },
+  { key: "dp_tap", label: "Double tap logs +1", value: 0,
+    choices: [[0, "Off"], [1, "On"]] },
+  { key: "alert_warn", label: "Warn before a derail", value: 24,
+    choices: [[0, "Never"], [12, "12 hours"], [24, "1 day"], [48, "2 days"]] },
+  { key: "alert_urgent", label: "And again", value: 3,
+    choices: [[0, "Never"], [1, "1 hour before"], [3, "3 hours before"], [6, "6 hours before"]] },
+  { section: "Face" },
+  { key: "style_inv", label: "Theme", value: 0,
+    choices: [[0, "Light on dark"], [1, "Dark on light"]] },
+  { key: "slot_bot", label: "Bottom of the face", value: 1,
+    choices: [[1, "Calendar"], [2, "Weather"]] },
+  { key: "wunits", label: "Temperature", value: "c",
+    choices: [["c", "°C"], ["f", "°F"]] },
+  { key: "style_week", label: "Below the time, left", value: 0,
+    choices: [[0, "Nothing"], [1, "Week"], [2, "Timezone"]] },
+  { key: "style_day", label: "Below the time, middle", value: 0,
+    choices: [[0, "Nothing"], [1, "Day"], [2, "Month"], [3, "Timezone"], [4, "Week"]] },
+  { key: "intl_fmt_week", label: "Week numbers", value: 0,
+    choices: [[0, "ISO 8601"], [1, "From the first Sunday"], [2, "From the first Monday"]] },
+  { key: "intl_dowo", label: "Calendar weeks start on", value: 1,
+    choices: [[0, "Sunday"], [1, "Monday"], [2, "Tuesday"], [3, "Wednesday"],
+              [4, "Thursday"], [5, "Friday"], [6, "Saturday"]] },
+  { key: "style_day_inv", label: "Highlight today", value: 1,
+    choices: [[0, "No"], [1, "Yes"]] },
+  { key: "style_grid", label: "Calendar grid", value: 1,
+    choices: [[0, "Off"], [1, "On"]] },
+  { section: "Vibrations" },
+  { key: "vibe_hour", label: "Every hour", value: 0, choices: vibePatterns },
+  { key: "vibe_pat_disconnect", label: "Phone lost", value: 2, choices: vibePatterns },
+  { key: "vibe_pat_connect", label: "Phone back", value: 0, choices: vibePatterns },
+  { key: "vibe_pat_alert", label: "Derail alert", value: 2, choices: vibePatterns },
+  { section: "Battery" },
+  { key: "track_battery", label: "Track battery", value: 0,
+    choices: [[0, "Off"], [1, "On"]] }
+];
+
+var configStyle =
+  "body{font:16px sans-serif;margin:0;padding:0 12px 72px;background:#fff;color:#222}" +
+  "h1{font-size:20px}h2{font-size:16px;margin:20px 0 4px;color:#777}" +
+  "label{display:block;margin:10px 0 2px}" +
+  "input,select{width:100%;box-sizing:border-box;font-size:16px;padding:6px}" +
+  "table{border-collapse:collapse}td{padding:2px 12px 2px 0}" +
+  "pre{font-size:11px;white-space:pre-wrap}" +
+  "#bar{position:fixed;bottom:0;left:0;right:0;display:flex;background:#eee}" +
+  "#bar button{flex:1;margin:8px;padding:12px;font-size:16px}";
+
+var configScript =
+  "function save(){var o={},f=document.querySelectorAll('[name]');" +
+  "for(var i=0;i<f.length;i++){o[f[i].name]=f[i].hasAttribute('data-number')?Number(f[i].value):f[i].value;}" +
+  "document.location='pebblejs://close#'+encodeURIComponent(JSON.stringify(o));}" +
+  "function cancel(){document.location='pebblejs://close';}";
+
+function escapeHtml(text) {
+  return String(text).replace(/&/g, "&amp;").replace(/</g, "&lt;")
+                     .replace(/>/g, "&gt;").replace(/"/g, "&quot;");
+}
+
+function configFieldHtml(field, value) {
+  var id = escapeHtml(field.key);
+  var html = '<label for="' + id + '">' + escapeHtml(field.label) + '</label>';
+  if(!field.choices) {
+    return html + '<input type="' + field.type + '" id="' + id + '" name="' + id +
+           '" value="' + escapeHtml(value) + '" autocapitalize="off" autocorrect="off">';
+  }
+  var number = typeof field.value === "number";
+  html += '<select id="' + id + '" name="' + id + '"' + (number ? ' data-number' : '') + '>';
+  field.choices.forEach(function(choice) {
+    html += '<option value="' + escapeHtml(choice[0]) + '"' +
+            (String(choice[0]) === String(value) ? ' selected' : '') + '>' +
+            escapeHtml(choice[1]) + '</option>';
+  });
+  return html + '</select>';
+}
+
+// What the phone has worked out about the watch's battery, see estimateDrain
+function energyHtml(profile) {
+  if(!profile.segments) {
+    return "<p>Not enough battery history yet.</p>";
+  }
+  var labels = { vibe_hour: "Hourly vibe", track_battery: "Battery tracking",
+                 inverted: "Inverted display", subtext: "Day/week text" };
+  var rows = [["Base watchface", profile.base]];
+  Object.keys(profile.features || {}).forEach(function(name) {
+    rows.push([labels[name] || name, profile.features[name]]);
+  });
+  rows.push(["Per message/hour", profile.per_message]);
+  rows.push(["Per vibration/hour", profile.per_vibe]);
+  var html = profile.hours_left ?
+    "<p>About " + Math.round(profile.hours_left) + " hours left at the current settings.</p>" : "";
+  html += "<table>";
+  rows.forEach(function(row) {
+    html += "<tr><td>" + escapeHtml(row[0]) + "</td><td>" + (row[1] || 0).toFixed(2) + " %/h</td></tr>";
+  });
+  return html + "</table>";
+}
+
+// The whole page, prefilled from what we last saved for the watch and the phone
+function configPage() {
+  var values = JSON.parse(localStorage.getItem("watch_options") || "{}");
+  var phone = getOptions();
+  Object.keys(phone).forEach(function(key) { values[key] = phone[key]; });
+  var flight = JSON.parse(localStorage.getItem("flight_log") || "[]").slice(-20);
+
+  var html = '<!DOCTYPE html><html><head><meta charset="utf-8">' +
+             '<meta name="viewport" content="width=device-width,initial-scale=1">' +
+             '<title>Beeminder Pebble</title><style>' + configStyle + '</style></head>' +
+             '<body><h1>Beeminder Pebble</h1>';
+  configFields.forEach(function(field) {
+    if(field.section) {
+      html += "<h2>" + escapeHtml(field.section) + "</h2>";
+    } else {
+      html += configFieldHtml(field, field.key in values ? values[field.key] : field.value);
+    }
+  });
+  html += "<h2>Battery usage</h2>" +
+          energyHtml(JSON.parse(localStorage.getItem("energy_profile") || "{}"));
+  html += "<h2>Diagnostics</h2><p>Recent connection events on the watch:</p><pre>" +
+          (flight.length ? escapeHtml(flight.join("\n")) : "None recorded yet.") + "</pre>";
+  html += '<div id="bar"><button onclick="cancel()">Cancel</button>' +
+          '<button onclick="save()">Save</button></div>' +
+          '<script>' + configScript + '</script></body></html>';
+  return html;
+}
@@ -1,33 +1,355 @@
 var initialized = false;
-var configUrl = 'https://www.beeminder.com/pebblebee-config.html';
+var beeminderApi = 'https://www.beeminder.com/api/v1';
+var weatherApi = 'https://api.open-meteo.com/v1/forecast';
+// options only the phone needs, kept out of the message to the watch
+var phoneOptions = ["buser", "bgoal", "btoken", "wunits"];
 
 Pebble.addEventListener("ready", function(e) {
   console.log("Connect! " + e.ready);
   initialized = true;
+  sendHello(); // goals, weather and the flight log follow the watch's reply
+  submitDatapoints(); // anything left over from last time
 });
 
+// the page is built right here, see config-page.js
 Pebble.addEventListener("showConfiguration", function(e) {
-  console.log("Configuration window launching");
-  Pebble.openURL(configUrl + '?_=' + new Date().getTime() );
+  var started = new Date().getTime();
+  var url = "data:text/html;charset=utf-8," + encodeURIComponent(configPage());
+  console.log("Configuration page: " + url.length + " bytes, built in " +
+              (new Date().getTime() - started) + " ms");
+  Pebble.openURL(url);
 });
 
+// messages are packed by the codec generated from messages.json
 Pebble.addEventListener("appmessage", function(e) {
-  console.log("Received message: type " + e.payload.message_type);
-  switch(e.payload.message_type) {
-  case 100:
-    saveBatteryValue(e);
+  var msg = messageDecode(e.payload);
+  if(!msg) { return; }
+  console.log("Received message: " + msg.type);
+  switch(msg.type) {
+  case "log_data":
+    saveBatteryLog(msg);
     break;
-  case 103:
+  case "hello_reply":
+    helloReply(msg);
+    break;
+  case "timezone":
     sendTimezoneToWatch();
+    fetchGoals(); // the watch asks hourly, a good time to check the goals
+    fetchWeather();
+    requestFlightLog();
+    break;
+  case "dp_data":
+    queueDatapoints(msg);
+    break;
+  case "flightrec_data":
+    saveFlightLog(msg);
+    break;
+  case "stream_ack":
+    streamAck(msg);
     break;
   }
 });
 
-function saveBatteryValue(e) {
-  console.log("Battery: "   + e.payload.send_batt_percent + 
-              "%, Charge: " + e.payload.send_batt_charging + 
-              ", Plugged: " + e.payload.send_batt_plugged);
-  // store these in localStorage along with a date object in some useful manner?
+// Bounded time-series store in localStorage.
+//
+// Points are kept in fixed-size segments, one localStorage key each, in three
+// tiers: raw points, hourly and daily aggregates.  Appending only rewrites the
+// newest segment.  When a tier has too many segments its oldest one is rolled
+// up into the next tier as min/avg/max per field (daily ones just age out), so
+// storage never exceeds limits.size * (limits.raw + limits.hour + limits.day)
+// points per series, however long it runs.
+function TimeSeries(name, fields, limits) {
+  this.name = name;
+  this.fields = fields;
+  this.limits = limits || TimeSeries.limits;
+  this.meta = JSON.parse(localStorage.getItem(this.key("meta")) || "null") ||
+              { next: 0, raw: [], hour: [], day: [] };
+  this.open = {}; // tier -> points of its newest segment
+}
+
+TimeSeries.limits = { size: 128, raw: 8, hour: 4, day: 4 };
+TimeSeries.span = { hour: 3600000, day: 86400000 };
+TimeSeries.rollup = { raw: "hour", hour: "day" };
+
+TimeSeries.prototype.key = function(k) {
+  return "ts." + this.name + "." + k;
+};
+
+TimeSeries.prototype.segment = function(id) {
+  return JSON.parse(localStorage.getItem(this.key(id)) || "[]");
+};
+
+// raw points are [t, v0, v1, ...], aggregates [t, n, min0, avg0, max0, ...]
+TimeSeries.prototype.append = function(t, values) {
+  this.push("raw", [t].concat(this.fields.map(function(f) {
+    return Number(values[f]) || 0;
+  })));
+};
+
+TimeSeries.prototype.push = function(tier, point) {
+  var ids = this.meta[tier];
+  var id = ids[ids.length - 1];
+  var seg = this.open[tier];
+  if(ids.length && !seg) {
+    seg = this.open[tier] = this.segment(id);
+  }
+  var last = seg && seg[seg.length - 1];
+  if(tier !== "raw" && last && last[0] === point[0]) {
+    TimeSeries.merge(last, point); // same bucket, e.g. an hour split across segments
+  } else {
+    if(!ids.length || seg.length >= this.limits.size) {
+      id = this.meta.next++;
+      ids.push(id);
+      seg = this.open[tier] = [];
+      localStorage.setItem(this.key("meta"), JSON.stringify(this.meta));
+    }
+    seg.push(point);
+  }
+  localStorage.setItem(this.key(id), JSON.stringify(seg));
+  if(ids.length > this.limits[tier]) { this.compact(tier); }
+};
+
+TimeSeries.prototype.compact = function(tier) {
+  var id = this.meta[tier].shift();
+  var seg = this.segment(id);
+  localStorage.removeItem(this.key(id));
+  localStorage.setItem(this.key("meta"), JSON.stringify(this.meta));
+  var next = TimeSeries.rollup[tier];
+  if(!next) { return; }
+  var span = TimeSeries.span[next];
+  var bucket = null;
+  for(var i = 0; i < seg.length; i++) {
+    var agg = tier === "raw" ? TimeSeries.aggregate(seg[i]) : seg[i].slice();
+    agg[0] = Math.floor(agg[0] / span) * span;
+    if(bucket && bucket[0] === agg[0]) {
+      TimeSeries.merge(bucket, agg);
+    } else {
+      if(bucket) { this.push(next, bucket); }
+      bucket = agg;
+    }
+  }
+  if(bucket) { this.push(next, bucket); }
+};
+
+TimeSeries.aggregate = function(point) {
+  var agg = [point[0], 1];
+  for(var i = 1; i < point.length; i++) {
+    agg.push(point[i], point[i], point[i]);
+  }
+  return agg;
+};
+
+TimeSeries.merge = function(into, agg) {
+  var n = into[1] + agg[1];
+  for(var i = 2; i < into.length; i += 3) {
+    into[i]     = Math.min(into[i], agg[i]);
+    into[i + 1] = (into[i + 1] * into[1] + agg[i + 1] * agg[1]) / n;
+    into[i + 2] = Math.max(into[i + 2], agg[i + 2]);
+  }
+  into[1] = n;
+};
+
+TimeSeries.prototype.decode = function(tier, point) {
+  var out = { t: point[0] };
+  if(tier === "raw") {
+    this.fields.forEach(function(f, i) { out[f] = point[i + 1]; });
+  } else {
+    out.tier = tier;
+    out.n = point[1];
+    this.fields.forEach(function(f, i) {
+      out[f] = { min: point[2 + 3*i], avg: point[3 + 3*i], max: point[4 + 3*i] };
+    });
+  }
+  return out;
+};
+
+// Points with from <= t < to, oldest first, optionally from a single tier.
+// Aggregates come back as { t, tier, n, field: { min, avg, max }, ... }.
+TimeSeries.prototype.query = function(from, to, onlyTier) {
+  var self = this;
+  var out = [];
+  ["day", "hour", "raw"].forEach(function(tier) {
+    if(onlyTier && tier !== onlyTier) { return; }
+    self.meta[tier].forEach(function(id) {
+      self.segment(id).forEach(function(point) {
+        if(point[0] >= from && point[0] < to) {
+          out.push(self.decode(tier, point));
+        }
+      });
+    });
+  });
+  return out;
+};
+
+TimeSeries.prototype.exportAll = function() {
+  return { name: this.name, fields: this.fields,
+           day:  this.query(0, Infinity, "day"),
+           hour: this.query(0, Infinity, "hour"),
+           raw:  this.query(0, Infinity, "raw") };
+};
+
+// feature bits, matching FEAT_* in battlog.h
+var features = { vibe_hour: 1, track_battery: 2, inverted: 4, subtext: 8 };
+var batteryFields = ["p", "c", "u", "l", "f", "why", "m", "v", "r"];
+var battlogRecordSize = 8; // sizeof(battlog_record)
+
+// Unpack a batch of the worker's battery log records (see battlog.h):
+// uint32 local time, uint8 percent, uint8 state, uint8 features, uint8 reason
+function decodeBatteryLog(bytes) {
+  // the watch keeps local time, so shift it back to UTC
+  var tzOffset = new Date().getTimezoneOffset() * 60;
+  var records = [];
+  for(var i = 0; i + battlogRecordSize <= bytes.length; i += battlogRecordSize) {
+    var t = (bytes[i] | (bytes[i+1] << 8) | (bytes[i+2] << 16)) +
+            bytes[i+3] * 16777216;
+    records.push({ t: (t + tzOffset) * 1000,
+                   p: bytes[i+4],
+                   c: (bytes[i+5] & 1) ? 1 : 0,
+                   u: (bytes[i+5] & 2) ? 1 : 0,
+                   l: (bytes[i+5] & 4) ? 1 : 0,
+                   f: bytes[i+6],
+                   why: bytes[i+7],
+                   m: 0, v: 0, r: 0 });
+  }
+  return records;
+}
+
+function saveBatteryLog(msg) {
+  var records = decodeBatteryLog(msg.records);
+  console.log("Battery log: " + records.length + " records from #" + msg.seq);
+  var lastSeq = Number(localStorage.getItem("battery_log_seq") || -1);
+  if(msg.head <= lastSeq) { // reinstalled, the watch's log started over
+    lastSeq = -1;
+    localStorage.setItem("battery_log_seq", lastSeq);
+  }
+  var fresh = records.filter(function(record, i) {
+    return msg.seq + i > lastSeq; // resent after a lost ack
+  });
+  if(!fresh.length) { return; }
+  // activity counters cover the whole batch, credit them to its last record
+  var last = fresh[fresh.length - 1];
+  last.m = msg.msg_count;
+  last.v = msg.vibe_count;
+  last.r = msg.drain_rate;
+  var store = batteryStore();
+  fresh.forEach(function(record) { store.append(record.t, record); });
+  localStorage.setItem("battery_log_seq", msg.seq + records.length - 1);
+  localStorage.setItem("energy_profile",
+                       JSON.stringify(estimateDrain(store.query(0, Infinity, "raw"))));
+}
+
+var batteryStoreCache = null;
+function batteryStore() {
+  if(!batteryStoreCache) {
+    localStorage.removeItem("battery_history"); // unbounded, superseded by the store
+    batteryStoreCache = new TimeSeries("battery", batteryFields);
+  }
+  return batteryStoreCache;
+}
+
+// Split the history into discharge segments (not charging, same features)
+// and fit each one's drain in %/hour by least squares.
+function dischargeSegments(history) {
+  var segments = [];
+  var cur = null;
+  for(var i = 0; i < history.length; i++) {
+    var s = history[i];
+    if(s.c || s.u || !cur || cur.f !== s.f) {
+      if(cur && cur.pts.length > 1) { segments.push(cur); }
+      cur = (s.c || s.u) ? null : { f: s.f, pts: [], m: 0, v: 0 };
+      if(!cur) { continue; }
+    }
+    cur.pts.push([s.t / 3600000, s.p]);
+    cur.m += s.m;
+    cur.v += s.v;
+  }
+  if(cur && cur.pts.length > 1) { segments.push(cur); }
+
+  var fitted = [];
+  segments.forEach(function(seg) {
+    var n = seg.pts.length, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    seg.pts.forEach(function(p) {
+      sx += p[0]; sy += p[1]; sxx += p[0] * p[0]; sxy += p[0] * p[1];
+    });
+    var hours = seg.pts[n - 1][0] - seg.pts[0][0];
+    var denom = n * sxx - sx * sx;
+    if(hours < 1 || denom <= 0) { return; }
+    var drain = -(n * sxy - sx * sy) / denom;
+    if(drain <= 0) { return; }
+    fitted.push({ f: seg.f, hours: hours, drain: drain,
+                  msgs: seg.m / hours, vibes: seg.v / hours });
+  });
+  return fitted;
+}
+
+// Solve A x = b by Gaussian elimination with partial pivoting.
+function solve(A, b) {
+  var n = b.length;
+  for(var c = 0; c < n; c++) {
+    var p = c;
+    for(var r = c + 1; r < n; r++) {
+      if(Math.abs(A[r][c]) > Math.abs(A[p][c])) { p = r; }
+    }
+    var t = A[c]; A[c] = A[p]; A[p] = t;
+    t = b[c]; b[c] = b[p]; b[p] = t;
+    for(r = c + 1; r < n; r++) {
+      var k = A[r][c] / A[c][c];
+      for(var j = c; j < n; j++) { A[r][j] -= k * A[c][j]; }
+      b[r] -= k * b[c];
+    }
+  }
+  var x = [];
+  for(var i = n - 1; i >= 0; i--) {
+    var sum = b[i];
+    for(var j2 = i + 1; j2 < n; j2++) { sum -= A[i][j2] * x[j2]; }
+    x[i] = sum / A[i][i];
+  }
+  return x;
+}
+
+// Attribute drain to features with a duration-weighted linear regression:
+//   drain = base + sum(feature_i * cost_i) + msgs/h * per_msg + vibes/h * per_vibe
+// A small ridge term keeps it solvable before every feature has been seen.
+function estimateDrain(history) {
+  var segments = dischargeSegments(history);
+  var names = Object.keys(features);
+  var rows = segments.map(function(seg) {
+    return [1].concat(names.map(function(name) {
+      return (seg.f & features[name]) ? 1 : 0;
+    }), [seg.msgs, seg.vibes]);
+  });
+  var n = names.length + 3;
+  var A = [], b = [];
+  for(var i = 0; i < n; i++) {
+    A.push([]);
+    b.push(0);
+    for(var j = 0; j < n; j++) { A[i].push(i === j ? 0.01 : 0); }
+  }
+  rows.forEach(function(x, k) {
+    var w = segments[k].hours;
+    for(var i = 0; i < n; i++) {
+      for(var j = 0; j < n; j++) { A[i][j] += w * x[i] * x[j]; }
+      b[i] += w * x[i] * segments[k].drain;
+    }
+  });
+  var coef = solve(A, b);
+
+  var profile = { segments: segments.length, base: coef[0], features: {},
+                  per_message: coef[names.length + 1],
+                  per_vibe: coef[names.length + 2], configs: {} };
+  names.forEach(function(name, i) { profile.features[name] = coef[i + 1]; });
+  segments.forEach(function(seg) {
+    var c = profile.configs[seg.f] || (profile.configs[seg.f] = { hours: 0, drain: 0 });
+    c.drain = (c.drain * c.hours + seg.drain * seg.hours) / (c.hours + seg.hours);
+    c.hours += seg.hours;
+  });
+  var last = history[history.length - 1];
+  if(last && !last.c && !last.u) {
+    var rate = profile.configs[last.f] ? profile.configs[last.f].drain
+                                       : (last.r / 16); // watch's own estimate
+    if(rate > 0) { profile.hours_left = last.p / rate; }
+  }
+  return profile;
 }
 
 // better version at 
@@ -35,30 +357,721 @@ function saveBatteryValue(e) {
 function sendTimezoneToWatch() {
   var offsetHours = new Date().getTimezoneOffset() / 60;
   // 5 means GMT-5, -5 means GMT+5 ... -12 through +14 are the valid options
-  Pebble.sendAppMessage({ message_type: 103, timezone_offset: offsetHours },
+  sendReliably(messageEncode("timezone", { offset: offsetHours }),
+               "TZ message (" + offsetHours + ")");
+}
+
+// The next change of the UTC offset within a year, to the minute, or null
+function nextTimezoneChange() {
+  var day = 24 * 60 * 60 * 1000;
+  var now = new Date().getTime();
+  var offset = new Date(now).getTimezoneOffset();
+  for(var t = now + day; t < now + 366 * day; t += day) {
+    if(new Date(t).getTimezoneOffset() === offset) { continue; }
+    var lo = t - day, hi = t;
+    while(hi - lo > 60 * 1000) {
+      var mid = Math.floor((lo + hi) / 2);
+      if(new Date(mid).getTimezoneOffset() === offset) { lo = mid; } else { hi = mid; }
+    }
+    return { time: hi, offset: new Date(hi).getTimezoneOffset() };
+  }
+  return null;
+}
+
+// A hash of what we've sent the watch of each goal, 0 for nothing.  The watch
+// keeps the one that came with the last goal_batch it applied.
+function goalsVersion(sent) {
+  var slugs = Object.keys(sent).sort();
+  if(!slugs.length) { return 0; }
+  var hash = 2166136261; // FNV-1a, without Math.imul
+  slugs.forEach(function(slug) {
+    var entry = slug + "=" + sent[slug] + ";";
+    for(var i = 0; i < entry.length; i++) {
+      hash ^= entry.charCodeAt(i) & 0xFF;
+      hash = (hash + (hash << 1) + (hash << 4) + (hash << 7) + (hash << 8) + (hash << 24)) >>> 0;
+    }
+  });
+  return hash;
+}
+
+// Everything the watch would otherwise ask for at startup, in one message:
+// the timezone and when it next changes, and what we think the watch has, so
+// its one reply can say what it's missing (see in_hello_handler).
+function sendHello() {
+  var offset = new Date().getTimezoneOffset();
+  var change = nextTimezoneChange();
+  sendReliably(messageEncode("hello", {
+    offset: offset / 60, // as for the timezone message
+    next_offset: change ? change.offset / 60 : offset / 60,
+    transition: change ? change.time / 1000 - offset * 60 : 0, // watch local time
+    config_version: Number(localStorage.getItem("config_version") || 0),
+    goals_version: goalsVersion(JSON.parse(localStorage.getItem("goals_sent") || "{}")),
+    log_next: Number(localStorage.getItem("battery_log_seq") || -1) + 1,
+    flight_next: Number(localStorage.getItem("flight_seq") || 0)
+  }), "hello");
+}
+
+function helloReply(msg) {
+  var logBytes = msg.log_count * 8; // sizeof(battlog_record)
+  console.log("Watch needs " + msg.needs + ", " + msg.log_count + " battery log records");
+  saveBatteryLog({ seq: msg.seq, head: msg.log_head, msg_count: msg.msg_count, vibe_count: msg.vibe_count,
+                   drain_rate: msg.drain_rate, records: msg.records.slice(0, logBytes) });
+  saveFlightLog({ from: msg.flight_from, head: msg.flight_head, records: msg.records.slice(logBytes) });
+  if(msg.needs & 1) { // HELLO_NEED_CONFIG
+    var options = localStorage.getItem("watch_options");
+    if(options) { sendReliably(JSON.parse(options), "configuration"); }
+  }
+  // HELLO_NEED_GOALS: the store was lost, or a batch never made it, so
+  // goals_sent is no guide to what the watch has
+  fetchGoals(!!(msg.needs & 2));
+  if(msg.needs & 4) { // HELLO_NEED_WEATHER
+    fetchWeather(true);
+  }
+}
+
+function getOptions() {
+  return JSON.parse(localStorage.getItem("pebblebee_options") || "{}");
+}
+
+var dpEntrySize = 7; // sizeof(dp_entry)
+
+// Unpack the watch's datapoint queue (see dp_entry in pebblebee.c):
+// uint16 id, uint8 goal slot, uint16 local day, int16 value
+function decodeDatapoints(bytes) {
+  var entries = [];
+  for(var i = 0; i + dpEntrySize <= bytes.length; i += dpEntrySize) {
+    var value = bytes[i+5] | (bytes[i+6] << 8);
+    entries.push({ id:    bytes[i] | (bytes[i+1] << 8),
+                   goal:  bytes[i+2],
+                   day:   bytes[i+3] | (bytes[i+4] << 8),
+                   value: value >= 32768 ? value - 65536 : value });
+  }
+  return entries;
+}
+
+// Take the watch's queued datapoints into our own persistent queue, then ack
+// so the watch can drop them.  A resend (lost ack) is recognised by day+id.
+function queueDatapoints(msg) {
+  var entries = decodeDatapoints(msg.entries);
+  if(!entries.length) { return; }
+  var pending = JSON.parse(localStorage.getItem("dp_pending") || "[]");
+  var seen = JSON.parse(localStorage.getItem("dp_seen") || "[]");
+  entries.forEach(function(entry) {
+    var key = entry.day + ":" + entry.id;
+    if(seen.indexOf(key) >= 0) { return; }
+    seen.push(key);
+    // fixed before the first attempt, so retries can't create a second datapoint
+    entry.requestid = "pebblebee-" + new Date().getTime().toString(36) + "-" + key;
+    pending.push(entry);
+  });
+  localStorage.setItem("dp_pending", JSON.stringify(pending));
+  localStorage.setItem("dp_seen", JSON.stringify(seen.slice(-200)));
+  Pebble.sendAppMessage(messageEncode("dp_ack", { id: entries[entries.length - 1].id }),
     function(e) {
-      console.log("Sent TZ message (" + offsetHours + ") with transactionId=" + 
-                  e.data.transactionId);
+      console.log("Acked datapoints to watch");
     },
     function(e) {
-      console.log("Unable to deliver TZ message with transactionId=" + 
-                  e.data.transactionId + " Error is: " + e.error.message);
+      console.log("Unable to ack datapoints, watch will resend: " + e.error.message);
     }
   );
+  submitDatapoints();
 }
 
-Pebble.addEventListener("webviewclosed", function(e) {
-  console.log("Configuration closed");
-  var options = JSON.parse(decodeURIComponent(e.response));
-  console.log("Options = " + JSON.stringify(options));
-  var transactionId = Pebble.sendAppMessage(options,
+var submitting = false;
+var submitFailures = 0;
+var submitTimer = null;
+var submitBackoff = 30 * 1000;      // after the first failure, doubling
+var submitBackoffMax = 30 * 60 * 1000;
+
+// Try again later, rather than leaving refused datapoints until the next
+// batch or launch
+function retrySubmit() {
+  submitting = false;
+  if(submitTimer) { return; }
+  var delay = Math.min(submitBackoff * Math.pow(2, submitFailures), submitBackoffMax);
+  submitFailures++;
+  submitTimer = setTimeout(function() {
+    submitTimer = null;
+    submitDatapoints();
+  }, delay);
+}
+
+// Post pending datapoints, one create_all request per goal.  Each carries
+// its requestid, so a request that succeeded but whose reply got lost is
+// harmless to repeat.
+function submitDatapoints() {
+  var options = getOptions();
+  var pending = JSON.parse(localStorage.getItem("dp_pending") || "[]");
+  if(submitting || !pending.length || !options.buser || !options.btoken) {
+    return;
+  }
+  var goals = [options.bgoal]; // slot 0 is the configured goal
+  var tzOffset = new Date().getTimezoneOffset() * 60;
+  var batch = pending.filter(function(entry) { return goals[entry.goal]; });
+  var slug = batch.length && goals[batch[0].goal];
+  batch = batch.filter(function(entry) { return goals[entry.goal] === slug; });
+  if(!batch.length) { return; }
+
+  var datapoints = batch.map(function(entry) {
+    return { timestamp: entry.day * 86400 + tzOffset + 12 * 3600, // local noon
+             value: entry.value, comment: "via Pebble",
+             requestid: entry.requestid };
+  });
+  var req = new XMLHttpRequest();
+  req.open("POST", beeminderApi + "/users/" + encodeURIComponent(options.buser) +
+           "/goals/" + encodeURIComponent(slug) + "/datapoints/create_all.json", true);
+  req.setRequestHeader("Content-Type", "application/x-www-form-urlencoded");
+  req.onload = function() {
+    if(req.status !== 200) {
+      console.log("Datapoint submission failed: " + req.status);
+      retrySubmit(); // still pending
+      return;
+    }
+    submitting = false;
+    submitFailures = 0;
+    var done = batch.map(function(entry) { return entry.requestid; });
+    var left = JSON.parse(localStorage.getItem("dp_pending") || "[]")
+      .filter(function(entry) { return done.indexOf(entry.requestid) < 0; });
+    localStorage.setItem("dp_pending", JSON.stringify(left));
+    console.log("Submitted " + done.length + " datapoints to " + slug);
+    submitDatapoints(); // other goals
+  };
+  req.onerror = function() {
+    console.log("Datapoint submission failed, will retry");
+    retrySubmit();
+  };
+  submitting = true;
+  req.send("auth_token=" + encodeURIComponent(options.btoken) +
+           "&datapoints=" + encodeURIComponent(JSON.stringify(datapoints)));
+}
+
+// Send one message, retrying a few times with backoff if the watch doesn't
+// take it; for small messages whose loss would otherwise go unnoticed
+function sendReliably(payload, what, tries) {
+  tries = tries || 0;
+  Pebble.sendAppMessage(payload,
+    function(e) {
+      console.log("Delivered " + what);
+    },
+    function(e) {
+      console.log("Unable to deliver " + what + ": " + e.error.message);
+      if(tries < 3) {
+        setTimeout(function() { sendReliably(payload, what, tries + 1); },
+                   1000 << tries);
+      }
+    }
+  );
+}
+
+// Reliable streams to the watch (see stream.h).
+//
+// A payload goes out as stream_chunk messages sized to the watch's inbox (up
+// to the schema's limit on a chunk's data), at most streamWindow of them
+// unacknowledged.  The watch acks each chunk with how much it holds, which
+// trails what we've sent while the window is full.  Only a gap ack or a chunk
+// that failed to send means something went missing: we go back and resend
+// from there, once per gap, as we do when a delivered chunk's ack doesn't
+// come.  Failing again before any progress also halves the chunk size, down
+// to streamChunkMin, since a chunk is lost whenever any of its packets is;
+// and each failure in a row after the first waits longer before the resend.
+// A stream is only given up on once it's made no progress for streamGiveUp.
+// Streams are sent one after another.
+var streamMax = 4096;         // STREAM_MAX
+var streamWindow = 4;         // chunks in flight
+var streamTimeout = 5000;     // go back to the last ack after a delivered chunk's doesn't come;
+                              // longer than the watch's outbox waits on an ack of its own
+var streamGiveUp = 3 * 60 * 1000; // without progress, once at streamChunkMin, before giving up on a stream
+var streamChunkMin = 256;     // what a chunk shrinks to; smaller ones cost more in messages than they save
+var streamBackoff = 500;      // before resending after a failure, doubling to streamTimeout
+var streamHeader = 8 + 7 + 10; // dictionary + tuple headers + the chunk's own fields
+var streamChunkMax = messageSchema.stream_chunk.fields.filter(function(f) { return f[0] === "data"; })[0][2];
+var streamQueue = [];
+var streamCurrent = null;
+var streamLastId = Math.floor(Math.random() * 256);
+
+var crcTable = null;
+function crc32(bytes) {
+  if(!crcTable) {
+    crcTable = [];
+    for(var n = 0; n < 256; n++) {
+      var c = n;
+      for(var k = 0; k < 8; k++) { c = (c & 1) ? (0xEDB88320 ^ (c >>> 1)) : (c >>> 1); }
+      crcTable[n] = c >>> 0;
+    }
+  }
+  var crc = 0xFFFFFFFF;
+  for(var i = 0; i < bytes.length; i++) {
+    crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >>> 8);
+  }
+  return (crc ^ 0xFFFFFFFF) >>> 0;
+}
+
+// Queue kind/bytes for the watch, done(ok) is called once it's committed or given up on
+function streamSend(kind, bytes, done) {
+  if(!bytes.length) {
+    if(done) { done(true); }
+    return;
+  }
+  streamQueue.push({ kind: kind, bytes: bytes, done: done });
+  if(!streamCurrent) { streamNext(); }
+}
+
+function streamNext() {
+  streamCurrent = streamQueue.shift() || null;
+  var s = streamCurrent;
+  if(!s) { return; }
+  streamLastId = (streamLastId + 1) & 0xFF;
+  s.id = streamLastId;
+  s.crc = crc32(s.bytes);
+  s.acked = 0;        // bytes the watch has confirmed
+  s.delivered = 0;    // bytes the watch has had, as far as the send callbacks say
+  s.rewinds = 0;      // times we've gone back, so a chunk sent before that can tell
+  s.sent = 0;         // bytes sent, acked or not
+  s.failures = 0;     // in a row, without progress
+  s.progressed = new Date().getTime();
+  s.size = streamChunkSize();
+  s.pause = null;     // waiting to resend
+  s.started = new Date().getTime();
+  streamPump();
+}
+
+function streamChunkSize() {
+  var inbox = Number(localStorage.getItem("watch_inbox") || 124); // SDK 2's minimum
+  return Math.max(Math.min(inbox - streamHeader, streamChunkMax), 16);
+}
+
+function streamPump() {
+  var s = streamCurrent;
+  if(s.pause) { return; }
+  var size = s.size;
+  while(s.sent < s.bytes.length && s.sent - s.acked < streamWindow * size) {
+    var offset = s.sent;
+    var data = s.bytes.slice(offset, offset + size);
+    s.sent += data.length;
+    streamChunk(s, offset, data);
+  }
+}
+
+function streamChunk(s, offset, data) {
+  var rewinds = s.rewinds;
+  Pebble.sendAppMessage(messageEncode("stream_chunk", {
+      id: s.id, kind: s.kind, length: s.bytes.length, crc: s.crc,
+      offset: offset, data: data }),
     function(e) {
-      console.log("Successfully delivered message with transactionId=" + 
-                  e.data.transactionId);
+      if(s !== streamCurrent) { return; }
+      // it's there, its ack should follow
+      s.delivered = Math.max(s.delivered, offset + data.length);
+      clearTimeout(s.timer);
+      s.timer = setTimeout(streamTimedOut, streamTimeout);
     },
     function(e) {
-      console.log("Unable to deliver message with transactionId=" + 
-                  e.data.transactionId + " Error is: " + e.error.message);
+      if(s !== streamCurrent || rewinds !== s.rewinds || offset < s.acked) {
+        return; // already being resent, or the watch has it after all
+      }
+      streamRetry(s, offset);
     }
   );
+}
+
+// resend from offset; the gap acks for chunks already on their way say
+// the same, and aren't a reason to go back again
+function streamRewind(s, offset) {
+  s.sent = offset;
+  s.delivered = Math.min(s.delivered, offset);
+  s.rewound = offset;
+  s.rewinds++;
+}
+
+// something went missing: smaller chunks from offset, after a pause
+function streamRetry(s, offset) {
+  s.failures++;
+  if(s.size <= streamChunkMin && new Date().getTime() - s.progressed > streamGiveUp) {
+    streamFinish(false);
+    return;
+  }
+  if(s.failures > 1) { // twice in a row, so likely not a one-off
+    s.size = Math.max(Math.floor(s.size / 2), Math.min(s.size, streamChunkMin));
+  }
+  streamRewind(s, offset);
+  clearTimeout(s.pause);
+  s.pause = setTimeout(function() {
+    s.pause = null;
+    if(s === streamCurrent) { streamPump(); }
+  }, s.failures > 1 ? Math.min(streamBackoff << (s.failures - 2), streamTimeout) : 0);
+}
+
+function streamTimedOut() {
+  var s = streamCurrent;
+  if(!s) { return; }
+  console.log("Stream " + s.id + ": no ack, resending from " + s.acked);
+  streamRetry(s, s.acked);
+}
+
+function streamFinish(ok) {
+  var s = streamCurrent;
+  clearTimeout(s.timer);
+  clearTimeout(s.pause);
+  var seconds = (new Date().getTime() - s.started) / 1000;
+  console.log("Stream " + s.id + (ok ? " delivered " : " failed after ") + s.acked + "/" +
+              s.bytes.length + " bytes, " + Math.round(s.acked / seconds) + " bytes/s");
+  streamNext();
+  if(s.done) { s.done(ok); }
+}
+
+function streamProgress(s, acked) {
+  s.acked = acked;
+  s.failures = 0;
+  s.progressed = new Date().getTime();
+}
+
+function streamAck(msg) {
+  var s = streamCurrent;
+  localStorage.setItem("watch_inbox", msg.inbox);
+  if(!s || msg.id !== s.id) { return; } // for a stream we've already finished
+  switch(msg.status) {
+  case 1: // STREAM_COMPLETE
+    s.acked = s.bytes.length;
+    streamFinish(true);
+    return;
+  case 2: // STREAM_CORRUPT, start over
+    s.acked = 0;
+    streamRetry(s, 0);
+    return;
+  case 3: // STREAM_REJECTED
+    streamFinish(false);
+    return;
+  case 4: // STREAM_GAP
+    if(msg.next > s.acked) { streamProgress(s, msg.next); }
+    if(msg.next < s.sent && msg.next !== s.rewound) {
+      streamRewind(s, msg.next);
+    }
+    break;
+  default: // STREAM_PROGRESS, behind what we've sent while the window's full
+    if(msg.next > s.acked) { streamProgress(s, msg.next); }
+  }
+  if(s.acked >= s.delivered) {
+    clearTimeout(s.timer); // nothing the watch has had is waiting on an ack
+  }
+  streamPump();
+}
+
+function applyGoalChanges(changes, sent) {
+  changes.forEach(function(change) {
+    if(change.version) { sent[change.slug] = change.version; } else { delete sent[change.slug]; }
+  });
+}
+
+// version is goalsVersion() of what the watch has once these changes are
+// in; a replace batch is everything it should have.  goals_sent only ever
+// records what the watch has stored: it rejects a batch it couldn't.
+// done(ok) once the watch has answered or we've given up.
+function sendGoals(changes, replace, version, done) {
+  var records = [];
+  changes.forEach(function(change) { records = records.concat(change.bytes); });
+  var bytes = recordEncode("goal_batch", { version: version, flags: replace ? 1 : 0, // GOAL_BATCH_REPLACE
+                                           records: records });
+  streamSend(1, bytes, function(ok) {
+    if(ok) { // else they're still unsent, so we'll try again next time
+      var sent = replace ? {} : JSON.parse(localStorage.getItem("goals_sent") || "{}");
+      applyGoalChanges(changes, sent);
+      localStorage.setItem("goals_sent", JSON.stringify(sent));
+    }
+    done(ok);
+  });
+}
+
+// A goal as the watch's goal_record (see goal_store.h).
+// The watch keeps local time, so the deadline is shifted to match.
+function encodeGoal(goal, flags) {
+  return recordEncode("goal_record", {
+    slug:       goal.slug,
+    losedate:   (goal.losedate || 0) - new Date().getTimezoneOffset() * 60,
+    updated_at: goal.updated_at || 0,
+    rate:       Math.round((goal.rate || 0) * 1000),
+    safebuf:    goal.safebuf || 0,
+    runits:     (goal.runits || "d").charCodeAt(0),
+    flags:      flags
+  });
+}
+
+// Fetch all of the user's goals and send the watch the ones that changed
+// since we last sent them, and deletions for the ones that are gone.  With
+// replace, the watch's goals are unknown, so it gets every goal as one batch
+// that replaces what it has.  Either way the watch only gets as many as it
+// holds: the active one, then the ones due soonest; deletions go first, to
+// make room.
+//
+// One fetch runs at a time, its streams included, so each one starts from
+// what the last one left the watch with; one asked for meanwhile runs next.
+var goalMax = 32; // GOAL_MAX
+var goalsFetching = false;
+var goalsAgain = null; // null, or whether the next fetch replaces
+
+function fetchGoals(replace) {
+  if(goalsFetching) {
+    goalsAgain = goalsAgain || !!replace;
+    return;
+  }
+  var options = getOptions();
+  if(!options.buser || !options.btoken) { return; }
+  goalsFetching = true;
+  function done() {
+    goalsFetching = false;
+    var again = goalsAgain;
+    goalsAgain = null;
+    if(again !== null) { fetchGoals(again); }
+  }
+  var req = new XMLHttpRequest();
+  req.open("GET", beeminderApi + "/users/" + encodeURIComponent(options.buser) +
+           "/goals.json?auth_token=" + encodeURIComponent(options.btoken), true);
+  req.onload = function() {
+    if(req.status !== 200) {
+      console.log("Goal fetch failed: " + req.status);
+      done();
+      return;
+    }
+    var goals = JSON.parse(req.responseText);
+    var sent = replace ? {} : JSON.parse(localStorage.getItem("goals_sent") || "{}");
+    var changes = [];
+    var present = {};
+    goals.sort(function(a, b) {
+      return (b.slug === options.bgoal) - (a.slug === options.bgoal) ||
+             (a.losedate || 0) - (b.losedate || 0) || (a.slug < b.slug ? -1 : a.slug > b.slug ? 1 : 0);
+    });
+    goals = goals.slice(0, goalMax);
+    goals.forEach(function(goal) { present[goal.slug] = true; });
+    Object.keys(sent).forEach(function(slug) {
+      if(present[slug]) { return; }
+      changes.push({ bytes: encodeGoal({ slug: slug }, 2), // GOAL_FLAG_DELETED
+                     slug: slug, version: null });
+    });
+    goals.forEach(function(goal) {
+      var flags = goal.slug === options.bgoal ? 1 : 0; // GOAL_FLAG_ACTIVE
+      var version = goal.updated_at + ":" + flags;
+      if(sent[goal.slug] === version) { return; } // the watch already has it
+      changes.push({ bytes: encodeGoal(goal, flags), slug: goal.slug, version: version });
+    });
+    if(!changes.length && !replace) {
+      done();
+      return;
+    }
+    // as few streams as the watch's buffer allows, STREAM_KIND_GOALS; a
+    // replace batch of goalMax goals always fits in one
+    var perStream = Math.floor((streamMax - 5) / 40); // goal_batch header, sizeof(goal_record)
+    var after = JSON.parse(JSON.stringify(sent));
+    var streams = Math.max(Math.ceil(changes.length / perStream), 1);
+    function sendFrom(i) {
+      var batch = changes.slice(i * perStream, (i + 1) * perStream);
+      applyGoalChanges(batch, after);
+      sendGoals(batch, replace, goalsVersion(after), function(ok) {
+        // each batch's version counts the ones before it in, so stop at one the watch didn't store
+        if(ok && i + 1 < streams) { sendFrom(i + 1); } else { done(); }
+      });
+    }
+    sendFrom(0);
+  };
+  req.onerror = function() {
+    console.log("Goal fetch failed");
+    done();
+  };
+  req.send(null);
+}
+
+// Weather for the bottom slot.
+//
+// Positions are rounded to a ~10km cell and weather is cached per cell (and
+// units) for weatherTtl, so moving around town or a reconnect doesn't cost a
+// fetch.  A position fix is reused for positionMaxAge before GPS is asked
+// again.  The watch only gets a message when the packed values change, or
+// every weatherResend so it can tell old weather from unchanged weather.
+var weatherSlot = 2;                   // SLOT_ID_WEATHER
+var weatherTtl = 30 * 60 * 1000;
+var positionMaxAge = 60 * 60 * 1000;
+var weatherResend = 2 * 60 * 60 * 1000;
+
+function weatherCell(coords) {
+  return (Math.round(coords.latitude * 10) / 10) + "," +
+         (Math.round(coords.longitude * 10) / 10);
+}
+
+// WMO weather code to the watch's WEATHER_* condition
+function weatherCondition(code) {
+  if(code === 0)               { return 1; } // clear
+  if(code <= 2)                { return 2; } // partly cloudy
+  if(code === 3)               { return 3; } // cloudy
+  if(code === 45 || code === 48) { return 4; } // fog
+  if((code >= 71 && code <= 77) || code === 85 || code === 86) { return 6; } // snow
+  if(code >= 95)               { return 7; } // thunder
+  if(code >= 51 && code <= 82) { return 5; } // drizzle and rain
+  return 0;
+}
+
+// force: the watch asked, so send it even if it's what we last sent
+function fetchWeather(force) {
+  var options = getOptions();
+  if(Number(options.slot_bot) !== weatherSlot) { return; }
+  var last = JSON.parse(localStorage.getItem("weather_position") || "null");
+  if(last && new Date().getTime() - last.time < positionMaxAge) {
+    weatherForCell(last.cell, options, force);
+    return;
+  }
+  navigator.geolocation.getCurrentPosition(
+    function(pos) {
+      var cell = weatherCell(pos.coords);
+      localStorage.setItem("weather_position",
+                           JSON.stringify({ cell: cell, time: new Date().getTime() }));
+      weatherForCell(cell, options, force);
+    },
+    function(err) {
+      console.log("Location unavailable: " + err.message);
+      if(last) { weatherForCell(last.cell, options, force); }
+    },
+    { enableHighAccuracy: false, maximumAge: positionMaxAge, timeout: 15000 }
+  );
+}
+
+function weatherForCell(cell, options, force) {
+  var units = options.wunits === "f" ? "fahrenheit" : "celsius";
+  var key = cell + "," + units;
+  var now = new Date().getTime();
+  var cache = JSON.parse(localStorage.getItem("weather_cache") || "{}");
+  if(cache[key] && now - cache[key].time < weatherTtl) {
+    sendWeather(cache[key].weather, force);
+    return;
+  }
+  var latlon = cell.split(",");
+  var req = new XMLHttpRequest();
+  req.open("GET", weatherApi + "?latitude=" + latlon[0] + "&longitude=" + latlon[1] +
+           "&current_weather=true&daily=temperature_2m_max,temperature_2m_min" +
+           "&forecast_days=1&timezone=auto&temperature_unit=" + units, true);
+  req.onload = function() {
+    if(req.status !== 200) {
+      console.log("Weather fetch failed: " + req.status);
+      return;
+    }
+    var r = JSON.parse(req.responseText);
+    var weather = [Math.round(r.current_weather.temperature),
+                   Math.round(r.daily.temperature_2m_max[0]),
+                   Math.round(r.daily.temperature_2m_min[0]),
+                   weatherCondition(r.current_weather.weathercode)];
+    Object.keys(cache).forEach(function(k) { // only fresh cells are worth keeping
+      if(now - cache[k].time >= weatherTtl) { delete cache[k]; }
+    });
+    cache[key] = { time: now, weather: weather };
+    localStorage.setItem("weather_cache", JSON.stringify(cache));
+    sendWeather(weather, force);
+  };
+  req.send(null);
+}
+
+// Send temp, hi, lo and condition as the watch's weather message
+function sendWeather(weather, force) {
+  var payload = messageEncode("weather", { temp: weather[0], hi: weather[1],
+                                           lo: weather[2], condition: weather[3] });
+  var packed = payload.weather.join();
+  var sent = JSON.parse(localStorage.getItem("weather_sent") || "null");
+  var now = new Date().getTime();
+  if(!force && sent && sent.packed === packed && now - sent.time < weatherResend) {
+    return; // the watch already has it
+  }
+  Pebble.sendAppMessage(payload,
+    function(e) {
+      localStorage.setItem("weather_sent", JSON.stringify({ packed: packed, time: now }));
+    },
+    function(e) {
+      console.log("Unable to deliver weather: " + e.error.message);
+    }
+  );
+}
+
+// The watch's flight recorder (see flightrec.h): communication events kept
+// on the watch, fetched from where we left off and kept here as readable text
+var flightEvents = { 1: "start", 2: "dropped", 3: "send failed", 4: "outbox busy",
+                     5: "link up", 6: "link down", 7: "config received" };
+var appMessageResults = { 2: "SEND_TIMEOUT", 4: "SEND_REJECTED", 8: "NOT_CONNECTED",
+                          16: "APP_NOT_RUNNING", 32: "INVALID_ARGS", 64: "BUSY",
+                          128: "BUFFER_OVERFLOW", 512: "ALREADY_RELEASED",
+                          4096: "OUT_OF_MEMORY", 8192: "CLOSED", 16384: "INTERNAL_ERROR" };
+var flightRecordSize = 8; // sizeof(flightrec_record)
+var flightLogLines = 200;
+
+function requestFlightLog() {
+  var from = Number(localStorage.getItem("flight_seq") || 0);
+  Pebble.sendAppMessage(messageEncode("flightrec_request", { from: from }),
+    function(e) {},
+    function(e) {
+      console.log("Unable to request flight log: " + e.error.message);
+    }
+  );
+}
+
+// uint32 local time, uint8 event, uint8 message id, uint16 AppMessageResult
+function decodeFlightLog(bytes) {
+  var tzOffset = new Date().getTimezoneOffset() * 60; // the watch keeps local time
+  var lines = [];
+  for(var i = 0; i + flightRecordSize <= bytes.length; i += flightRecordSize) {
+    var t = (bytes[i] | (bytes[i+1] << 8) | (bytes[i+2] << 16)) + bytes[i+3] * 16777216;
+    var line = new Date((t + tzOffset) * 1000).toISOString() + " " +
+               (flightEvents[bytes[i+4]] || "event " + bytes[i+4]);
+    var message = bytes[i+5];
+    if(message) {
+      var name = "message " + message;
+      Object.keys(messageSchema).forEach(function(n) {
+        if(messageSchema[n].id === message) { name = n; }
+      });
+      line += " " + name;
+    }
+    var result = bytes[i+6] | (bytes[i+7] << 8);
+    if(result) { line += " " + (appMessageResults[result] || "result " + result); }
+    lines.push(line);
+  }
+  return lines;
+}
+
+function saveFlightLog(msg) {
+  var seq = Number(localStorage.getItem("flight_seq") || 0);
+  var log = JSON.parse(localStorage.getItem("flight_log") || "[]");
+  if(msg.head < seq) { // reinstalled, the watch started over
+    localStorage.setItem("flight_seq", 0);
+    requestFlightLog();
+    return;
+  }
+  if(msg.from > seq) {
+    log.push((msg.from - seq) + " events lost, the watch only keeps the latest");
+  }
+  var lines = decodeFlightLog(msg.records);
+  lines.forEach(function(line) { console.log("Watch: " + line); });
+  log = log.concat(lines).slice(-flightLogLines);
+  localStorage.setItem("flight_log", JSON.stringify(log));
+  localStorage.setItem("flight_seq", msg.from + lines.length);
+  if(lines.length && msg.from + lines.length < msg.head) {
+    requestFlightLog(); // more where that came from
+  }
+}
+
+Pebble.addEventListener("webviewclosed", function(e) {
+  console.log("Configuration closed");
+  var options;
+  try {
+    options = JSON.parse(decodeURIComponent(e.response));
+  } catch(err) {
+    return; // cancelled
+  }
+  if(!options) { return; }
+  console.log("Options = " + JSON.stringify(options));
+  var saved = getOptions();
+  phoneOptions.forEach(function(key) {
+    if(key in options) { saved[key] = options[key]; }
+    delete options[key];
+  });
+  if("slot_bot" in options) { saved.slot_bot = options.slot_bot; } // the watch needs it too
+  localStorage.setItem("pebblebee_options", JSON.stringify(saved));
+  // numbered, and kept, so the watch can be caught up if it misses this one
+  options.config_version = Number(localStorage.getItem("config_version") || 0) % 65535 + 1;
+  localStorage.setItem("config_version", options.config_version);
+  localStorage.setItem("watch_options", JSON.stringify(options));
+  submitDatapoints(); // in case we were waiting on credentials
+  fetchGoals(); // the active goal may have changed
+  fetchWeather();
+  sendReliably(options, "configuration");
 });
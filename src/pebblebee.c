@@ -1,4 +1,11 @@
 #include <pebble.h>
+#include "battlog.h"
+#include "goal_store.h"
+#include "goal_alert.h"
+#include "flightrec.h"
+#include "stream.h"
+#include "messages.auto.h"
+#include "layout.auto.h"
 #define DEBUGLOG 0
 #define TRANSLOG 0
 
@@ -10,7 +17,9 @@ static TextLayer * date_layer;
 static TextLayer * time_layer;
 static TextLayer * week_layer;
 static TextLayer * day_layer;
+static TextLayer * countdown_layer;
 static Layer * calendar_layer;
+static Layer * weather_layer;
 static Layer * statusbar;
 static Layer * slot_top;
 static Layer * slot_bot;
@@ -21,86 +30,122 @@ static GBitmap *image_noconnection_icon;
 static BitmapLayer *bmp_charging_layer;
 static GBitmap *image_charging_icon;
 static GBitmap *image_hourvibe_icon;
+static GBitmap *image_weather_atlas;
 static TextLayer *text_connection_layer;
-static TextLayer *text_battery_layer;
+static TextLayer *alert_badge_layer;      // goals about to derail, in place of the charging icon
+static Layer *battery_meter_layer;
 
-static InverterLayer *inverter_layer;
-static InverterLayer *battery_meter_layer;
+// theme colors, foreground/background swap for light mode (see set_theme)
+static GColor theme_fg = GColorWhite;
+static GColor theme_bg = GColorBlack;
 
 // battery info, instantiate to 'worst scenario' to prevent false hopes
 static uint8_t battery_percent = 10;
+static char battery_text[] = "100";
 static bool battery_charging = false;
 static bool battery_plugged = false;
-static uint8_t sent_battery_percent = 10;
-static bool sent_battery_charging = false;
-static bool sent_battery_plugged = false;
-AppTimer *battery_sending = NULL;
+// battery log written by the worker, see battlog.h
+static uint32_t log_head = 0;     // next seq the worker will write
+static uint32_t log_sent = 0;     // first seq the phone hasn't acknowledged
+static uint8_t log_sending = 0;   // records in flight to the phone
+static uint32_t log_retry_ms = 0; // wait before retrying a failed upload, 0 = none failed
+static bool log_waiting = false;  // an upload found the outbox busy
+AppTimer *log_upload_timer = NULL;
+// datapoint entry: a tap arms, a second tap within DP_CONFIRM_MS queues +1
+static bool dp_armed = false;
+static uint8_t dp_sending = 0;    // queued entries in flight to the phone
+static bool dp_waiting = false;   // a flush found the outbox busy
+AppTimer *dp_armed_timer = NULL;
+AppTimer *dp_ack_timer = NULL;    // running while a batch waits for the phone's ack
+// goal deadline countdown, see update_countdown()
+static uint32_t goal_losedate = 0;        // the active goal's, watch local time, 0 = none
+static uint8_t goals_alerting = 0;        // goals inside an alert threshold, see goal_alert.h
+static uint32_t goals_version = 0;        // the phone's version of the goal store, see goal_batch
+static TimeUnits tick_unit = MINUTE_UNIT; // what handle_tick is subscribed to
 // connected info
 static bool bluetooth_connected = false;
 // suppress vibration
 static bool vibe_suppression = true;
 static int8_t timezone_offset = 0;
+static int8_t timezone_next_offset = 0;
+static uint32_t timezone_transition = 0; // when timezone_next_offset applies, 0 = no change known
+// startup instrumentation: when init() began, and whether the first frame is up
+static time_t startup_s = 0;
+static uint16_t startup_ms = 0;
+static bool first_frame_drawn = false;
+// what needs recomputing on the next redraw pass, see invalidate()
+static uint8_t redraw_flags = 0;
+static AppTimer *redraw_timer = NULL;
+// the datetime language blob is only read once the day/month text needs it
+static bool lang_datetime_loaded = false;
+// activity counters for energy profiling, reset whenever they're sent
+static uint16_t message_count = 0;
+static uint16_t vibe_count = 0;
 
 // define the persistent storage key(s)
 #define PK_SETTINGS      0
 #define PK_LANG_GEN      1
 #define PK_LANG_DATETIME 2
-
-// define the appkeys used for appMessages
-#define AK_STYLE_INV     0
-#define AK_STYLE_DAY_INV 1
-#define AK_STYLE_GRID    2
-#define AK_VIBE_HOUR     3
-#define AK_INTL_DOWO     4
-//#define AK_INTL_FMT_DATE 5 // INCOMPLETE
-#define AK_STYLE_AM_PM   6
-#define AK_STYLE_DAY     7
-#define AK_STYLE_WEEK    8
-#define AK_INTL_FMT_WEEK 9
-#define AK_VERSION       10 // UNUSED
-#define AK_VIBE_PAT_DISCONNECT   11
-#define AK_VIBE_PAT_CONNECT      12
-#define AK_STRFTIME_FORMAT       13
-#define AK_TRACK_BATTERY         14
-
-#define AK_MESSAGE_TYPE          99
-#define AK_SEND_BATT_PERCENT    100
-#define AK_SEND_BATT_CHARGING   101
-#define AK_SEND_BATT_PLUGGED    102
-#define AK_TIMEZONE_OFFSET      103
-
-// primary coordinates
-#define DEVICE_WIDTH        144
-#define DEVICE_HEIGHT       168
-#define LAYOUT_STAT           0 // 20 tall
-#define LAYOUT_SLOT_TOP      24 // 72 tall
-#define LAYOUT_SLOT_BOT      96 // 72 tall, 4px gap above
-#define LAYOUT_SLOT_HEIGHT   72
-#define STAT_BATT_LEFT       96 // LEFT + WIDTH + NIB_WIDTH <= 143
-#define STAT_BATT_TOP         4
-#define STAT_BATT_WIDTH      44 // should be multiple of 10, after subtracting 4 (2 pixels/side for the 'border')
-#define STAT_BATT_HEIGHT     15
-#define STAT_BATT_NIB_WIDTH   3 // >= 3
-#define STAT_BATT_NIB_HEIGHT  5 // >= 3
-#define STAT_BT_ICON_LEFT    -2 // 0
-#define STAT_BT_ICON_TOP      2
-#define STAT_CHRG_ICON_LEFT  76
-#define STAT_CHRG_ICON_TOP    2
-
-// relative coordinates (relative to SLOTs)
-#define REL_CLOCK_DATE_LEFT       0
-#define REL_CLOCK_DATE_TOP       -9
-#define REL_CLOCK_DATE_HEIGHT    30 // date/time overlap, due to the way text is 'positioned'
-#define REL_CLOCK_TIME_LEFT       0
-#define REL_CLOCK_TIME_TOP        7
-#define REL_CLOCK_TIME_HEIGHT    60 // date/time overlap, due to the way text is 'positioned'
-#define REL_CLOCK_SUBTEXT_TOP    56 // time/ampm overlap, due to the way text is 'positioned'
+#define PK_ENERGY        3
+// 4-6 and 16-23 are the battery log, see battlog.h
+#define PK_DP_QUEUE      7
+#define PK_WEATHER      10
+#define PK_GOALS_VERSION 14
+// 11-13 are the flight recorder, see flightrec.h
+// 9 and 64-95 are the goal store, see goal_store.h
+#define PERSIST_BUDGET 4096 // bytes of persistent storage per app, for all of the above
+
+// appMessage keys (AK_*) and messages (MSG_*) are generated from messages.json
+
+#define BATTLOG_BATCH       16   // battery log records per upload message
+#define LOG_RETRY_MIN_MS 10000   // first retry of a failed upload, doubling from there
+#define LOG_RETRY_MAX_MS 900000  // to at most one per sample
+#define FLIGHTREC_BATCH     16   // flight recorder records per message to the phone
+#define HELLO_NEED_CONFIG 0x01   // hello_reply.needs: the phone should resend the configuration
+#define HELLO_NEED_GOALS  0x02   // and every goal
+#define HELLO_NEED_WEATHER 0x04  // and the weather, if the slot shows it
+#define WEATHER_WANTED_S  1800   // weather older than the phone's cache of it is worth a fetch
+#define GOAL_BATCH_REPLACE 0x01  // goal_batch.flags: the batch is every goal, forget the rest
+#define DP_QUEUE_MAX        32   // datapoints held on the watch until the phone has them
+#define DP_CONFIRM_MS     3000   // how long a first tap stays armed
+#define DP_ACK_TIMEOUT_MS 10000   // resend datapoints if the phone hasn't acked by then
+#define COUNTDOWN_MINUTES_WITHIN 86400 // count down in h:mm inside a day
+#define COUNTDOWN_SECONDS_WITHIN   600 // and in m:ss, ticking every second, inside 10 minutes
+#define COUNTDOWN_ALL_UNITS (SECOND_UNIT | MINUTE_UNIT | HOUR_UNIT)
+#define WEATHER_ICON_SIZE   24   // condition icons are 24x24 cells of one atlas strip
+#define WEATHER_CONDITIONS   8   // cells in the atlas, see WEATHER_* below
+#define WEATHER_STALE_S  10800   // the phone resends at least every 2 hours, blank the temps after 3
+#define DRAIN_SCALE         16   // drain rates are kept in 1/16ths of a percent per hour
+#define DRAIN_SMOOTH_SHIFT   2   // exponential smoothing, alpha = 1/4
+
+// redraw flags, collected by invalidate() and handled together by redraw()
+#define REDRAW_CONNECTION 0x01 // recompute the status text
+#define REDRAW_SUBTEXT    0x02 // recompute week/day text and the time position
+#define REDRAW_BATTERY    0x04
+#define REDRAW_CALENDAR   0x08
+#define REDRAW_DATETIME   0x10
+#define REDRAW_WEATHER    0x20
+#define REDRAW_ROOT       0x40 // everything, e.g. after a theme change
+#define REDRAW_STATUS     0x80 // pick the charging/alert/hourly vibe indicator
+
+// screen layout (DEVICE_*, LAYOUT_*, STAT_*, REL_CLOCK_*, REL_WEATHER_*, CAL_*)
+// is generated per platform from layouts.json, see tools/layoutgen.py
 
 #define SLOT_ID_CLOCK_1  0
 #define SLOT_ID_CALENDAR 1
 #define SLOT_ID_WEATHER  2
 #define SLOT_ID_CLOCK_2  3
 
+// weather condition codes, also the cell index in the weather atlas
+#define WEATHER_UNKNOWN       0
+#define WEATHER_CLEAR         1
+#define WEATHER_PARTLY_CLOUDY 2
+#define WEATHER_CLOUDY        3
+#define WEATHER_FOG           4
+#define WEATHER_RAIN          5
+#define WEATHER_SNOW          6
+#define WEATHER_THUNDER       7
+
 // Create a struct to hold our persistent settings...
 typedef struct persist {
   uint8_t version;                // version key
@@ -118,6 +163,12 @@ typedef struct persist {
   uint8_t vibe_pat_connect;       // vibration pattern for connect
   char *strftime_format;          // custom date_format string (date_format = 255)
   uint8_t track_battery;          // track battery information
+  uint8_t dp_tap;                 // log a datapoint with a double tap
+  uint8_t slot_bot;               // what the bottom slot shows (SLOT_ID_*)
+  uint8_t alert_warn;             // hours before a derail to warn, 0 = off
+  uint8_t alert_urgent;           // hours before a derail to alert again, 0 = off
+  uint8_t vibe_pat_alert;         // vibration pattern for goal alerts
+  uint16_t config_version;        // the phone's count of configurations, see hello
 } __attribute__((__packed__)) persist;
 
 typedef struct persist_datetime_lang { // 247 bytes
@@ -134,6 +185,22 @@ typedef struct persist_general_lang { // 101 bytes
 //                                   101 bytes
 } __attribute__((__packed__)) persist_general_lang;
 
+typedef struct persist_energy { // 42 bytes
+  uint8_t last_percent;           // battery percent when last_time was recorded
+  uint32_t last_time;             // time of the last observed drop (0 = waiting for one)
+  uint8_t last_features;          // feature mask in effect since last_time
+  uint16_t drain[FEAT_CONFIGS];   // smoothed drain per configuration (DRAIN_SCALE * %/hour, 0 = unknown)
+  uint32_t log_seq;               // next battery log record to feed in
+} __attribute__((__packed__)) persist_energy;
+
+typedef struct persist_weather { // 8 bytes
+  int8_t temp;                    // current temperature, in the phone's configured units
+  int8_t hi;                      // today's high
+  int8_t lo;                      // today's low
+  uint8_t condition;              // WEATHER_*
+  uint32_t received;              // when the phone last sent it, 0 = never
+} __attribute__((__packed__)) persist_weather;
+
 persist settings = {
   .version    = 10,
   .inverted   = 0, // no, dark
@@ -150,6 +217,51 @@ persist settings = {
   .vibe_pat_connect = 0, // no vibe
   .strftime_format = "%Y-%m-%d",
   .track_battery = 0, // no battery tracking by default
+  .dp_tap = 0, // no datapoint entry by default
+  .slot_bot = SLOT_ID_CALENDAR,
+  .alert_warn = 24, // a day out
+  .alert_urgent = 3,
+  .vibe_pat_alert = 2, // double vibe
+  .config_version = 0, // never configured
+};
+
+persist_weather weather = {
+  .condition = WEATHER_UNKNOWN,
+  .received = 0,
+};
+
+typedef struct dp_entry { // 7 bytes
+  uint16_t id;                    // assigned by the watch, the phone dedupes on it
+  uint8_t goal;                   // goal slot, 0 = the configured goal
+  uint16_t day;                   // local days since the epoch
+  int16_t value;                  // summed value of merged entries
+} __attribute__((__packed__)) dp_entry;
+
+typedef struct persist_dp_queue { // 228 bytes
+  uint16_t next_id;
+  uint8_t count;
+  uint8_t sealed;                 // leading entries that have been sent at least once
+  dp_entry entries[DP_QUEUE_MAX];
+} __attribute__((__packed__)) persist_dp_queue;
+
+// everything we keep, at its largest: about 3.5 KB, so the store and the logs
+// are sized to leave some room to spare
+_Static_assert(sizeof(persist) + sizeof(persist_general_lang) + sizeof(persist_datetime_lang)
+               + sizeof(persist_energy) + sizeof(persist_weather) + sizeof(persist_dp_queue)
+               + sizeof(int32_t) /* PK_GOALS_VERSION */
+               + BATTLOG_BYTES + FLIGHTREC_BYTES + GOAL_STORE_BYTES <= PERSIST_BUDGET - 256,
+               "persistent storage over budget");
+
+persist_dp_queue dp_queue = {
+  .next_id = 1,
+  .count = 0,
+  .sealed = 0,
+};
+
+persist_energy energy = {
+  .last_percent = 0,
+  .last_time = 0,
+  .last_features = 0,
 };
 
 persist_datetime_lang lang_datetime = {
@@ -184,17 +296,47 @@ struct tm *get_time()
 }
 
 void setColors(GContext* ctx) {
-  window_set_background_color(window, GColorBlack);
-  graphics_context_set_stroke_color(ctx, GColorWhite);
-  graphics_context_set_fill_color(ctx, GColorBlack);
-  graphics_context_set_text_color(ctx, GColorWhite);
+  graphics_context_set_stroke_color(ctx, theme_fg);
+  graphics_context_set_fill_color(ctx, theme_bg);
+  graphics_context_set_text_color(ctx, theme_fg);
 }
 
 void setInvColors(GContext* ctx) {
-  window_set_background_color(window, GColorWhite);
-  graphics_context_set_stroke_color(ctx, GColorBlack);
-  graphics_context_set_fill_color(ctx, GColorWhite);
-  graphics_context_set_text_color(ctx, GColorBlack);
+  graphics_context_set_stroke_color(ctx, theme_bg);
+  graphics_context_set_fill_color(ctx, theme_fg);
+  graphics_context_set_text_color(ctx, theme_bg);
+}
+
+// The icons are white on black, as the dark theme draws them.  Black and
+// white screens draw them inverted for the light theme; color screens can't
+// invert a palettized bitmap, so there the palette itself is flipped.
+#if LAYOUT_COLOR
+#define ICON_OP GCompOpSet
+static bool icons_light = false; // whether the loaded icons' palettes are flipped
+
+static void flip_icon(GBitmap *icon) {
+  GColor *palette = gbitmap_get_palette(icon);
+  int colors = 0;
+  switch (gbitmap_get_format(icon)) {
+  case GBitmapFormat1BitPalette: colors = 2; break;
+  case GBitmapFormat2BitPalette: colors = 4; break;
+  case GBitmapFormat4BitPalette: colors = 16; break;
+  default: return;
+  }
+  for (int i = 0; i < colors; i++) {
+    palette[i].argb ^= 0x3F; // the RGB bits, alpha stays
+  }
+}
+#else
+#define ICON_OP (settings.inverted ? GCompOpAssignInverted : GCompOpAssign)
+#endif
+
+GBitmap *load_icon(uint32_t resource_id) {
+  GBitmap *icon = gbitmap_create_with_resource(resource_id);
+#if LAYOUT_COLOR
+  if (icons_light) { flip_icon(icon); }
+#endif
+  return icon;
 }
 
 void calendar_layer_update_callback(Layer* me, GContext* ctx) {
@@ -280,10 +422,6 @@ void calendar_layer_update_callback(Layer* me, GContext* ctx) {
 // ---------------------------
 
   #define CAL_DAYS   7   // number of columns (days of the week)
-  #define CAL_WIDTH  20  // width of columns
-  #define CAL_GAP    1   // gap around calendar
-  #define CAL_LEFT   2   // left side of calendar
-  #define CAL_HEIGHT 18  // how tall rows should be depends on number of weeks
 
   int weeks  =  3;  // always display 3 weeks: previous, current, next
   if(!show_last) { weeks--; }
@@ -394,12 +532,22 @@ void update_time_text() {
   text_layer_set_text(time_layer, time_text);
 }
 
+void ensure_lang_datetime() {
+  if (lang_datetime_loaded) { return; }
+  if (persist_exists(PK_LANG_DATETIME)) {
+    persist_read_data(PK_LANG_DATETIME, &lang_datetime, sizeof(lang_datetime) );
+  }
+  lang_datetime_loaded = true;
+}
+
 void update_day_text(TextLayer *which_layer) {
+  ensure_lang_datetime();
   struct tm *currentTime = get_time();
   text_layer_set_text(which_layer, lang_datetime.DaysOfWeek[currentTime->tm_wday]);
 }
 
 void update_month_text(TextLayer *which_layer) {
+  ensure_lang_datetime();
   struct tm *currentTime = get_time();
   text_layer_set_text(which_layer, lang_datetime.monthsNames[currentTime->tm_mon]);
 }
@@ -422,19 +570,37 @@ void update_week_text(TextLayer *which_layer) {
 
 
 void update_timezone_text(TextLayer *which_layer) {
-  static char timezone_text[7];
-  if (timezone_offset > 0) {
-    snprintf(timezone_text, sizeof(timezone_text), "GMT-%d", timezone_offset);
-  } else {
-    snprintf(timezone_text, sizeof(timezone_text), "GMT+%d", abs(timezone_offset));
-  }
+  static char timezone_text[] = "GMT+128";
+  // offsets are hours west of UTC, the opposite sign to how GMT+n reads
+  int hours = timezone_offset > 0 ? timezone_offset : -timezone_offset;
+  snprintf(timezone_text, sizeof(timezone_text), "GMT%c%d", timezone_offset > 0 ? '-' : '+', hours);
   text_layer_set_text(which_layer, timezone_text);
 }
 
+// week_layer and day_layer are only created the first time they're shown
+TextLayer *subtext_layer_create(GRect frame, GTextAlignment alignment) {
+  TextLayer *layer = text_layer_create(frame);
+  text_layer_set_text_color(layer, theme_fg);
+  text_layer_set_background_color(layer, GColorClear);
+  text_layer_set_font(layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
+  text_layer_set_text_alignment(layer, alignment);
+  layer_add_child(datetime_layer, text_layer_get_layer(layer));
+  return layer;
+}
+
 void process_show_week() {
+  if (settings.show_week == 0) {
+    if (week_layer != NULL) {
+      layer_set_hidden(text_layer_get_layer(week_layer), true);
+    }
+  } else if (week_layer == NULL) {
+    week_layer = subtext_layer_create(GRect(4, REL_CLOCK_SUBTEXT_TOP, DEVICE_WIDTH - 4, 16),
+                                      GTextAlignmentLeft);
+  } else {
+    layer_set_hidden(text_layer_get_layer(week_layer), false);
+  }
   switch(settings.show_week) {
   case 0: // Hide
-    //layer_set_hidden(text_layer_get_layer(week_layer), true);
     return;
   case 1: // Show Week
     update_week_text(week_layer);
@@ -446,9 +612,18 @@ void process_show_week() {
 }
 
 void process_show_day() {
+  if (settings.show_day == 0) {
+    if (day_layer != NULL) {
+      layer_set_hidden(text_layer_get_layer(day_layer), true);
+    }
+  } else if (day_layer == NULL) {
+    day_layer = subtext_layer_create(GRect(28, REL_CLOCK_SUBTEXT_TOP, DEVICE_WIDTH - 56, 16),
+                                     GTextAlignmentCenter);
+  } else {
+    layer_set_hidden(text_layer_get_layer(day_layer), false);
+  }
   switch ( settings.show_day ) {
   case 0: // Hide
-    //layer_set_hidden(text_layer_get_layer(day_layer), true);
     return;
   case 1: // Show Day
     update_day_text(day_layer);
@@ -469,9 +644,9 @@ void position_time_layer() {
   // potentially adjust the clock position, if we've added/removed the week, day, or AM/PM layers
   int time_offset = 0;
   if(!settings.show_day && !settings.show_week) {
-    time_offset = 4;
+    time_offset = REL_CLOCK_TIME_NUDGE;
     if(!settings.show_am_pm) {
-      time_offset = 8;
+      time_offset = 2 * REL_CLOCK_TIME_NUDGE;
     }
   }
   layer_set_frame( text_layer_get_layer(time_layer), 
@@ -486,10 +661,18 @@ void update_datetime_subtext() {
     position_time_layer();
 }
 
+static void check_goal_alerts();
+
+static void startup_deferred(void *data);
+
 void datetime_layer_update_callback(Layer* me, GContext* ctx) {
     (void)me;
     setColors(ctx);
     update_time_text();
+    if (!first_frame_drawn) {
+      first_frame_drawn = true;
+      app_timer_register(0, &startup_deferred, NULL);
+    }
 }
 
 void statusbar_layer_update_callback(Layer *me, GContext* ctx) {
@@ -515,11 +698,55 @@ void slot_top_layer_update_callback(Layer *me, GContext* ctx) {
 }
 
 void slot_bot_layer_update_callback(Layer *me, GContext* ctx) {
-// TODO: configurable: draw appropriate slot
+// the slot's content is a child layer, see apply_slot_bot
+}
+
+void weather_layer_update_callback(Layer *me, GContext* ctx) {
+  if (weather.received == 0) {
+    return; // nothing from the phone yet
+  }
+  if (image_weather_atlas == NULL) {
+    image_weather_atlas = load_icon(RESOURCE_ID_IMAGE_WEATHER_ATLAS);
+  }
+  uint8_t condition = weather.condition < WEATHER_CONDITIONS ? weather.condition : WEATHER_UNKNOWN;
+  GBitmap *icon = gbitmap_create_as_sub_bitmap(image_weather_atlas,
+    GRect(condition * WEATHER_ICON_SIZE, 0, WEATHER_ICON_SIZE, WEATHER_ICON_SIZE));
+  graphics_context_set_compositing_mode(ctx, ICON_OP);
+  graphics_draw_bitmap_in_rect(ctx, icon,
+    GRect(REL_WEATHER_ICON_LEFT, REL_WEATHER_ICON_TOP, WEATHER_ICON_SIZE, WEATHER_ICON_SIZE));
+  gbitmap_destroy(icon);
+
+  static char temp_text[] = "-128\u00B0";
+  static char hilo_text[] = "H -128  L -128";
+  if (time(NULL) - weather.received > WEATHER_STALE_S) {
+    strcpy(temp_text, "--\u00B0");
+    hilo_text[0] = '\0';
+  } else {
+    snprintf(temp_text, sizeof(temp_text), "%d\u00B0", weather.temp);
+    snprintf(hilo_text, sizeof(hilo_text), "H %d  L %d", weather.hi, weather.lo);
+  }
+  setColors(ctx);
+  graphics_draw_text(ctx, temp_text, fonts_get_system_font(FONT_KEY_GOTHIC_28_BOLD),
+    GRect(REL_WEATHER_TEMP_LEFT, REL_WEATHER_TEMP_TOP, DEVICE_WIDTH - REL_WEATHER_TEMP_LEFT, 32),
+    GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+  graphics_draw_text(ctx, hilo_text, fonts_get_system_font(FONT_KEY_GOTHIC_18),
+    GRect(REL_WEATHER_TEMP_LEFT, REL_WEATHER_HILO_TOP, DEVICE_WIDTH - REL_WEATHER_TEMP_LEFT, 22),
+    GTextOverflowModeTrailingEllipsis, GTextAlignmentLeft, NULL);
+}
+
+void apply_slot_bot() {
+  // one child of slot_bot is visible, the weather atlas is only kept while it's shown
+  bool show_weather = settings.slot_bot == SLOT_ID_WEATHER;
+  layer_set_hidden(calendar_layer, show_weather);
+  layer_set_hidden(weather_layer, !show_weather);
+  if (!show_weather && image_weather_atlas != NULL) {
+    gbitmap_destroy(image_weather_atlas);
+    image_weather_atlas = NULL;
+  }
 }
 
 void battery_layer_update_callback(Layer *me, GContext* ctx) {
-// simply draw the battery outline here - the text is a different layer, and we then 'fill' it with an inverterLayer
+// draw the battery outline and percentage here - the fill is a child layer, see battery_meter_layer_update_callback
   setColors(ctx);
 // battery outline
   graphics_draw_rect(ctx, GRect(STAT_BATT_LEFT, STAT_BATT_TOP, STAT_BATT_WIDTH, STAT_BATT_HEIGHT));
@@ -528,6 +755,67 @@ void battery_layer_update_callback(Layer *me, GContext* ctx) {
                                 STAT_BATT_TOP + (STAT_BATT_HEIGHT - STAT_BATT_NIB_HEIGHT)/2,
                                 STAT_BATT_NIB_WIDTH,
                                 STAT_BATT_NIB_HEIGHT));
+  graphics_draw_text(ctx, battery_text, fonts_get_system_font(FONT_KEY_GOTHIC_14),
+    GRect(STAT_BATT_LEFT, STAT_BATT_TOP-2, STAT_BATT_WIDTH, STAT_BATT_HEIGHT),
+    GTextOverflowModeWordWrap, GTextAlignmentCenter, NULL);
+}
+
+void battery_meter_layer_update_callback(Layer *me, GContext* ctx) {
+// the meter's frame is sized to the charge, so it clips the fill and the
+// reversed-out percentage (drawn at the same spot as in battery_layer)
+  setInvColors(ctx);
+  GRect bounds = layer_get_bounds(me);
+  graphics_fill_rect(ctx, bounds, 0, GCornerNone);
+  graphics_draw_text(ctx, battery_text, fonts_get_system_font(FONT_KEY_GOTHIC_14),
+    GRect(-2, -4, STAT_BATT_WIDTH, STAT_BATT_HEIGHT),
+    GTextOverflowModeWordWrap, GTextAlignmentCenter, NULL);
+}
+
+uint8_t feature_mask() {
+  uint8_t features = 0;
+  if (settings.vibe_hour)                        { features |= FEAT_VIBE_HOUR; }
+  if (settings.track_battery)                    { features |= FEAT_TRACK_BATTERY; }
+  if (settings.inverted)                         { features |= FEAT_INVERTED; }
+  if (settings.show_day || settings.show_week)   { features |= FEAT_SUBTEXT; }
+  return features;
+}
+
+static void energy_sample(uint8_t percent, bool plugged, uint8_t features, uint32_t now) {
+  // Pebble only reports the charge in 10% steps, so a rate is measured between
+  // two observed drops of the same discharge, under one unchanged configuration.
+  if (plugged || percent > energy.last_percent || features != energy.last_features) {
+    energy.last_percent  = percent;
+    energy.last_features = features;
+    energy.last_time     = 0;
+    return;
+  }
+  if (percent == energy.last_percent) {
+    return;
+  }
+  if (energy.last_time != 0 && now > energy.last_time) {
+    int32_t sample = (int32_t)(energy.last_percent - percent) * 3600 * DRAIN_SCALE
+                     / (int32_t)(now - energy.last_time);
+    int32_t rate = energy.drain[features];
+    if (rate == 0) {
+      rate = sample; // first estimate for this configuration
+    } else {
+      rate += (sample - rate) >> DRAIN_SMOOTH_SHIFT;
+    }
+    energy.drain[features] = rate < 1 ? 1 : (rate > UINT16_MAX ? UINT16_MAX : rate);
+    if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__,
+                           "drain sample %ld, config %d now %d", (long)sample, features,
+                           energy.drain[features]); }
+  }
+  energy.last_percent = percent;
+  energy.last_time    = now;
+  persist_write_data(PK_ENERGY, &energy, sizeof(energy) ); // at most once per 10%
+}
+
+// estimated hours until empty, or -1 if we have no estimate yet
+int energy_hours_left() {
+  uint16_t rate = energy.drain[feature_mask()];
+  if (rate == 0) { return -1; }
+  return battery_percent * DRAIN_SCALE / rate;
 }
 
 static void request_timezone() {
@@ -538,27 +826,87 @@ static void request_timezone() {
       app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
               "iterator is null: %d", result); 
     }
+    flightrec_log(FLIGHTREC_OUT_BUSY, MSG_TIMEZONE, result);
     return;
   }
-  if(dict_write_uint8(iter, AK_MESSAGE_TYPE, AK_TIMEZONE_OFFSET) != DICT_OK) {
+  msg_timezone msg = { .offset = timezone_offset }; // the phone answers with the real one
+  if(msg_timezone_write(iter, &msg) != DICT_OK) {
     return;
   }
   app_message_outbox_send();
 }
 
-static void battery_status_send(void *data) {
-  if(!settings.track_battery) {
-    return; // if track battery setting's off, saves power w/ appmessages
+static void log_upload(void *data);
+
+static void log_schedule_upload(uint32_t delay_ms) {
+  if (log_upload_timer == NULL) {
+    log_upload_timer = app_timer_register(delay_ms, &log_upload, NULL);
   }
-  if(  (battery_percent  == sent_battery_percent  )
-     & (battery_charging == sent_battery_charging )
-     & (battery_plugged  == sent_battery_plugged  )) {
-    if(DEBUGLOG) { 
-      app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
-              "repeat battery reading"); 
+}
+
+// read one record of the worker's battery log, caching the block it lives in
+static bool log_read(uint32_t seq, battlog_record *record) {
+  static battlog_record block[BATTLOG_BLOCK_RECORDS];
+  static uint32_t block_key = 0;
+  static uint32_t block_head = 0; // log head when the block was read
+  if (seq >= log_head || seq + BATTLOG_VALID < log_head) {
+    return false; // not written yet, or overwritten (or about to be)
+  }
+  if (block_key != BATTLOG_BLOCK_KEY(seq) || seq >= block_head) {
+    block_key = BATTLOG_BLOCK_KEY(seq);
+    block_head = log_head;
+    persist_read_data(block_key, block, sizeof(block));
+  }
+  *record = block[seq % BATTLOG_BLOCK_RECORDS];
+  return true;
+}
+
+// catch the drain estimate up with whatever the worker logged
+static void log_replay() {
+  battlog_record record;
+  if (persist_exists(PK_LOG_HEAD)) {
+    log_head = persist_read_int(PK_LOG_HEAD);
+  }
+  if (energy.log_seq + BATTLOG_VALID < log_head) {
+    energy.log_seq = log_head - BATTLOG_VALID;
+  }
+  for (; energy.log_seq < log_head; energy.log_seq++) {
+    if (log_read(energy.log_seq, &record)) {
+      energy_sample(record.percent, record.state & BATTLOG_PLUGGED,
+                    record.features, record.time);
     }
-    battery_sending = NULL;
-    return; // no need to resend the same value
+  }
+}
+
+// the next records the phone hasn't acknowledged, at most BATTLOG_BATCH
+static uint8_t log_batch(battlog_record *batch) {
+  if (log_sent + BATTLOG_VALID < log_head) {
+    log_sent = log_head - BATTLOG_VALID; // the worker lapped us, skip what's gone
+  }
+  uint8_t count = 0;
+  while (count < BATTLOG_BATCH && log_read(log_sent + count, &batch[count])) {
+    count++;
+  }
+  return count;
+}
+
+// an upload that found the outbox busy goes once it's free
+static void log_outbox_ready(void) {
+  if (log_waiting) {
+    log_waiting = false;
+    log_schedule_upload(0);
+  }
+}
+
+static void log_upload(void *data) {
+  log_upload_timer = NULL;
+  if(!settings.track_battery || !bluetooth_connected || log_sending) {
+    return; // if track battery setting's off, saves power w/ appmessages
+  }
+  battlog_record batch[BATTLOG_BATCH];
+  uint8_t count = log_batch(batch);
+  if (count == 0) {
+    return; // nothing new
   }
   DictionaryIterator *iter;
 
@@ -569,6 +917,10 @@ static void battery_status_send(void *data) {
       app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
               "iterator is null: %d", result); 
     }
+    if (!log_waiting) {
+      flightrec_log(FLIGHTREC_OUT_BUSY, MSG_LOG_DATA, result);
+    }
+    log_waiting = true; // e.g. behind the hourly timezone request, see my_out_sent_handler
     return;
   }
 
@@ -577,70 +929,132 @@ static void battery_status_send(void *data) {
       app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
              "Dict write failed to open outbox: %d", (AppMessageResult) result);
     }
+    flightrec_log(FLIGHTREC_OUT_BUSY, MSG_LOG_DATA, result);
     return;
   }
 
-  if(dict_write_uint8(iter, AK_MESSAGE_TYPE, AK_SEND_BATT_PERCENT) != DICT_OK) {
+  msg_log_data msg = {
+    .seq = log_sent,
+    .head = log_head,
+    .msg_count = message_count,
+    .vibe_count = vibe_count,
+    .drain_rate = energy.drain[feature_mask()],
+    .records = (uint8_t *)batch,
+    .records_length = count * sizeof(battlog_record),
+  };
+  if(msg_log_data_write(iter, &msg) != DICT_OK) {
     return;
   }
-  if(dict_write_uint8(iter, AK_SEND_BATT_PERCENT, battery_percent) != DICT_OK) {
+  app_message_outbox_send();
+  log_sending = count; // log_sent moves on once the phone has it, see my_out_sent_handler
+}
+
+GBitmap *hourvibe_icon() {
+  if (image_hourvibe_icon == NULL) {
+    image_hourvibe_icon = load_icon(RESOURCE_ID_IMAGE_HOURVIBE_ICON);
+  }
+  return image_hourvibe_icon;
+}
+
+void update_connection_text() {
+  static char estimate_text[] = "~999h";
+  if (dp_armed) {
+    text_layer_set_text(text_connection_layer, "+1?");
     return;
   }
-  if (dict_write_uint8(iter, AK_SEND_BATT_CHARGING, battery_charging ? 1: 0) != DICT_OK) {
+  if (!bluetooth_connected) {
+    text_layer_set_text(text_connection_layer, lang_gen.statuses[1]);
     return;
   }
-  if (dict_write_uint8(iter, AK_SEND_BATT_PLUGGED, battery_plugged ? 1: 0) != DICT_OK) {
+  // while linked the status text is free, so show the estimated time to empty
+  int hours = energy_hours_left();
+  if (hours < 0 || battery_charging || battery_plugged) {
+    text_layer_set_text(text_connection_layer, lang_gen.statuses[0]);
     return;
   }
-  app_message_outbox_send();
-  sent_battery_percent  = battery_percent;
-  sent_battery_charging = battery_charging;
-  sent_battery_plugged  = battery_plugged;
-  battery_sending = NULL;
+  if (hours < 48) {
+    snprintf(estimate_text, sizeof(estimate_text), "~%dh", hours);
+  } else {
+    snprintf(estimate_text, sizeof(estimate_text), "~%dd", hours / 24 > 99 ? 99 : hours / 24);
+  }
+  text_layer_set_text(text_connection_layer, estimate_text);
 }
 
-static void handle_battery(BatteryChargeState charge_state) {
-  static char battery_text[] = "100";
+// Handlers only say what changed; one pass on the next event loop turn does
+// the work, so events arriving together (startup, midnight, a config push)
+// recompute and redraw each thing once.
+void update_status_icon() {
+  // one spot for charging, then goal alerts, then the hourly vibe indicator
+  static char badge_text[] = "!999";
+  bool badge = false;
+  if (battery_charging) {
+    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), false);
+    bitmap_layer_set_bitmap(bmp_charging_layer, image_charging_icon);
+  } else if (battery_plugged) { // plugged but not charging = charging complete...
+    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
+  } else if (goals_alerting) {
+    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
+    snprintf(badge_text, sizeof(badge_text), "!%d", goals_alerting);
+    text_layer_set_text(alert_badge_layer, badge_text);
+    badge = true;
+  } else if (settings.vibe_hour) {
+    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), false);
+    bitmap_layer_set_bitmap(bmp_charging_layer, hourvibe_icon());
+  } else {
+    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
+  }
+  layer_set_hidden(text_layer_get_layer(alert_badge_layer), !badge);
+}
 
+static void redraw(void *data) {
+  uint8_t flags = redraw_flags;
+  redraw_timer = NULL;
+  redraw_flags = 0;
+  if (flags & REDRAW_CONNECTION) { update_connection_text(); }
+  if (flags & REDRAW_SUBTEXT) { update_datetime_subtext(); }
+  if (flags & REDRAW_STATUS) { update_status_icon(); }
+  if (flags & REDRAW_ROOT) {
+    layer_mark_dirty(window_get_root_layer(window)); // covers the rest
+    return;
+  }
+  if (flags & REDRAW_BATTERY) { layer_mark_dirty(battery_layer); }
+  if (flags & REDRAW_CALENDAR) { layer_mark_dirty(calendar_layer); }
+  if (flags & REDRAW_DATETIME) { layer_mark_dirty(datetime_layer); }
+  if (flags & REDRAW_WEATHER) { layer_mark_dirty(weather_layer); }
+}
+
+static void invalidate(uint8_t flags) {
+  redraw_flags |= flags;
+  if (redraw_timer == NULL) {
+    redraw_timer = app_timer_register(0, &redraw, NULL);
+  }
+}
+
+static void show_battery(BatteryChargeState charge_state) {
   battery_percent = charge_state.charge_percent;
   uint8_t battery_meter = battery_percent/10*(STAT_BATT_WIDTH-4)/10;
   battery_charging = charge_state.is_charging;
   battery_plugged = charge_state.is_plugged;
 
   // fill it in with current power
-  layer_set_bounds(inverter_layer_get_layer(battery_meter_layer), GRect(STAT_BATT_LEFT+2, STAT_BATT_TOP+2, battery_meter, STAT_BATT_HEIGHT-4));
-  layer_set_hidden(inverter_layer_get_layer(battery_meter_layer), false);
+  layer_set_frame(battery_meter_layer, GRect(STAT_BATT_LEFT+2, STAT_BATT_TOP+2, battery_meter, STAT_BATT_HEIGHT-4));
+  layer_set_hidden(battery_meter_layer, false);
 
-  //if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "battery reading"); }
-  if (battery_sending == NULL) {
-    // multiple battery events can fire in rapid succession, we'll let it settle down before logging it
-    battery_sending = app_timer_register(5000, &battery_status_send, NULL);
-    if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "battery timer queued"); }
-  }
+  snprintf(battery_text, sizeof(battery_text), "%d", charge_state.charge_percent);
+  invalidate(REDRAW_CONNECTION | REDRAW_BATTERY | REDRAW_STATUS);
+}
 
-  if (charge_state.is_charging) { // charging
-    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), false);
-    bitmap_layer_set_bitmap(bmp_charging_layer, image_charging_icon);
-  } else { // not charging
-    if (charge_state.is_plugged) { // plugged but not charging = charging complete...
-      layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
-    } else { // normal wear
-      if (settings.vibe_hour) {
-        layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), false);
-        bitmap_layer_set_bitmap(bmp_charging_layer, image_hourvibe_icon);
-      } else {
-        layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
-      }
-    }
+static void handle_battery(BatteryChargeState charge_state) {
+  show_battery(charge_state);
+  if (!app_worker_is_running()) { // otherwise it's in the log, see log_replay
+    energy_sample(battery_percent, battery_plugged, feature_mask(), time(0));
   }
-  snprintf(battery_text, sizeof(battery_text), "%d", charge_state.charge_percent);
-  text_layer_set_text(text_battery_layer, battery_text);
-  layer_mark_dirty(battery_layer);
 }
 
 void generate_vibe(uint32_t vibe_pattern_number) {
   if (vibe_suppression) { return; }
   vibes_cancel();
+  if (vibe_pattern_number > 0 && vibe_pattern_number <= 7) { vibe_count++; }
   switch ( vibe_pattern_number ) {
   case 0: // No Vibration
     return;
@@ -655,6 +1069,7 @@ void generate_vibe(uint32_t vibe_pattern_number) {
       .durations = (uint32_t []) {200, 100, 200, 100, 200},
       .num_segments = 5
     } );
+    break;
   case 4: // Long
     vibes_long_pulse();
     break;
@@ -682,8 +1097,7 @@ void generate_vibe(uint32_t vibe_pattern_number) {
 }
 
 void update_connection() {
-  text_layer_set_text(text_connection_layer, 
-    bluetooth_connected ? lang_gen.statuses[0] : lang_gen.statuses[1]);
+  invalidate(REDRAW_CONNECTION);
   if(bluetooth_connected) {
     generate_vibe(settings.vibe_pat_connect);  // no-op by default
     bitmap_layer_set_bitmap(bmp_connection_layer, image_connection_icon);
@@ -693,15 +1107,209 @@ void update_connection() {
   }
 }
 
+static void dp_flush();
+
 static void handle_bluetooth(bool connected) {
+  if (connected != bluetooth_connected) {
+    flightrec_log(connected ? FLIGHTREC_LINK_UP : FLIGHTREC_LINK_DOWN, 0, 0);
+  }
   bluetooth_connected = connected;
   update_connection();
+  if (connected) {
+    log_schedule_upload(5000); // let the link settle before catching up
+    dp_sending = 0; // whatever was in flight may be lost, resend it
+    dp_flush();
+  }
+}
+
+// the worker logs battery and link state even while other apps run;
+// the face only reads the log, to render and upload it
+static void handle_worker_message(uint16_t type, AppWorkerMessage *data) {
+  if (type != BATTLOG_MSG_APPENDED) { return; }
+  log_replay();
+  invalidate(REDRAW_CONNECTION);
+  if (log_head - log_sent >= BATTLOG_BATCH) {
+    log_schedule_upload(5000); // multiple events can fire in rapid succession
+  }
+}
+
+void battery_worker_update() {
+  uint8_t features = feature_mask();
+  persist_write_int(PK_LOG_FEATURES, features);
+  if (settings.track_battery) {
+    if (!app_worker_is_running()) {
+      app_worker_launch();
+    }
+    AppWorkerMessage msg = { .data0 = features };
+    app_worker_send_message(BATTLOG_MSG_FEATURES, &msg);
+  } else if (app_worker_is_running()) {
+    app_worker_kill();
+  }
+}
+
+// Datapoints wait in a persistent queue until the phone acknowledges them, so
+// they survive disconnects and restarts.  Entries still on the watch for the
+// same goal and day are merged; once sent, an entry is never changed again,
+// and the phone dedupes resends by id.
+static void dp_flush() {
+  if (!bluetooth_connected || dp_sending || dp_queue.count == 0) {
+    return;
+  }
+  DictionaryIterator *iter;
+  AppMessageResult result = app_message_outbox_begin(&iter);
+  if(iter == NULL || result != APP_MSG_OK) {
+    if(DEBUGLOG) { 
+      app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
+              "datapoints not sent, outbox: %d", result); 
+    }
+    flightrec_log(FLIGHTREC_OUT_BUSY, MSG_DP_DATA, result);
+    dp_waiting = true; // we'll try again once the outbox is free
+    return;
+  }
+  msg_dp_data msg = {
+    .entries = (uint8_t *)dp_queue.entries,
+    .entries_length = dp_queue.count * sizeof(dp_entry),
+  };
+  if(msg_dp_data_write(iter, &msg) != DICT_OK) {
+    return;
+  }
+  app_message_outbox_send();
+  dp_sending = dp_queue.count;
+  if (dp_queue.sealed != dp_queue.count) {
+    dp_queue.sealed = dp_queue.count; // the phone may have these now, never merge into them
+    persist_write_data(PK_DP_QUEUE, &dp_queue, sizeof(dp_queue) );
+  }
+}
+
+// a flush that found the outbox busy goes once it's free
+static void dp_outbox_ready(void) {
+  if (dp_waiting) {
+    dp_waiting = false;
+    dp_flush();
+  }
+}
+
+static void dp_add(uint8_t goal, int16_t value) {
+  persist_dp_queue before = dp_queue;
+  uint16_t day = time(0) / 86400;
+  dp_entry *last = dp_queue.count > dp_queue.sealed ? &dp_queue.entries[dp_queue.count - 1] : NULL;
+  if (last != NULL && last->goal == goal && last->day == day) {
+    last->value += value;
+  } else if (dp_queue.count < DP_QUEUE_MAX) {
+    dp_queue.entries[dp_queue.count++] = (dp_entry) {
+      .id = dp_queue.next_id++, .goal = goal, .day = day, .value = value,
+    };
+  } else {
+    vibes_long_pulse(); // full, tell the user it didn't take
+    return;
+  }
+  if (persist_write_data(PK_DP_QUEUE, &dp_queue, sizeof(dp_queue) ) < 0) {
+    dp_queue = before; // not stored, so it would be lost on a restart: don't take it
+    vibes_long_pulse();
+    return;
+  }
+  dp_flush();
+}
+
+static void in_dp_ack_handler(const Tuple *tuple) {
+  msg_dp_ack ack;
+  if (!msg_dp_ack_unpack(tuple, &ack)) { return; }
+  // drop everything up to and including the acknowledged id
+  uint8_t done = 0;
+  while (done < dp_queue.count && dp_queue.entries[done].id != ack.id) {
+    done++;
+  }
+  if (done == dp_queue.count) {
+    return; // a late ack for entries we've already dropped
+  }
+  done++;
+  if (dp_ack_timer != NULL) {
+    app_timer_cancel(dp_ack_timer);
+    dp_ack_timer = NULL;
+  }
+  memmove(dp_queue.entries, &dp_queue.entries[done],
+          (dp_queue.count - done) * sizeof(dp_entry));
+  dp_queue.count -= done;
+  dp_queue.sealed -= done < dp_queue.sealed ? done : dp_queue.sealed;
+  dp_sending = 0;
+  persist_write_data(PK_DP_QUEUE, &dp_queue, sizeof(dp_queue) );
+  dp_flush(); // anything queued meanwhile
+}
+
+static void dp_disarm(void *data) {
+  dp_armed_timer = NULL;
+  dp_armed = false;
+  invalidate(REDRAW_CONNECTION);
+}
+
+static void handle_tap(AccelAxisType axis, int32_t direction) {
+  if (!dp_armed) {
+    dp_armed = true;
+    dp_armed_timer = app_timer_register(DP_CONFIRM_MS, &dp_disarm, NULL);
+    invalidate(REDRAW_CONNECTION);
+    return;
+  }
+  app_timer_cancel(dp_armed_timer);
+  dp_disarm(NULL);
+  dp_add(0, 1);
+  generate_vibe(1); // single short, to confirm
 }
 
+static void dp_ack_timeout(void *data) {
+  dp_ack_timer = NULL;
+  // the batch never went, or the phone got it but its ack never made it
+  // back: resend, it already has these ids and won't count them twice
+  dp_sending = 0;
+  dp_flush();
+}
+
+void dp_tap_update() {
+  static bool subscribed = false;
+  if (settings.dp_tap && !subscribed) {
+    accel_tap_service_subscribe(&handle_tap);
+  } else if (!settings.dp_tap && subscribed) {
+    accel_tap_service_unsubscribe();
+  }
+  subscribed = settings.dp_tap;
+}
+
+void set_theme() {
+  // light mode is drawn natively by swapping the theme colors, everything
+  // that draws reads theme_fg/theme_bg through setColors/setInvColors
+  theme_fg = settings.inverted ? GColorBlack : GColorWhite;
+  theme_bg = settings.inverted ? GColorWhite : GColorBlack;
+}
+
+void apply_theme() {
+  // push the theme into things that keep their own colors
+  GCompOp icon_op = ICON_OP;
+#if LAYOUT_COLOR
+  if (icons_light != settings.inverted) {
+    icons_light = settings.inverted;
+    flip_icon(image_connection_icon);
+    flip_icon(image_noconnection_icon);
+    flip_icon(image_charging_icon);
+    if (image_hourvibe_icon != NULL) { flip_icon(image_hourvibe_icon); }
+    if (image_weather_atlas != NULL) { flip_icon(image_weather_atlas); }
+  }
+#endif
+  window_set_background_color(window, theme_bg);
+  text_layer_set_text_color(date_layer, theme_fg);
+  text_layer_set_text_color(time_layer, theme_fg);
+  if (week_layer != NULL) { text_layer_set_text_color(week_layer, theme_fg); }
+  if (day_layer != NULL)  { text_layer_set_text_color(day_layer, theme_fg); }
+  if (countdown_layer != NULL) { text_layer_set_text_color(countdown_layer, theme_fg); }
+  text_layer_set_text_color(text_connection_layer, theme_fg);
+  text_layer_set_text_color(alert_badge_layer, theme_fg);
+  bitmap_layer_set_compositing_mode(bmp_connection_layer, icon_op);
+  bitmap_layer_set_compositing_mode(bmp_charging_layer, icon_op);
+}
+
+void update_countdown(TimeUnits units_changed);
+
 static void window_load(Window *window) {
 
   Layer *window_layer = window_get_root_layer(window);
-  GRect bounds = layer_get_bounds(window_layer);
 
   //statusbar = layer_create(GRect(0,LAYOUT_STAT,DEVICE_WIDTH,LAYOUT_SLOT_TOP));
   statusbar = layer_create(GRect(0,0,DEVICE_WIDTH,DEVICE_HEIGHT));
@@ -721,23 +1329,32 @@ static void window_load(Window *window) {
 
   bmp_connection_layer = bitmap_layer_create( GRect(STAT_BT_ICON_LEFT, STAT_BT_ICON_TOP, 20, 20) );
   layer_add_child(statusbar, bitmap_layer_get_layer(bmp_connection_layer));
-  image_connection_icon = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BT_LINKED_ICON);
-  image_noconnection_icon = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_BT_NOLINK_ICON);
+  image_connection_icon = load_icon(RESOURCE_ID_IMAGE_BT_LINKED_ICON);
+  image_noconnection_icon = load_icon(RESOURCE_ID_IMAGE_BT_NOLINK_ICON);
 
   bmp_charging_layer = bitmap_layer_create( GRect(STAT_CHRG_ICON_LEFT, STAT_CHRG_ICON_TOP, 20, 20) );
   layer_add_child(statusbar, bitmap_layer_get_layer(bmp_charging_layer));
-  image_charging_icon = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_CHARGING_ICON);
-  image_hourvibe_icon = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_HOURVIBE_ICON);
-  if (settings.vibe_hour) {
-    bitmap_layer_set_bitmap(bmp_charging_layer, image_hourvibe_icon);
-  } else {
-    layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
-  }
+  image_charging_icon = load_icon(RESOURCE_ID_IMAGE_CHARGING_ICON);
+  layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true); // see update_status_icon
+
+  alert_badge_layer = text_layer_create( GRect(STAT_CHRG_ICON_LEFT, 0, 20, 22) );
+  text_layer_set_text_color(alert_badge_layer, theme_fg);
+  text_layer_set_background_color(alert_badge_layer, GColorClear);
+  text_layer_set_font(alert_badge_layer, fonts_get_system_font(FONT_KEY_GOTHIC_18_BOLD));
+  text_layer_set_text_alignment(alert_badge_layer, GTextAlignmentCenter);
+  layer_set_hidden(text_layer_get_layer(alert_badge_layer), true);
+  layer_add_child(statusbar, text_layer_get_layer(alert_badge_layer));
 
   battery_layer = layer_create(stat_bounds);
   layer_set_update_proc(battery_layer, battery_layer_update_callback);
   layer_add_child(statusbar, battery_layer);
 
+  // hide battery meter, until we can fix the size/position later when subscribing
+  battery_meter_layer = layer_create(GRect(STAT_BATT_LEFT+2, STAT_BATT_TOP+2, 0, STAT_BATT_HEIGHT-4));
+  layer_set_update_proc(battery_meter_layer, battery_meter_layer_update_callback);
+  layer_set_hidden(battery_meter_layer, true);
+  layer_add_child(battery_layer, battery_meter_layer);
+
   datetime_layer = layer_create(slot_top_bounds);
   layer_set_update_proc(datetime_layer, datetime_layer_update_callback);
   layer_add_child(slot_top, datetime_layer);
@@ -746,87 +1363,65 @@ static void window_load(Window *window) {
   layer_set_update_proc(calendar_layer, calendar_layer_update_callback);
   layer_add_child(slot_bot, calendar_layer);
 
+  weather_layer = layer_create(slot_bot_bounds);
+  layer_set_update_proc(weather_layer, weather_layer_update_callback);
+  layer_add_child(slot_bot, weather_layer);
+  apply_slot_bot();
+
   date_layer = text_layer_create( GRect(REL_CLOCK_DATE_LEFT, REL_CLOCK_DATE_TOP, DEVICE_WIDTH, REL_CLOCK_DATE_HEIGHT) );
-  text_layer_set_text_color(date_layer, GColorWhite);
+  text_layer_set_text_color(date_layer, theme_fg);
   text_layer_set_background_color(date_layer, GColorClear);
   text_layer_set_font(date_layer, fonts_get_system_font(FONT_KEY_GOTHIC_24));
   text_layer_set_text_alignment(date_layer, GTextAlignmentCenter);
   layer_add_child(datetime_layer, text_layer_get_layer(date_layer));
 
   time_layer = text_layer_create( GRect(REL_CLOCK_TIME_LEFT, REL_CLOCK_TIME_TOP, DEVICE_WIDTH, REL_CLOCK_TIME_HEIGHT) ); // see position_time_layer()
-  text_layer_set_text_color(time_layer, GColorWhite);
+  text_layer_set_text_color(time_layer, theme_fg);
   text_layer_set_background_color(time_layer, GColorClear);
   text_layer_set_font(time_layer, fonts_get_system_font(FONT_KEY_ROBOTO_BOLD_SUBSET_49));
   text_layer_set_text_alignment(time_layer, GTextAlignmentCenter);
   position_time_layer(); // make use of our whitespace, if we have it...
   layer_add_child(datetime_layer, text_layer_get_layer(time_layer));
 
-  week_layer = text_layer_create( GRect(4, REL_CLOCK_SUBTEXT_TOP, 140, 16) );
-  text_layer_set_text_color(week_layer, GColorWhite);
-  text_layer_set_background_color(week_layer, GColorClear);
-  text_layer_set_font(week_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-  text_layer_set_text_alignment(week_layer, GTextAlignmentLeft);
-  layer_add_child(datetime_layer, text_layer_get_layer(week_layer));
-  if ( settings.show_week == 0 ) {
-    layer_set_hidden(text_layer_get_layer(week_layer), true);
-  }
-
-  day_layer = text_layer_create( GRect(28, REL_CLOCK_SUBTEXT_TOP, DEVICE_WIDTH - 56, 16) );
-  text_layer_set_text_color(day_layer, GColorWhite);
-  text_layer_set_background_color(day_layer, GColorClear);
-  text_layer_set_font(day_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-  text_layer_set_text_alignment(day_layer, GTextAlignmentCenter);
-  layer_add_child(datetime_layer, text_layer_get_layer(day_layer));
-  if ( settings.show_day == 0 ) {
-    layer_set_hidden(text_layer_get_layer(day_layer), true);
-  }
+  update_datetime_subtext(); // creates week_layer/day_layer if they're shown
+  update_countdown(COUNTDOWN_ALL_UNITS); // and countdown_layer, if there's a deadline
 
-  update_datetime_subtext();
-
-  text_connection_layer = text_layer_create( GRect(20+STAT_BT_ICON_LEFT, 0, 72, 22) );
-  text_layer_set_text_color(text_connection_layer, GColorWhite);
+  text_connection_layer = text_layer_create( GRect(20+STAT_BT_ICON_LEFT, 0, STAT_TEXT_WIDTH, 22) );
+  text_layer_set_text_color(text_connection_layer, theme_fg);
   text_layer_set_background_color(text_connection_layer, GColorClear);
   text_layer_set_font(text_connection_layer, fonts_get_system_font(FONT_KEY_GOTHIC_18));
   text_layer_set_text_alignment(text_connection_layer, GTextAlignmentLeft);
   text_layer_set_text(text_connection_layer, "NO LINK");
   layer_add_child(statusbar, text_layer_get_layer(text_connection_layer));
 
-  text_battery_layer = text_layer_create( GRect(STAT_BATT_LEFT, STAT_BATT_TOP-2, STAT_BATT_WIDTH, STAT_BATT_HEIGHT) );
-  text_layer_set_text_color(text_battery_layer, GColorWhite);
-  text_layer_set_background_color(text_battery_layer, GColorClear);
-  text_layer_set_font(text_battery_layer, fonts_get_system_font(FONT_KEY_GOTHIC_14));
-  text_layer_set_text_alignment(text_battery_layer, GTextAlignmentCenter);
-  text_layer_set_text(text_battery_layer, "?");
-
-  layer_add_child(statusbar, text_layer_get_layer(text_battery_layer));
-
-  // NOTE: No more adding layers below here - the inverter layers NEED to be the last to be on top!
-
-  // hide battery meter, until we can fix the size/position later when subscribing
-  battery_meter_layer = inverter_layer_create(stat_bounds);
-  layer_set_hidden(inverter_layer_get_layer(battery_meter_layer), true);
-  layer_add_child(statusbar, inverter_layer_get_layer(battery_meter_layer));
-
-  // topmost inverter layer, determines dark or light...
-  inverter_layer = inverter_layer_create(bounds);
-  if (settings.inverted==0) {
-    layer_set_hidden(inverter_layer_get_layer(inverter_layer), true);
-  }
-  layer_add_child(window_layer, inverter_layer_get_layer(inverter_layer));
-
+  apply_theme();
 }
 
 static void window_unload(Window *window) {
   // unload anything we loaded, destroy anything we created, remove anything we added
-  layer_destroy(inverter_layer_get_layer(inverter_layer));
-  layer_destroy(inverter_layer_get_layer(battery_meter_layer));
-  layer_destroy(text_layer_get_layer(text_battery_layer));
+  layer_destroy(battery_meter_layer);
   layer_destroy(text_layer_get_layer(text_connection_layer));
-  layer_destroy(text_layer_get_layer(day_layer));
-  layer_destroy(text_layer_get_layer(week_layer));
+  layer_destroy(text_layer_get_layer(alert_badge_layer));
+  if (day_layer != NULL) {
+    layer_destroy(text_layer_get_layer(day_layer));
+    day_layer = NULL;
+  }
+  if (countdown_layer != NULL) {
+    layer_destroy(text_layer_get_layer(countdown_layer));
+    countdown_layer = NULL;
+  }
+  if (week_layer != NULL) {
+    layer_destroy(text_layer_get_layer(week_layer));
+    week_layer = NULL;
+  }
   layer_destroy(text_layer_get_layer(time_layer));
   layer_destroy(text_layer_get_layer(date_layer));
   layer_destroy(calendar_layer);
+  layer_destroy(weather_layer);
+  if (image_weather_atlas != NULL) {
+    gbitmap_destroy(image_weather_atlas);
+    image_weather_atlas = NULL;
+  }
   layer_destroy(datetime_layer);
   layer_destroy(battery_layer);
   layer_remove_from_parent(bitmap_layer_get_layer(bmp_charging_layer));
@@ -836,7 +1431,10 @@ static void window_unload(Window *window) {
   gbitmap_destroy(image_connection_icon);
   gbitmap_destroy(image_noconnection_icon);
   gbitmap_destroy(image_charging_icon);
-  gbitmap_destroy(image_hourvibe_icon);
+  if (image_hourvibe_icon != NULL) {
+    gbitmap_destroy(image_hourvibe_icon);
+    image_hourvibe_icon = NULL;
+  }
   layer_destroy(slot_bot);
   layer_destroy(slot_top);
   layer_destroy(statusbar);
@@ -844,63 +1442,370 @@ static void window_unload(Window *window) {
 
 static void deinit(void) {
   // deinit anything we init
+  goal_store_flush();
+  flightrec_flush();
+  stream_deinit();
+  if (redraw_timer != NULL) { app_timer_cancel(redraw_timer); }
+  accel_tap_service_unsubscribe();
+  app_worker_message_unsubscribe();
   bluetooth_connection_service_unsubscribe();
   battery_state_service_unsubscribe();
   tick_timer_service_unsubscribe();
   window_destroy(window);
 }
 
+// Goals are only looked at again when goal_alert says the next one crosses a
+// threshold, the per-minute check is a single comparison.
+static void check_goal_alerts() {
+  goal_alert_configure(settings.alert_warn * 3600, settings.alert_urgent * 3600);
+  uint8_t alerting;
+  uint8_t raised = goal_alert_evaluate(time(NULL), &alerting);
+  if (raised != GOAL_ALERT_NONE) {
+    generate_vibe(settings.vibe_pat_alert);
+  }
+  if (alerting != goals_alerting) {
+    goals_alerting = alerting;
+    invalidate(REDRAW_STATUS);
+  }
+}
+
 void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed)
 {
   update_time_text();
 
+  if (goal_alert_due(time(NULL))) {
+    check_goal_alerts();
+  }
+
+  if (timezone_transition != 0 && (uint32_t)time(NULL) >= timezone_transition) {
+    timezone_offset = timezone_next_offset; // as the phone said it would, no need to ask
+    timezone_transition = 0;
+    invalidate(REDRAW_SUBTEXT);
+  }
+
   //if (units_changed & MONTH_UNIT) {
   //  update_date_text();
   //}
 
   if (units_changed & HOUR_UNIT) {
     request_timezone();
-    update_datetime_subtext();
+    log_schedule_upload(0);
+    invalidate(REDRAW_SUBTEXT);
     if (settings.vibe_hour) {
       generate_vibe(settings.vibe_hour);
     }
   }
 
   if (units_changed & DAY_UNIT) {
-    //layer_mark_dirty(datetime_layer);
-    layer_mark_dirty(calendar_layer);
+    invalidate(REDRAW_CALENDAR);
   }
 
   // calendar gets redrawn every time because time_layer is changed and all layers are redrawn together.
 }
 
+void handle_tick(struct tm *tick_time, TimeUnits units_changed);
+
+// The countdown only asks for second ticks in the last few minutes before the
+// deadline.  Further out it just changes text on the minute or hour, and once
+// the deadline is gone we drop back to minute ticks.
+void update_countdown(TimeUnits units_changed) {
+  static char countdown_text[] = "000d 00h";
+  int32_t left = goal_losedate - (int32_t)time(0);
+  TimeUnits want = MINUTE_UNIT;
+
+  if (goal_losedate == 0 || left <= 0) {
+    if (countdown_layer != NULL) {
+      layer_set_hidden(text_layer_get_layer(countdown_layer), true);
+    }
+  } else {
+    if (countdown_layer == NULL) {
+      countdown_layer = subtext_layer_create(GRect(DEVICE_WIDTH - 52, REL_CLOCK_SUBTEXT_TOP, 48, 16),
+                                             GTextAlignmentRight);
+      units_changed = COUNTDOWN_ALL_UNITS;
+    } else if (layer_get_hidden(text_layer_get_layer(countdown_layer))) {
+      layer_set_hidden(text_layer_get_layer(countdown_layer), false);
+      units_changed = COUNTDOWN_ALL_UNITS;
+    }
+    if (left > COUNTDOWN_MINUTES_WITHIN) {
+      if (units_changed & HOUR_UNIT) {
+        int days = left / 86400 > 999 ? 999 : (int)(left / 86400); // fits the layer
+        snprintf(countdown_text, sizeof(countdown_text), "%dd %dh", days, (int)(left % 86400 / 3600));
+        text_layer_set_text(countdown_layer, countdown_text);
+      }
+    } else if (left > COUNTDOWN_SECONDS_WITHIN) {
+      if (units_changed & MINUTE_UNIT) {
+        snprintf(countdown_text, sizeof(countdown_text), "%d:%02d",
+                 (int)(left / 3600), (int)(left % 3600 / 60));
+        text_layer_set_text(countdown_layer, countdown_text);
+      }
+    } else {
+      want = SECOND_UNIT;
+      snprintf(countdown_text, sizeof(countdown_text), "%d:%02d",
+               (int)(left / 60), (int)(left % 60));
+      text_layer_set_text(countdown_layer, countdown_text); // only this layer is dirtied
+    }
+  }
+
+  if (want != tick_unit) {
+    tick_unit = want;
+    tick_timer_service_subscribe(tick_unit, &handle_tick);
+  }
+}
+
+void handle_tick(struct tm *tick_time, TimeUnits units_changed) {
+  if (units_changed & MINUTE_UNIT) {
+    handle_minute_tick(tick_time, units_changed);
+  }
+  update_countdown(units_changed);
+}
+
+void load_active_goal() {
+  const goal_record *goal = goal_store_get(goal_store_active());
+  goal_losedate = goal != NULL ? goal->losedate : 0;
+}
+
+void in_weather_handler(const Tuple *tuple) {
+  // the phone only sends this when something changed, or every couple of hours
+  msg_weather msg;
+  if (!msg_weather_unpack(tuple, &msg)) {
+    return;
+  }
+  weather.temp = msg.temp;
+  weather.hi = msg.hi;
+  weather.lo = msg.lo;
+  weather.condition = msg.condition;
+  weather.received = time(NULL);
+  persist_write_data(PK_WEATHER, &weather, sizeof(weather) );
+  invalidate(REDRAW_WEATHER);
+}
+
+static bool goal_batch_lists(const msg_goal_batch *batch, const char *slug) {
+  msg_goal_record msg;
+  for (uint16_t at = 0; at + MSG_GOAL_RECORD_SIZE <= batch->records_length; at += MSG_GOAL_RECORD_SIZE) {
+    msg_goal_record_decode(batch->records + at, MSG_GOAL_RECORD_SIZE, &msg);
+    if (strncmp(msg.slug, slug, GOAL_SLUG_LEN) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// false if any of it wasn't stored, so the phone doesn't take it as done
+static bool goals_received(const uint8_t *data, uint16_t length) {
+  // a whole batch from the phone, so it's written back right away
+  msg_goal_batch batch;
+  if (!msg_goal_batch_decode(data, length, &batch)) {
+    return false;
+  }
+  if (batch.flags & GOAL_BATCH_REPLACE) {
+    // the phone lost track of what we have: whatever it didn't list is gone,
+    // and dropping it first makes room for what it did
+    for (int slot = goal_store_next(-1); slot >= 0; slot = goal_store_next(slot)) {
+      const goal_record *known = goal_store_get(slot);
+      if (known != NULL && !goal_batch_lists(&batch, known->slug)) {
+        goal_store_remove(slot);
+      }
+    }
+  }
+  bool refused = false;
+  msg_goal_record msg;
+  for (uint16_t at = 0; at + MSG_GOAL_RECORD_SIZE <= batch.records_length; at += MSG_GOAL_RECORD_SIZE) {
+    msg_goal_record_decode(batch.records + at, MSG_GOAL_RECORD_SIZE, &msg);
+    goal_record record = {
+      .losedate = msg.losedate,
+      .updated_at = msg.updated_at,
+      .rate = msg.rate,
+      .safebuf = msg.safebuf,
+      .runits = msg.runits,
+      .flags = msg.flags,
+    };
+    strncpy(record.slug, msg.slug, GOAL_SLUG_LEN);
+    const goal_record *known = goal_store_get(goal_store_find(record.slug));
+    if (known != NULL && known->losedate == record.losedate) {
+      record.flags |= known->flags & GOAL_FLAG_ALERTS; // already alerted for this deadline
+    }
+    if (record.flags & GOAL_FLAG_DELETED) {
+      goal_store_remove(goal_store_find(record.slug));
+    } else if (goal_store_put(&record) < 0) {
+      if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "goal store full"); }
+      refused = true;
+    }
+  }
+  bool stored = goal_store_flush() && !refused;
+  if (stored) {
+    goals_version = batch.version;
+    persist_write_int(PK_GOALS_VERSION, goals_version);
+  } // else keep the old version, and the phone keeps what it had sent us
+  check_goal_alerts(); // after our flush: it flushes its own changes, which would hide a failed write of ours
+  load_active_goal();
+  update_countdown(COUNTDOWN_ALL_UNITS);
+  return stored;
+}
+
+static bool stream_committed(uint8_t kind, const uint8_t *data, uint16_t length) {
+  switch (kind) {
+  case STREAM_KIND_GOALS:
+    return goals_received(data, length);
+  }
+  return true; // a kind we don't know: checked, and ignored
+}
+
 void my_out_sent_handler(DictionaryIterator *sent, void *context) {
 // outgoing message was delivered
+  message_count++;
+  Tuple *message = dict_read_first(sent);
+  if (message != NULL && (message->key == MSG_LOG_DATA || message->key == MSG_HELLO_REPLY)) {
+    log_sent += log_sending;
+    log_sending = 0;
+    log_retry_ms = 0;
+    persist_write_int(PK_LOG_SENT, log_sent);
+    message_count = 0;
+    vibe_count    = 0;
+    if (log_sent < log_head) {
+      log_schedule_upload(1000); // keep going until we've caught up
+    }
+  } else if (message != NULL && message->key == MSG_DP_DATA) {
+    // one timer for whatever batch is out, however often it's been resent
+    if (dp_ack_timer == NULL || !app_timer_reschedule(dp_ack_timer, DP_ACK_TIMEOUT_MS)) {
+      dp_ack_timer = app_timer_register(DP_ACK_TIMEOUT_MS, &dp_ack_timeout, NULL);
+    }
+  }
+  log_outbox_ready();
+  stream_outbox_ready();
+  dp_outbox_ready();
 }
 void my_out_fail_handler(DictionaryIterator *failed, AppMessageResult reason, void *context) {
 // outgoing message failed
   if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "AppMessage Failed to Send: %d", reason); }
+  Tuple *message = dict_read_first(failed);
+  flightrec_log(FLIGHTREC_OUT_FAILED, message != NULL ? message->key : 0, reason);
+  if (log_sending) {
+    // resent from log_sent, soon rather than at the next hour, backing off
+    // while the phone isn't taking them
+    log_sending = 0;
+    log_retry_ms = log_retry_ms ? log_retry_ms * 2 : LOG_RETRY_MIN_MS;
+    if (log_retry_ms > LOG_RETRY_MAX_MS) { log_retry_ms = LOG_RETRY_MAX_MS; }
+    log_schedule_upload(log_retry_ms);
+  }
+  if (message != NULL && message->key == MSG_DP_DATA) {
+    // the queue is still intact: resend after a while, on the same timer
+    dp_sending = 0;
+    if (dp_ack_timer == NULL || !app_timer_reschedule(dp_ack_timer, DP_ACK_TIMEOUT_MS)) {
+      dp_ack_timer = app_timer_register(DP_ACK_TIMEOUT_MS, &dp_ack_timeout, NULL);
+    }
+  }
+  log_outbox_ready();
+  stream_outbox_ready();
+  dp_outbox_ready();
 }
 
-void in_timezone_handler(DictionaryIterator *received, void *context) {
-    Tuple *tz_offset = dict_find(received, AK_TIMEZONE_OFFSET);
-    if (tz_offset != NULL) {
-      timezone_offset = tz_offset->value->int8;
-      update_datetime_subtext();
+void in_timezone_handler(const Tuple *tuple) {
+    msg_timezone msg;
+    if (msg_timezone_unpack(tuple, &msg)) {
+      timezone_offset = msg.offset;
+      invalidate(REDRAW_SUBTEXT);
     }
   if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "Timezone received: %d", timezone_offset); }
 }
 
+// The phone says hello when it starts: everything the watch would otherwise
+// ask for one exchange at a time, and what it thinks the watch has.  The one
+// reply carries whatever that leaves the phone missing.
+void in_hello_handler(const Tuple *tuple) {
+  msg_hello hello;
+  if (!msg_hello_unpack(tuple, &hello)) {
+    return;
+  }
+  timezone_offset = hello.offset;
+  timezone_next_offset = hello.next_offset;
+  timezone_transition = hello.transition;
+  invalidate(REDRAW_SUBTEXT);
+
+  uint8_t needs = 0;
+  if (hello.config_version != settings.config_version) { needs |= HELLO_NEED_CONFIG; }
+  if (hello.goals_version != goals_version)            { needs |= HELLO_NEED_GOALS; }
+  if (settings.slot_bot == SLOT_ID_WEATHER && time(NULL) - weather.received > WEATHER_WANTED_S) {
+    needs |= HELLO_NEED_WEATHER;
+  }
+
+  // the phone knows what it has: resend what it lost, skip what only lost its ack
+  struct {
+    battlog_record log[BATTLOG_BATCH];
+    flightrec_record flight[FLIGHTREC_BATCH];
+  } records;
+  uint8_t count = 0;
+  if (settings.track_battery && !log_sending && hello.log_next <= log_head) {
+    log_sent = hello.log_next;
+    count = log_batch(records.log);
+  }
+  // and the flight recorder from where it left off, right behind the log
+  uint32_t flight_from = hello.flight_next;
+  uint8_t flight_count = flightrec_read(&flight_from, records.flight, FLIGHTREC_BATCH);
+  memmove(&records.log[count], records.flight, flight_count * sizeof(flightrec_record));
+
+  DictionaryIterator *iter;
+  AppMessageResult result = app_message_outbox_begin(&iter);
+  if(iter == NULL || result != APP_MSG_OK) {
+    flightrec_log(FLIGHTREC_OUT_BUSY, MSG_HELLO_REPLY, result); // the log still goes out on its timer
+    return;
+  }
+  msg_hello_reply reply = {
+    .needs = needs,
+    .seq = log_sent,
+    .msg_count = message_count,
+    .vibe_count = vibe_count,
+    .drain_rate = energy.drain[feature_mask()],
+    .log_count = count,
+    .log_head = log_head,
+    .flight_from = flight_from,
+    .flight_head = flightrec_head(),
+    .records = (uint8_t *)&records,
+    .records_length = count * sizeof(battlog_record) + flight_count * sizeof(flightrec_record),
+  };
+  if(msg_hello_reply_write(iter, &reply) != DICT_OK) {
+    return;
+  }
+  app_message_outbox_send();
+  log_sending = count; // as for log_data, see my_out_sent_handler
+  if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "hello: needs %d, %d log, %d flight records", needs, count, flight_count); }
+}
+
+void in_flightrec_request_handler(const Tuple *tuple) {
+  msg_flightrec_request request;
+  if (!msg_flightrec_request_unpack(tuple, &request)) {
+    return;
+  }
+  DictionaryIterator *iter;
+  AppMessageResult result = app_message_outbox_begin(&iter);
+  if(iter == NULL || result != APP_MSG_OK) {
+    flightrec_log(FLIGHTREC_OUT_BUSY, MSG_FLIGHTREC_DATA, result); // the phone asks again later
+    return;
+  }
+  flightrec_record batch[FLIGHTREC_BATCH];
+  uint32_t from = request.from;
+  uint8_t count = flightrec_read(&from, batch, FLIGHTREC_BATCH);
+  msg_flightrec_data msg = {
+    .from = from,
+    .head = flightrec_head(),
+    .records = (uint8_t *)batch,
+    .records_length = count * sizeof(flightrec_record),
+  };
+  if(msg_flightrec_data_write(iter, &msg) != DICT_OK) {
+    return;
+  }
+  app_message_outbox_send();
+}
+
 void in_configuration_handler(DictionaryIterator *received, void *context) {
+    flightrec_log(FLIGHTREC_CONFIG, 0, 0);
+
     // style_inv == inverted
     Tuple *style_inv = dict_find(received, AK_STYLE_INV);
     if (style_inv != NULL) {
       settings.inverted = style_inv->value->uint8;
-      if (style_inv->value->uint8==0) {
-        layer_set_hidden(inverter_layer_get_layer(inverter_layer), true); // hide inversion = dark
-      } else {
-        layer_set_hidden(inverter_layer_get_layer(inverter_layer), false); // show inversion = light
-      }
+      set_theme();
+      apply_theme();
+      invalidate(REDRAW_ROOT);
     }
 
     // style_day_inv == day_invert
@@ -919,12 +1824,7 @@ void in_configuration_handler(DictionaryIterator *received, void *context) {
     Tuple *vibe_hour = dict_find(received, AK_VIBE_HOUR);
     if (vibe_hour != NULL) {
       settings.vibe_hour = vibe_hour->value->uint8;
-      if (settings.vibe_hour && !battery_plugged) {
-        layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), false);
-        bitmap_layer_set_bitmap(bmp_charging_layer, image_hourvibe_icon);
-      } else if (!battery_charging) {
-        layer_set_hidden(bitmap_layer_get_layer(bmp_charging_layer), true);
-      }
+      invalidate(REDRAW_STATUS);
     }
 
     // INTL_DOWO == dayOfWeekOffset
@@ -943,12 +1843,7 @@ void in_configuration_handler(DictionaryIterator *received, void *context) {
     // AK_STYLE_WEEK
     Tuple *style_week = dict_find(received, AK_STYLE_WEEK);
     if (style_week != NULL) {
-      settings.show_week = style_week->value->uint8;
-      if ( settings.show_week ) {
-        layer_set_hidden(text_layer_get_layer(week_layer), false);
-      }  else {
-        layer_set_hidden(text_layer_get_layer(week_layer), true);
-      }
+      settings.show_week = style_week->value->uint8; // shown/hidden by update_datetime_subtext
     }
 
     // AK_INTL_FMT_WEEK == week format (strftime)
@@ -960,16 +1855,11 @@ void in_configuration_handler(DictionaryIterator *received, void *context) {
     // AK_STYLE_DAY
     Tuple *style_day = dict_find(received, AK_STYLE_DAY);
     if (style_day != NULL) {
-      settings.show_day = style_day->value->uint8;
-      if ( settings.show_day ) {
-        layer_set_hidden(text_layer_get_layer(day_layer), false);
-      }  else {
-        layer_set_hidden(text_layer_get_layer(day_layer), true);
-      }
+      settings.show_day = style_day->value->uint8; // shown/hidden by update_datetime_subtext
     }
 
     // now that we've received any changes, redraw the subtext (which processes week, day, and AM/PM)
-    update_datetime_subtext();
+    invalidate(REDRAW_SUBTEXT);
 
     // AK_VIBE_PAT_DISCONNECT / AK_VIBE_PAT_CONNECT == vibration patterns for connect and disconnect
     Tuple *VIBE_PAT_D = dict_find(received, AK_VIBE_PAT_DISCONNECT);
@@ -986,9 +1876,48 @@ void in_configuration_handler(DictionaryIterator *received, void *context) {
     if (track_battery != NULL) {
       settings.track_battery = track_battery->value->uint8;
       if (settings.track_battery) {
-        battery_status_send(NULL); // either it was just turned on, or we'll get a bonus datapoint from running config.
+        log_schedule_upload(0); // either it was just turned on, or we'll get a bonus upload from running config.
       }
     }
+    battery_worker_update(); // features may have changed too
+
+    Tuple *dp_tap = dict_find(received, AK_DP_TAP);
+    if (dp_tap != NULL) {
+      settings.dp_tap = dp_tap->value->uint8;
+      dp_tap_update();
+    }
+
+    // AK_ALERT_WARN / AK_ALERT_URGENT == goal alert thresholds, in hours
+    Tuple *alert_warn = dict_find(received, AK_ALERT_WARN);
+    if (alert_warn != NULL) {
+      settings.alert_warn = alert_warn->value->uint8;
+    }
+    Tuple *alert_urgent = dict_find(received, AK_ALERT_URGENT);
+    if (alert_urgent != NULL) {
+      settings.alert_urgent = alert_urgent->value->uint8;
+    }
+    if (alert_warn != NULL || alert_urgent != NULL) {
+      check_goal_alerts();
+    }
+
+    // AK_VIBE_PAT_ALERT == vibration pattern for goal alerts
+    Tuple *vibe_pat_alert = dict_find(received, AK_VIBE_PAT_ALERT);
+    if (vibe_pat_alert != NULL) {
+      settings.vibe_pat_alert = vibe_pat_alert->value->uint8;
+    }
+
+    // AK_CONFIG_VERSION == config_version, so the phone can tell if we've missed one
+    Tuple *config_version = dict_find(received, AK_CONFIG_VERSION);
+    if (config_version != NULL) {
+      settings.config_version = config_version->value->uint16;
+    }
+
+    // AK_SLOT_BOT == slot_bot, what the bottom slot shows
+    Tuple *slot_bot_id = dict_find(received, AK_SLOT_BOT);
+    if (slot_bot_id != NULL) {
+      settings.slot_bot = slot_bot_id->value->uint8;
+      apply_slot_bot();
+    }
 
     int result = 0;
     result = persist_write_data(PK_SETTINGS, &settings, sizeof(settings) );
@@ -997,10 +1926,12 @@ void in_configuration_handler(DictionaryIterator *received, void *context) {
     result = persist_write_data(PK_LANG_GEN, &lang_gen, sizeof(lang_gen) );
     if(DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
                            "Wrote %d bytes into lang_gen", result); }
-    result = persist_write_data(PK_LANG_DATETIME, &lang_datetime, 
-                                sizeof(lang_datetime) );
-    if(DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
-                           "Wrote %d bytes into lang_datetime", result); }
+    if (lang_datetime_loaded) { // otherwise what's stored is still current
+      result = persist_write_data(PK_LANG_DATETIME, &lang_datetime, 
+                                  sizeof(lang_datetime) );
+      if(DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
+                             "Wrote %d bytes into lang_datetime", result); }
+    }
 
     // ==== Implemented SDK ====
     // Battery
@@ -1017,25 +1948,41 @@ void in_configuration_handler(DictionaryIterator *received, void *context) {
     // PebbleKit JS - more information from phone
     // ==== Future improvements ====
     // Positioning - top, bottom, etc.
-  if(1) { layer_mark_dirty(calendar_layer); }
-  if(1) { layer_mark_dirty(datetime_layer); }
+  invalidate(REDRAW_CALENDAR | REDRAW_DATETIME);
 
   //update_time_text(&currentTime);
 }
 
 void my_in_rcv_handler(DictionaryIterator *received, void *context) {
 // incoming message received
-  Tuple *message_type = dict_find(received, AK_MESSAGE_TYPE);
-  if(message_type != NULL) {
-    if(DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
-                      "Message type %d received", message_type->value->uint8); }
-    switch ( message_type->value->uint8 ) {
-    case AK_TIMEZONE_OFFSET:
-      in_timezone_handler(received, context);
-      return;
-    }
-  } else {
-    // default to configuration, which may not send the message type...
+  message_count++;
+  // a message is a single tuple keyed by its id, anything else is configuration
+  Tuple *message = dict_read_first(received);
+  if (message == NULL) {
+    return;
+  }
+  if(DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
+                    "Message %d received", (int)message->key); }
+  switch ( message->key ) {
+  case MSG_HELLO:
+    in_hello_handler(message);
+    break;
+  case MSG_TIMEZONE:
+    in_timezone_handler(message);
+    break;
+  case MSG_DP_ACK:
+    in_dp_ack_handler(message);
+    break;
+  case MSG_STREAM_CHUNK:
+    stream_handle_chunk(message);
+    break;
+  case MSG_WEATHER:
+    in_weather_handler(message);
+    break;
+  case MSG_FLIGHTREC_REQUEST:
+    in_flightrec_request_handler(message);
+    break;
+  default:
     in_configuration_handler(received, context);
   }
 }
@@ -1044,6 +1991,8 @@ void my_in_drp_handler(AppMessageResult reason, void *context) {
 // incoming message dropped
   if(DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, 
                          "AppMessage Dropped: %d", reason); }
+  flightrec_log(FLIGHTREC_IN_DROPPED, 0, reason);
+  stream_handle_dropped();
 }
 
 static void app_message_init(void) {
@@ -1057,8 +2006,58 @@ static void app_message_init(void) {
                    app_message_outbox_size_maximum());
 }
 
-static void init(void) {
+static void startup_deferred(void *data) {
+  // runs once the first frame is on screen: anything not needed to draw it
+  if (DEBUGLOG) {
+    time_t now_s;
+    uint16_t now_ms;
+    time_ms(&now_s, &now_ms);
+    app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "first frame after %d ms",
+            (int)((now_s - startup_s) * 1000 + now_ms - startup_ms));
+  }
+  flightrec_init();
+  flightrec_log(FLIGHTREC_START, 0, 0);
+  if(persist_exists(PK_ENERGY)) {
+    persist_read_data(PK_ENERGY, &energy, sizeof(energy) );
+  }
+  if(settings.slot_bot != SLOT_ID_WEATHER && persist_exists(PK_WEATHER)) {
+    persist_read_data(PK_WEATHER, &weather, sizeof(weather) ); // the phone's hello asks after it
+  }
+  goal_store_init();
+  if (persist_exists(PK_GOALS_VERSION)) {
+    goals_version = persist_read_int(PK_GOALS_VERSION);
+  }
+  load_active_goal(); // the only goal we need to read
+  if(persist_exists(PK_DP_QUEUE)) {
+    persist_read_data(PK_DP_QUEUE, &dp_queue, sizeof(dp_queue) );
+  } else {
+    dp_queue.next_id = time(0); // so ids after a reinstall don't repeat old ones
+  }
+  if(persist_exists(PK_LOG_SENT)) {
+    log_sent = persist_read_int(PK_LOG_SENT);
+  }
+  log_replay();
+
+  // the phone's messages need all of the above, so the inbox opens last
+  stream_init(&stream_committed);
   app_message_init();
+  battery_state_service_subscribe(&handle_battery);
+  handle_battery(battery_state_service_peek());
+  bluetooth_connection_service_subscribe(&handle_bluetooth);
+  handle_bluetooth(bluetooth_connection_service_peek());
+  app_worker_message_subscribe(&handle_worker_message);
+  battery_worker_update();
+  dp_tap_update();
+  vibe_suppression = false;
+
+  update_countdown(COUNTDOWN_ALL_UNITS);
+  invalidate(REDRAW_CONNECTION | REDRAW_WEATHER);
+  check_goal_alerts(); // reads every goal
+  // nothing to ask the phone: it says hello when it starts, see in_hello_handler
+}
+
+static void init(void) {
+  time_ms(&startup_s, &startup_ms);
 
   if(persist_exists(PK_SETTINGS)) {
     persist_read_data(PK_SETTINGS, &settings, sizeof(settings) );
@@ -1066,11 +2065,13 @@ static void init(void) {
   if(persist_exists(PK_LANG_GEN)) {
     persist_read_data(PK_LANG_GEN, &lang_gen, sizeof(lang_gen) );
   }
-  if(persist_exists(PK_LANG_DATETIME)) {
-    persist_read_data(PK_LANG_DATETIME, &lang_datetime, sizeof(lang_datetime) );
+  // PK_LANG_DATETIME is read on first use, see ensure_lang_datetime()
+  if(settings.slot_bot == SLOT_ID_WEATHER && persist_exists(PK_WEATHER)) {
+    persist_read_data(PK_WEATHER, &weather, sizeof(weather) ); // it's on the first frame
   }
+  // everything else waits for the first frame, see startup_deferred()
 
-  request_timezone();
+  set_theme();
 
   window = window_create();
   window_set_window_handlers(window, (WindowHandlers) {
@@ -1078,17 +2079,19 @@ static void init(void) {
     .unload = window_unload
   });
   const bool animated = false;
-  window_set_background_color(window, GColorBlack);
+  window_set_background_color(window, theme_bg);
   window_stack_push(window, animated);
 
   //update_time_text();
 
-  tick_timer_service_subscribe(MINUTE_UNIT, &handle_minute_tick);
-  battery_state_service_subscribe(&handle_battery);
-  handle_battery(battery_state_service_peek()); // initialize
-  bluetooth_connection_service_subscribe(&handle_bluetooth);
-  handle_bluetooth(bluetooth_connection_service_peek()); // initialize
-  vibe_suppression = false;
+  tick_timer_service_subscribe(tick_unit, &handle_tick);
+  show_battery(battery_state_service_peek());
+  bluetooth_connected = bluetooth_connection_service_peek();
+  update_connection(); // vibes are still suppressed
+
+  // the calls above only queued their work, do it before the first frame
+  if (redraw_timer != NULL) { app_timer_cancel(redraw_timer); }
+  redraw(NULL);
 }
 
 int main(void) {
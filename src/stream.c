@@ -0,0 +1,140 @@
+#include <pebble.h>
+#include "stream.h"
+#include "flightrec.h"
+#include "messages.auto.h"
+#define DEBUGLOG 0
+
+static StreamCommitHandler commit_handler = NULL;
+static uint8_t *buffer = NULL;   // the payload being received, NULL if none
+static uint8_t id = 0;
+static uint8_t kind = 0;
+static uint16_t length = 0;
+static uint32_t crc = 0;
+static uint16_t received = 0;
+static int16_t done_id = -1;     // the last stream committed, to re-ack its resends
+static uint16_t done_length = 0; // and its length and crc, so a new stream that
+static uint32_t done_crc = 0;    // happens to reuse its id isn't taken for one
+// the ack to send, kept until the outbox takes it
+static msg_stream_ack ack;
+static bool ack_pending = false;
+
+static uint32_t crc32(const uint8_t *data, uint16_t size) {
+  uint32_t value = 0xFFFFFFFF;
+  while (size--) {
+    value ^= *data++;
+    for (int bit = 0; bit < 8; bit++) {
+      value = (value >> 1) ^ (0xEDB88320 & -(value & 1));
+    }
+  }
+  return ~value;
+}
+
+static void send_ack(uint8_t stream_id, uint8_t status, uint16_t next) {
+  if (ack_pending && ack.id == stream_id && ack.status == STREAM_GAP &&
+      status == STREAM_PROGRESS && next == ack.next) {
+    return; // the gap is still news, this isn't
+  }
+  ack = (msg_stream_ack) {
+    .id = stream_id, .status = status, .next = next,
+    .inbox = app_message_inbox_size_maximum(),
+  };
+  ack_pending = true;
+  stream_outbox_ready();
+}
+
+void stream_outbox_ready(void) {
+  if (!ack_pending) {
+    return;
+  }
+  DictionaryIterator *iter;
+  AppMessageResult result = app_message_outbox_begin(&iter);
+  if (iter == NULL || result != APP_MSG_OK) {
+    return; // still busy, the newest ack goes out when it's free
+  }
+  if (msg_stream_ack_write(iter, &ack) != DICT_OK) {
+    return;
+  }
+  app_message_outbox_send();
+  ack_pending = false;
+}
+
+static void discard() {
+  if (buffer != NULL) {
+    free(buffer);
+    buffer = NULL;
+  }
+}
+
+void stream_handle_chunk(const Tuple *tuple) {
+  msg_stream_chunk chunk;
+  if (!msg_stream_chunk_unpack(tuple, &chunk)) {
+    return;
+  }
+  if (buffer == NULL && chunk.id == done_id && chunk.length == done_length && chunk.crc == done_crc) {
+    send_ack(chunk.id, STREAM_COMPLETE, chunk.length); // our ack got lost
+    return;
+  }
+  if (chunk.offset == 0 && (buffer == NULL || chunk.id != id)) {
+    // a new stream replaces whatever was in progress
+    discard();
+    if (chunk.length > STREAM_MAX ||
+        (buffer = malloc(chunk.length > 0 ? chunk.length : 1)) == NULL) {
+      send_ack(chunk.id, STREAM_REJECTED, 0);
+      return;
+    }
+    id = chunk.id;
+    kind = chunk.kind;
+    length = chunk.length;
+    crc = chunk.crc;
+    received = 0;
+  }
+  if (buffer == NULL || chunk.id != id) {
+    send_ack(chunk.id, STREAM_GAP, 0); // we never saw its start
+    return;
+  }
+  if (chunk.offset > received) {
+    send_ack(id, STREAM_GAP, received);
+    return;
+  }
+  if (chunk.offset < received) {
+    send_ack(id, STREAM_PROGRESS, received); // a resend of what we have
+    return;
+  }
+  uint16_t size = chunk.data_length < length - received ? chunk.data_length : length - received;
+  memcpy(buffer + received, chunk.data, size);
+  received += size;
+  if (received < length) {
+    send_ack(id, STREAM_PROGRESS, received);
+    return;
+  }
+  if (crc32(buffer, length) != crc) {
+    if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__, "stream %d corrupt", id); }
+    discard();
+    send_ack(id, STREAM_CORRUPT, 0);
+    return;
+  }
+  if (!commit_handler(kind, buffer, length)) {
+    discard();
+    send_ack(id, STREAM_REJECTED, 0); // so the phone doesn't count it as delivered
+    return;
+  }
+  discard();
+  done_id = id;
+  done_length = length;
+  done_crc = crc;
+  send_ack(id, STREAM_COMPLETE, length);
+}
+
+void stream_handle_dropped(void) {
+  if (buffer != NULL) {
+    send_ack(id, STREAM_GAP, received); // tell the phone now rather than on its timeout
+  }
+}
+
+void stream_init(StreamCommitHandler handler) {
+  commit_handler = handler;
+}
+
+void stream_deinit(void) {
+  discard();
+}
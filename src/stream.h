@@ -0,0 +1,32 @@
+// Reliable phone -> watch streams, for payloads too big or too important for
+// a single AppMessage.
+//
+// The phone splits a payload into stream_chunk messages sized to our inbox
+// and keeps a window of them in flight.  Chunks are only taken in order: each
+// one is answered with a stream_ack saying how much of the payload we hold.
+// A chunk past that, or a dropped message, is answered STREAM_GAP, which makes
+// the phone go back and resend from there.  Once the whole payload is in, its
+// CRC-32 is checked before it's handed to the commit handler; a bad one makes
+// the phone start over, and one the handler couldn't apply is rejected.  Chunks of the stream last committed (the same id,
+// length and CRC) are acked STREAM_COMPLETE again, for when that ack was lost.
+
+#define STREAM_MAX        4096 // largest payload we'll buffer
+
+// stream_chunk.kind
+#define STREAM_KIND_GOALS    1 // a run of goal_record records
+
+// stream_ack.status
+#define STREAM_PROGRESS      0 // next = bytes held so far
+#define STREAM_COMPLETE      1 // checked and committed
+#define STREAM_CORRUPT       2 // the CRC didn't match, start over
+#define STREAM_REJECTED      3 // too big, no memory for it, or not applied
+#define STREAM_GAP           4 // next = bytes held so far, something after it went missing
+
+// false if the payload couldn't be applied, in whole or in part
+typedef bool (*StreamCommitHandler)(uint8_t kind, const uint8_t *data, uint16_t length);
+
+void stream_init(StreamCommitHandler handler);
+void stream_handle_chunk(const Tuple *tuple);
+void stream_handle_dropped(void);  // an inbound message was dropped
+void stream_outbox_ready(void);    // call once the outbox is free, to send an ack that had to wait
+void stream_deinit(void);
@@ -0,0 +1,71 @@
+// Time to interactive for the configuration page (see config-page.js).  The
+// page is built on the phone and opened as a data: URL with its style and
+// script inline, so once the showConfiguration handler has built it there is
+// nothing left to fetch: the webview can lay it out and take taps straight
+// away.  Its time to interactive is the handler's time plus the webview's
+// parse of the page, and this measures the handler (real time, over many
+// runs, with the settings, energy profile and flight log all filled in), the
+// size of what the webview has to parse, and that it references nothing
+// outside itself.  How long a saved page takes to reach the watch is in
+// bench_roundtrip.js.  Run with `make -C test bench`.
+
+"use strict";
+var harness = require("./harness");
+var MINUTE = harness.MINUTE;
+
+var RUNS = 200;
+var VIBE_PATTERNS = 8; // generate_vibe's 0-7
+
+function percentile(sorted, p) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p))];
+}
+
+(async function() {
+  var rig = harness.rig();
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ buser: "alice", btoken: "secret", bgoal: "pushups", slot_bot: 2 });
+  await rig.run(MINUTE);
+
+  // the most the page ever shows
+  var flight = [];
+  for(var i = 0; i < 200; i++) { flight.push("2026-03-02T09:" + (i % 60) + ":00.000Z send failed hello SEND_TIMEOUT"); }
+  rig.phone.storage.flight_log = JSON.stringify(flight);
+  rig.phone.storage.energy_profile = JSON.stringify({
+    segments: 12, base: 0.41, per_message: 0.002, per_vibe: 0.01, hours_left: 153,
+    features: { vibe_hour: 0.05, track_battery: 0.02, inverted: 0.01, subtext: 0.03 }
+  });
+
+  var times = [];
+  for(var run = 0; run < RUNS; run++) {
+    var started = process.hrtime.bigint();
+    rig.phone.emit("showConfiguration", {});
+    times.push(Number(process.hrtime.bigint() - started) / 1e6);
+  }
+  times.sort(function(a, b) { return a - b; });
+  var url = rig.phone.urls[rig.phone.urls.length - 1];
+  var page = decodeURIComponent(url.slice(url.indexOf(",") + 1));
+  var elements = (page.match(/<[a-z][^>]*>/g) || []).length;
+  var external = page.match(/\b(src|href)\s*=|url\(|@import|https?:\/\//g) || [];
+  var selects = page.match(/<select id="vibe[^"]*"[^>]*>[\s\S]*?<\/select>/g) || [];
+  var patterns = selects.map(function(select) { return (select.match(/<option /g) || []).length; });
+
+  harness.table([{
+    "build ms (median)": percentile(times, 0.5).toFixed(2),
+    "build ms (p95)": percentile(times, 0.95).toFixed(2),
+    "URL bytes": url.length, "page bytes": page.length, elements: elements,
+    "external refs": external.length
+  }]);
+
+  harness.check(percentile(times, 0.95) < 20, "the page is built in under 20 ms (p95 " +
+                percentile(times, 0.95).toFixed(2) + " ms)");
+  harness.check(external.length === 0, "nothing to fetch before the page is interactive" +
+                (external.length ? ": " + external.join(" ") : ""));
+  harness.check(url.length < 32 * 1024, "the URL stays under 32 KB (" + url.length + ")");
+  harness.check(selects.length === 4 && patterns.every(function(n) { return n === VIBE_PATTERNS; }),
+                "every vibe setting offers all " + VIBE_PATTERNS + " patterns (" + patterns.join(" ") + ")");
+  await rig.stop();
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
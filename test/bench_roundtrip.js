@@ -0,0 +1,162 @@
+// What the phone and watch say to each other to stay in step, over a lossy
+// link: messages, bytes on the air and how long until the watch shows the
+// right thing, for
+//
+//   - the timezone: at startup (the hello round trip), across a daylight
+//     saving change the hello announced, and after travel it didn't,
+//   - a configuration saved on the phone,
+//   - a day of battery telemetry, batched.
+//
+// Each at 0%, 10% and 30% packet loss, averaged over a few seeds, with the
+// slowest run's time too.  Run with `make -C test bench`.
+
+"use strict";
+var harness = require("./harness");
+var MINUTE = harness.MINUTE, HOUR = harness.HOUR, DAY = harness.DAY;
+
+var PK_LOG_HEAD = 4; // see battlog.h
+var losses = [0, 0.1, 0.3];
+var seeds = [1, 2, 3, 4, 5];
+
+// GMT text as update_timezone_text shows it, for minutes west of UTC
+function gmt(minutes) {
+  var hours = minutes / 60;
+  return new RegExp("^GMT" + (hours > 0 ? "-" + hours : "\\+" + Math.abs(hours)) + "$");
+}
+
+// a rig with the timezone shown below the time, already configured
+async function configured(options) {
+  var rig = harness.rig(options);
+  var loss = rig.options.loss;
+  rig.options.loss = 0;
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ style_week: 2, track_battery: options.track_battery || 0 });
+  await rig.run(MINUTE);
+  rig.options.loss = loss;
+  return rig;
+}
+
+async function timezone(loss, seed) {
+  var rows = [];
+
+  // a cold start of both ends, in UTC+2
+  var rig = await configured({ loss: loss, tz: -120, seed: seed });
+  await rig.watch.stop();
+  rig.phone.stop();
+  await rig.setZone(-60); // the watch still shows +2 from before
+  await rig.watch.start();
+  var mark = rig.mark();
+  rig.phone.start();
+  var ms = await rig.untilScreen(gmt(-60), 10 * MINUTE);
+  rows.push(Object.assign({ case: "startup" }, mark(), { converged: ms }));
+
+  // a daylight saving change, announced by the hello: the watch switches on
+  // its own when the phone's clock sync moves its time
+  var change = rig.sim.now + 30 * MINUTE;
+  rig.phone.setZone(change, -120);
+  rig.restartPhone(); // a fresh hello knows about the change
+  await rig.run(5 * MINUTE);
+  await rig.run(change - rig.sim.now);
+  mark = rig.mark();
+  await rig.watch.command("tz -120");
+  ms = await rig.untilScreen(gmt(-120), 2 * HOUR);
+  rows.push(Object.assign({ case: "dst" }, mark(), { converged: ms }));
+
+  // travel: nobody knew, the watch finds out when it next asks
+  await rig.run(10 * MINUTE);
+  mark = rig.mark();
+  await rig.setZone(300);
+  ms = await rig.untilScreen(gmt(300), 3 * HOUR);
+  rows.push(Object.assign({ case: "travel" }, mark(), { converged: ms }));
+  await rig.stop();
+  return rows;
+}
+
+async function config(loss, seed) {
+  var rig = await configured({ loss: loss, seed: seed });
+  var mark = rig.mark();
+  rig.phone.configure({ style_week: 1 }); // week number instead of the timezone
+  var ms = await rig.untilScreen(/^W\d+$/, 10 * MINUTE);
+  var row = Object.assign({ case: "config" }, mark(), { converged: ms });
+  await rig.stop();
+  return [row];
+}
+
+// a day on battery: a percent every 15 minutes, the link down for 20
+// minutes every 6 hours
+async function telemetry(loss, seed) {
+  var rig = await configured({ loss: loss, seed: seed, track_battery: 1 });
+  var mark = rig.mark();
+  for(var quarter = 0; quarter < 96; quarter++) {
+    if(quarter % 24 === 12) {
+      await rig.setLink(false);
+      await rig.run(20 * MINUTE);
+      await rig.setLink(true);
+    }
+    await rig.run(15 * MINUTE);
+    await rig.watch.command("battery " + Math.max(5, 80 - quarter) + " 0 0");
+  }
+  var head, got;
+  var ms = await rig.until(async function() {
+    head = await rig.watch.persistInt(PK_LOG_HEAD);
+    got = Number(rig.phone.storage.battery_log_seq || -1) + 1;
+    return got >= head;
+  }, 2 * HOUR);
+  var row = Object.assign({ case: "telemetry" }, mark(),
+                          { records: got, logged: head, converged: ms });
+  await rig.stop();
+  return [row];
+}
+
+// mean counts over the seeds; convergence mean and worst, any that never did
+function summarize(loss, runs) {
+  function mean(key) {
+    return Math.round(runs.reduce(function(sum, r) { return sum + r[key]; }, 0) / runs.length);
+  }
+  var times = runs.map(function(r) { return r.converged; });
+  var never = times.filter(function(t) { return t < 0; }).length;
+  var done = times.filter(function(t) { return t >= 0; });
+  return {
+    loss: loss * 100 + "%", case: runs[0].case,
+    messages: mean("messages"), bytes: mean("bytes"), packets: mean("packets"),
+    converged: done.length ? harness.seconds(done.reduce(function(a, b) { return a + b; }, 0) / done.length) : "never",
+    worst: never ? never + " never" : harness.seconds(Math.max.apply(null, done)),
+    records: runs[0].logged === undefined ? "" :
+      runs.reduce(function(sum, r) { return sum + r.records; }, 0) + "/" +
+      runs.reduce(function(sum, r) { return sum + r.logged; }, 0),
+    never: never,
+    slowest: done.length ? Math.max.apply(null, done) : -1
+  };
+}
+
+(async function() {
+  var rows = [];
+  for(var i = 0; i < losses.length; i++) {
+    var loss = losses[i], runs = {};
+    for(var j = 0; j < seeds.length; j++) {
+      var results = [].concat(await timezone(loss, seeds[j]), await config(loss, seeds[j]),
+                              await telemetry(loss, seeds[j]));
+      results.forEach(function(row) { (runs[row.case] = runs[row.case] || []).push(row); });
+    }
+    Object.keys(runs).forEach(function(name) { rows.push(summarize(loss, runs[name])); });
+  }
+  harness.table(rows.map(function(row) {
+    return { loss: row.loss, case: row.case, messages: row.messages, bytes: row.bytes,
+             packets: row.packets, converged: row.converged, worst: row.worst, records: row.records };
+  }));
+
+  function find(name, loss) { return rows.filter(function(row) { return row.case === name && row.loss === loss; })[0]; }
+  harness.check(find("startup", "0%").slowest < MINUTE, "timezone set at startup");
+  harness.check(find("dst", "0%").slowest <= MINUTE, "announced DST change shown without asking the phone");
+  harness.check(find("travel", "0%").slowest <= HOUR, "travel picked up within the hour");
+  harness.check(find("config", "0%").slowest < MINUTE, "configuration delivered");
+  losses.forEach(function(loss) {
+    var row = find("telemetry", loss * 100 + "%");
+    harness.check(!row.never && /^(\d+)\/\1$/.test(row.records),
+                  "every battery record delivered at " + row.loss + " loss");
+  });
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,82 @@
+// Time to the first frame: what the face reads from persistent storage
+// before it draws, against what it leaves for startup_deferred(), for
+//
+//   - a fresh install,
+//   - a watch with a full goal store, a day of battery log, queued
+//     datapoints and the weather slot showing.
+//
+// Every persist lookup is a flash access on the watch, so the reads before
+// the first frame are what its time depends on; the host's own time to get
+// there is shown too, for what it's worth on a desktop CPU.  Run with
+// `make -C test bench`.
+
+"use strict";
+var harness = require("./harness");
+var servers = require("./servers");
+var MINUTE = harness.MINUTE, HOUR = harness.HOUR;
+
+async function measure(rig) {
+  await rig.restartWatch();
+  var first = rig.watch.firstFrame;
+  await rig.run(MINUTE);
+  var stat = await rig.watch.stat();
+  return { first: first, reads: stat.reads, readBytes: stat.readBytes };
+}
+
+async function fresh() {
+  var rig = harness.rig();
+  await rig.start();
+  var row = await measure(rig);
+  await rig.stop();
+  return row;
+}
+
+async function busy() {
+  var rig = harness.rig();
+  var goals = [];
+  for(var i = 0; i < 40; i++) {
+    goals.push({ slug: "goal-" + i, losedate: rig.sim.now / 1000 + (i + 1) * 86400,
+                 updated_at: 1, rate: 1, safebuf: i % 7, runits: "d" });
+  }
+  rig.servers.push(new servers.Beeminder({ goals: goals }), new servers.Weather());
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ buser: "alice", btoken: "secret", bgoal: "goal-0", dp_tap: 1,
+                        track_battery: 1, slot_bot: 2 });
+  await rig.run(HOUR);
+  for(var h = 0; h < 24; h++) {
+    await rig.watch.command("battery " + (90 - h * 2) + " 0 0");
+    await rig.run(HOUR);
+  }
+  await rig.setLink(false); // so a few datapoints wait on the watch
+  for(var tap = 0; tap < 3; tap++) {
+    await rig.watch.command("tap");
+    await rig.run(500);
+    await rig.watch.command("tap");
+    await rig.run(5000);
+  }
+  var row = await measure(rig);
+  await rig.stop();
+  return row;
+}
+
+(async function() {
+  var rows = [["fresh install", await fresh()], ["busy watch", await busy()]].map(function(r) {
+    var m = r[1];
+    return { watch: r[0], "reads first": m.first.reads, "bytes first": m.first.readBytes,
+             "writes first": m.first.writes, "host us": m.first.us,
+             "reads deferred": m.reads - m.first.reads, "bytes deferred": m.readBytes - m.first.readBytes };
+  });
+  harness.table(rows);
+
+  rows.forEach(function(row) {
+    harness.check(row["writes first"] === 0, row.watch + ": nothing written before the first frame");
+    harness.check(row["reads first"] <= 6, row.watch + ": only the settings, strings and weather read first (" +
+                  row["reads first"] + " lookups)");
+  });
+  harness.check(rows[1]["reads deferred"] > rows[1]["reads first"],
+                "the busy watch's other reads all came after the first frame (" + rows[1]["reads deferred"] + ")");
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,95 @@
+// Stream throughput to the watch (see stream.h): a full STREAM_MAX payload
+// over a lossy link, for a few inbox sizes, in bytes/s of simulated time,
+// with the chunks and acks it took against the fewest it could have.
+// Averaged over a few seeds.  Each lost message or ack holds up its sender's
+// queue for an AppMessage timeout, which is what most of the time goes on;
+// the biggest chunks don't pay off under loss, as a chunk is lost whenever
+// any of its packets is, so the phone sends smaller ones once they fail.
+// Every run has to be delivered, however lossy.  Run with `make -C test bench`.
+
+"use strict";
+var harness = require("./harness");
+var MINUTE = harness.MINUTE;
+
+var PAYLOAD = 4096;               // STREAM_MAX
+var inboxes = [124, 656, 8200];   // SDK 2's minimum, what we ask for, more than a chunk can use
+var losses = [0, 0.05, 0.1, 0.3];
+var seeds = [1, 2, 3];
+
+function payload(seed) {
+  var random = harness.random(seed), bytes = [];
+  for(var i = 0; i < PAYLOAD; i++) { bytes.push(Math.floor(random() * 256)); }
+  return bytes;
+}
+
+// send bytes as a stream of kind 0, which the watch checks and then ignores
+function stream(rig, bytes) {
+  var result = { done: false, ok: false };
+  rig.phone.context.streamSend(0, bytes, function(ok) {
+    result.done = true;
+    result.ok = ok;
+  });
+  return result;
+}
+
+async function run(inbox, loss, seed) {
+  var rig = harness.rig({ inbox: inbox, seed: seed });
+  await rig.start();
+  await rig.run(MINUTE);
+  var warmup = stream(rig, [0]); // so the phone knows the watch's inbox
+  await rig.until(function() { return warmup.done; }, MINUTE);
+  var size = rig.phone.context.streamChunkSize();
+
+  rig.options.loss = loss;
+  var chunks = rig.stats().toWatch.byType.stream_chunk || 0;
+  var acks = rig.stats().fromWatch.byType.stream_ack || 0;
+  var started = rig.sim.now;
+  var result = stream(rig, payload(seed));
+  var ms = await rig.until(function() { return result.done; }, 10 * MINUTE);
+  var row = {
+    inbox: inbox, loss: loss, size: size, ok: result.ok ? 1 : 0,
+    ms: ms < 0 ? rig.sim.now - started : ms,
+    chunks: (rig.stats().toWatch.byType.stream_chunk || 0) - chunks,
+    acks: (rig.stats().fromWatch.byType.stream_ack || 0) - acks,
+    ideal: Math.ceil(PAYLOAD / size)
+  };
+  await rig.stop();
+  return row;
+}
+
+(async function() {
+  var rows = [];
+  for(var i = 0; i < inboxes.length; i++) {
+    for(var j = 0; j < losses.length; j++) {
+      var runs = [];
+      for(var k = 0; k < seeds.length; k++) {
+        runs.push(await run(inboxes[i], losses[j], seeds[k]));
+      }
+      var sum = function(key) { return runs.reduce(function(total, r) { return total + r[key]; }, 0); };
+      rows.push({ inbox: inboxes[i], loss: losses[j], size: runs[0].size, ideal: runs[0].ideal,
+                  delivered: sum("ok"), runs: runs.length,
+                  rate: Math.round(sum("ok") * PAYLOAD / (sum("ms") / 1000)),
+                  chunks: sum("chunks") / runs.length, acks: sum("acks") / runs.length,
+                  maxChunks: Math.max.apply(null, runs.map(function(r) { return r.chunks; })),
+                  minChunks: Math.min.apply(null, runs.map(function(r) { return r.chunks; })) });
+    }
+  }
+  harness.table(rows.map(function(row) {
+    return { inbox: row.inbox, loss: row.loss * 100 + "%", "chunk bytes": row.size,
+             delivered: row.delivered + "/" + row.runs, "bytes/s": row.rate,
+             chunks: row.chunks.toFixed(1), fewest: row.ideal, acks: row.acks.toFixed(1) };
+  }));
+
+  rows.forEach(function(row) {
+    if(row.loss === 0) {
+      harness.check(row.minChunks === row.ideal && row.maxChunks === row.ideal,
+                    "inbox " + row.inbox + ", no loss: " + row.ideal + " chunks, none resent");
+    }
+    harness.check(row.delivered === row.runs, "inbox " + row.inbox + ", " + row.loss * 100 + "% loss: " +
+                  row.delivered + "/" + row.runs + " delivered");
+    harness.check(row.size <= 2048, "inbox " + row.inbox + ": chunks within the schema's 2048 bytes (" + row.size + ")");
+  });
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,97 @@
+// The phone's TimeSeries store (see pebble-js-app.js): append throughput,
+// what compaction costs, and that storage stays bounded however long it runs,
+// against the single growing JSON array it replaced.  Wall-clock times, on
+// this machine; a phone is maybe ten times slower.
+
+"use strict";
+var harness = require("./harness");
+
+var POINTS = 60000;          // ~1.7 years of 15 minute samples, enough to age out days
+var NAIVE_POINTS = 2000;     // the old way gets slow long before that
+var STEP = 15 * harness.MINUTE;
+
+function now() {
+  var t = process.hrtime();
+  return t[0] * 1000 + t[1] / 1e6;
+}
+
+function storageBytes(storage, prefix) {
+  return Object.keys(storage).filter(function(k) { return k.indexOf(prefix) === 0; })
+    .reduce(function(sum, k) { return sum + k.length + storage[k].length; }, 0);
+}
+
+function sample(i, start) {
+  return { t: start + i * STEP,
+           values: { p: 100 - i % 100, c: i % 100 > 90 ? 1 : 0, u: 0, l: 1, f: 2,
+                     why: 1, m: i % 7, v: i % 3, r: 40 } };
+}
+
+(async function() {
+  var rig = harness.rig();
+  rig.phone.start(); // the JS only; nothing answers its messages
+  var context = rig.phone.context, storage = rig.phone.storage;
+  var TimeSeries = context.TimeSeries;
+  var limits = TimeSeries.limits;
+  var bound = limits.size * (limits.raw + limits.hour + limits.day);
+
+  // time compaction on its own, and count it per tier
+  var compact = TimeSeries.prototype.compact;
+  var compactions = { raw: 0, hour: 0, day: 0 }, compactMs = 0;
+  TimeSeries.prototype.compact = function(tier) {
+    var started = now();
+    compactions[tier]++;
+    compact.call(this, tier);
+    if(tier === "raw") { compactMs += now() - started; } // includes the tiers it cascades into
+  };
+
+  var series = new TimeSeries("bench", context.batteryFields);
+  var start = rig.sim.now, maxBytes = 0, slowest = 0;
+  var began = now();
+  for(var i = 0; i < POINTS; i++) {
+    var s = sample(i, start), t0 = now();
+    series.append(s.t, s.values);
+    slowest = Math.max(slowest, now() - t0);
+    if(i % 1000 === 0) { maxBytes = Math.max(maxBytes, storageBytes(storage, "ts.bench.")); }
+  }
+  var appendMs = now() - began;
+  maxBytes = Math.max(maxBytes, storageBytes(storage, "ts.bench."));
+
+  began = now();
+  var all = series.query(0, Infinity);
+  var queryMs = now() - began;
+  var ordered = all.every(function(p, k) { return k === 0 || p.t >= all[k - 1].t; });
+  var reopened = new TimeSeries("bench", context.batteryFields).query(0, Infinity);
+
+  // what it replaced: one array, parsed and rewritten on every append
+  began = now();
+  for(i = 0; i < NAIVE_POINTS; i++) {
+    s = sample(i, start);
+    var history = JSON.parse(storage.naive || "[]");
+    history.push(Object.assign({ t: s.t }, s.values));
+    storage.naive = JSON.stringify(history);
+  }
+  var naiveMs = now() - began;
+
+  harness.table([
+    { store: "TimeSeries", points: POINTS, "appends/s": Math.round(POINTS / appendMs * 1000),
+      "slowest ms": slowest.toFixed(2), compactions: compactions.raw + "/" + compactions.hour + "/" + compactions.day,
+      "compact ms": compactMs.toFixed(0), kept: all.length, "storage KB": (maxBytes / 1024).toFixed(1),
+      "query ms": queryMs.toFixed(1) },
+    { store: "one array", points: NAIVE_POINTS, "appends/s": Math.round(NAIVE_POINTS / naiveMs * 1000),
+      "slowest ms": "", compactions: "", "compact ms": "", kept: NAIVE_POINTS,
+      "storage KB": (storage.naive.length / 1024).toFixed(1), "query ms": "" }
+  ]);
+
+  harness.check(all.length <= bound, "at most " + bound + " points kept (" + all.length + ")");
+  harness.check(maxBytes < 256 * 1024, "storage bounded (" + (maxBytes / 1024).toFixed(1) + " KB at most)");
+  harness.check(ordered, "query returns points oldest first");
+  harness.check(reopened.length === all.length, "a fresh instance reads back the same points");
+  harness.check(all.filter(function(p) { return p.tier === "day"; }).length > 0 && compactions.day > 0,
+                "old points rolled up into days, the oldest days aged out");
+  harness.check(POINTS / appendMs * 1000 > 1000, "over 1000 appends/s");
+  rig.phone.stop();
+  await rig.stop();
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,105 @@
+// What a day of the weather slot costs: web requests, position fixes and
+// Bluetooth messages, against the Open-Meteo stand-in's default day (it warms
+// up until mid-afternoon and rains after noon), for
+//
+//   - a day at home,
+//   - a commute: to another cell in the morning, back in the evening,
+//   - a day with the link down for half an hour every four hours,
+//
+// each averaged over a few seeds, with how long the watch showed blanked
+// (stale) weather.  Run with `make -C test bench`.
+
+"use strict";
+var harness = require("./harness");
+var servers = require("./servers");
+var MINUTE = harness.MINUTE, HOUR = harness.HOUR;
+
+var seeds = [1, 2, 3];
+var home = { latitude: 52.37, longitude: 4.89 };
+var work = { latitude: 52.09, longitude: 5.12 };
+
+var days = {
+  home: function(rig, hour) { },
+  commute: async function(rig, hour) {
+    if(hour === 8) { rig.phone.position = work; }
+    if(hour === 18) { rig.phone.position = home; }
+  },
+  patchy: async function(rig, hour) {
+    if(hour % 4 === 2) {
+      await rig.setLink(false);
+      await rig.run(30 * MINUTE);
+      await rig.setLink(true);
+    }
+  }
+};
+
+async function day(name, seed) {
+  var rig = harness.rig({ seed: seed, start: Date.UTC(2026, 2, 2, 0, 0, 0) });
+  var weather = new servers.Weather();
+  rig.servers.push(weather);
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ slot_bot: 2 });
+  await rig.run(10 * MINUTE);
+
+  var mark = rig.mark(), requests = weather.requests, positions = rig.phone.counts.positions;
+  var before = Object.assign({}, rig.stats().toWatch.byType);
+  var start = rig.sim.now, blank = 0, shown = {};
+  for(var hour = 0; hour < 24; hour++) {
+    await days[name](rig, hour);
+    // look at the watch every 5 minutes until the hour's up
+    while(rig.sim.now < start + (hour + 1) * HOUR) {
+      await rig.run(5 * MINUTE);
+      var text = await rig.watch.text();
+      if(text.indexOf("--°") >= 0) { blank += 5 * MINUTE; }
+      text.filter(function(t) { return /°$/.test(t); }).forEach(function(t) { shown[t] = true; });
+    }
+  }
+  var after = rig.stats().toWatch.byType;
+  function count(type) { return (after[type] || 0) - (before[type] || 0); }
+  var row = Object.assign({ day: name }, mark(), {
+    cells: Object.keys(weather.cells).length,
+    fetches: weather.requests - requests, fixes: rig.phone.counts.positions - positions,
+    weather: count("weather"), timezone: count("timezone"),
+    temps: Object.keys(shown).length, blank: blank
+  });
+  await rig.stop();
+  return row;
+}
+
+(async function() {
+  var rows = [];
+  var names = Object.keys(days);
+  for(var i = 0; i < names.length; i++) {
+    var runs = [];
+    for(var j = 0; j < seeds.length; j++) {
+      runs.push(await day(names[i], seeds[j]));
+    }
+    var mean = {};
+    Object.keys(runs[0]).forEach(function(key) {
+      mean[key] = typeof runs[0][key] === "number" ?
+        Math.round(runs.reduce(function(sum, r) { return sum + r[key]; }, 0) / runs.length) : runs[0][key];
+    });
+    rows.push(mean);
+  }
+  harness.table(rows.map(function(row) {
+    return { day: row.day, cells: row.cells, fetches: row.fetches, "GPS fixes": row.fixes,
+             "weather msgs": row.weather, "timezone msgs": row.timezone,
+             "all msgs": row.messages, "all bytes": row.bytes, temps: row.temps,
+             blank: harness.seconds(row.blank) };
+  }));
+
+  function find(name) { return rows.filter(function(row) { return row.day === name; })[0]; }
+  rows.forEach(function(row) {
+    harness.check(row.fetches <= 2 * 24, row.day + ": at most two fetches an hour (" + row.fetches + ")");
+    harness.check(row.fixes <= 24 + 2, row.day + ": about one position fix an hour (" + row.fixes + ")");
+    harness.check(row.weather <= row.fetches, row.day + ": no more weather messages than fetches (" + row.weather + ")");
+    harness.check(row.temps > 1, row.day + ": the temperature on the watch followed the day");
+    harness.check(row.blank === 0, row.day + ": the weather never went stale");
+  });
+  harness.check(find("commute").cells === 2, "the commute's weather came from both cells");
+  harness.check(find("home").weather < 24, "at home, only changed weather is sent (" + find("home").weather + ")");
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,273 @@
+// The goal store (../src/goal_store.c) against the host's persistent storage,
+// with the rest of the app's keys taking their share of the 4 KB budget:
+//
+//   - churn over 150 slugs, far more than fit, checked every few dozen steps
+//     against a plain model of what the store should hold,
+//   - restarts, with and without a flush before them,
+//   - a full store makes room for the active goal, and only for it,
+//   - running out of storage: a goal that can't be written isn't indexed,
+//     and the flush says so,
+//   - a record gone from under the index is dropped, never read as zeroes,
+//   - how many writes all that took.
+//
+// Built and run by `make -C test check`; prints "ok"/"FAIL" lines like the
+// Node tests and exits non-zero on a failure.
+
+#include <stdio.h>
+#include "pebble_host.h"
+#include "goal_store.h"
+
+#define SLUGS  150
+#define STEPS  20000
+#define OTHERS (HOST_PERSIST_BUDGET - 256 - GOAL_STORE_BYTES) // everything but the store, at most
+#define PK_OTHERS 1000
+
+typedef struct model_goal {
+  bool present;
+  goal_record record;
+} model_goal;
+
+static model_goal model[SLUGS];
+static int model_count = 0;
+static int failures = 0;
+static uint32_t seed = 1;
+
+static void check(bool condition, const char *what) {
+  printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+  if (!condition) { failures++; }
+}
+
+static uint32_t next_random(void) { // xorshift32
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static goal_record make_record(int i) {
+  goal_record record;
+  memset(&record, 0, sizeof(record));
+  snprintf(record.slug, GOAL_SLUG_LEN, "goal-%03d", i);
+  record.losedate = next_random();
+  record.updated_at = next_random();
+  record.rate = next_random() % 10000;
+  record.safebuf = next_random() % 30;
+  record.runits = "ymwdh"[next_random() % 5];
+  return record;
+}
+
+static const char *slug(int i) {
+  static char buffer[GOAL_SLUG_LEN];
+  snprintf(buffer, sizeof(buffer), "goal-%03d", i);
+  return buffer;
+}
+
+// everything the model holds is in the store, unchanged, and nothing else is
+static bool matches_model(void) {
+  if (goal_store_count() != model_count) { return false; }
+  for (int i = 0; i < SLUGS; i++) {
+    int slot = goal_store_find(slug(i));
+    if (!model[i].present) {
+      if (slot >= 0) { return false; }
+      continue;
+    }
+    const goal_record *record = goal_store_get(slot);
+    if (record == NULL || memcmp(record, &model[i].record, sizeof(goal_record)) != 0) {
+      return false;
+    }
+  }
+  int used = 0;
+  for (int slot = goal_store_next(-1); slot >= 0; slot = goal_store_next(slot)) {
+    used++;
+  }
+  return used == model_count;
+}
+
+static void fill_others(void) {
+  uint8_t filler[PERSIST_DATA_MAX_LENGTH];
+  memset(filler, 0xA5, sizeof(filler));
+  int left = OTHERS;
+  for (int key = PK_OTHERS; left > 0; key++) {
+    int size = left < PERSIST_DATA_MAX_LENGTH ? left : PERSIST_DATA_MAX_LENGTH;
+    persist_write_data(key, filler, size);
+    left -= size;
+  }
+}
+
+static void churn(void) {
+  bool consistent = true;
+  int refused = 0, restarts = 0;
+  host_persist_stats before = host_persist_get_stats();
+  for (int step = 0; step < STEPS && consistent; step++) {
+    int i = next_random() % SLUGS;
+    uint32_t op = next_random() % 10;
+    if (op < 6) { // new or changed
+      goal_record record = make_record(i);
+      int slot = goal_store_put(&record);
+      if (model[i].present || model_count < GOAL_MAX) {
+        consistent = slot >= 0;
+        model_count += model[i].present ? 0 : 1;
+        model[i].present = true;
+        model[i].record = record;
+      } else {
+        consistent = slot < 0;
+        refused++;
+      }
+    } else if (op < 8) { // the same again, which shouldn't cost a write
+      if (model[i].present) {
+        goal_store_put(&model[i].record);
+      }
+    } else if (op < 9) {
+      goal_store_remove(goal_store_find(slug(i)));
+      model_count -= model[i].present ? 1 : 0;
+      model[i].present = false;
+    } else if (step % 7 == 0) {
+      consistent = goal_store_flush();
+      goal_store_init(); // a restart
+      restarts++;
+    } else {
+      consistent = goal_store_flush();
+    }
+    if (step % 97 == 0) {
+      consistent = consistent && matches_model();
+    }
+  }
+  goal_store_flush();
+  host_persist_stats after = host_persist_get_stats();
+  char what[160];
+  snprintf(what, sizeof(what), "%d steps over %d slugs match the model (%d restarts, %d refused when full)",
+           STEPS, SLUGS, restarts, refused);
+  check(consistent && matches_model(), what);
+  snprintf(what, sizeof(what), "%u writes in all, %.2f per step, none refused",
+           after.writes - before.writes, (double)(after.writes - before.writes) / STEPS);
+  check(after.failed == before.failed, what);
+}
+
+// a free slot, and a slug that isn't stored
+static int make_room(void) {
+  int i;
+  if (model_count == GOAL_MAX) {
+    for (i = 0; i < SLUGS && !model[i].present; i++) { }
+    goal_store_remove(goal_store_find(slug(i)));
+    model[i].present = false;
+    model_count--;
+  }
+  for (i = 0; i < SLUGS && model[i].present; i++) { }
+  return i;
+}
+
+// a put of what's already stored changes nothing
+static void unchanged(void) {
+  int i;
+  for (i = 0; i < SLUGS && !model[i].present; i++) { }
+  goal_store_flush();
+  host_persist_stats before = host_persist_get_stats();
+  for (int k = 0; k < 10; k++) {
+    goal_store_put(&model[i].record);
+    goal_store_flush();
+  }
+  check(host_persist_get_stats().writes == before.writes, "storing an unchanged goal writes nothing");
+}
+
+// a new goal written but never indexed, say the app was killed before it
+// flushed, is swept up on the next start
+static void orphan(void) {
+  int i = make_room();
+  goal_store_flush();
+  goal_record record = make_record(i);
+  int slot = goal_store_put(&record);
+  bool written = slot >= 0 && persist_exists(PK_GOAL_BASE + slot);
+  goal_store_init(); // no flush
+  check(written && !persist_exists(PK_GOAL_BASE + slot) && matches_model(),
+        "a goal stored without its index is dropped on restart");
+}
+
+// full, a new goal is refused unless it's the active one, which takes the
+// place of the goal due last
+static void active_when_full(void) {
+  int i;
+  for (i = 0; i < SLUGS && model_count < GOAL_MAX; i++) {
+    if (model[i].present) { continue; }
+    model[i].record = make_record(i);
+    model[i].present = goal_store_put(&model[i].record) >= 0;
+    model_count += model[i].present ? 1 : 0;
+  }
+  int last = -1;
+  for (int k = 0; k < SLUGS; k++) {
+    if (model[k].present && (last < 0 || model[k].record.losedate >= model[last].record.losedate)) { last = k; }
+  }
+  for (i = 0; i < SLUGS && model[i].present; i++) { }
+  goal_record record = make_record(i);
+  bool refused = goal_store_put(&record) < 0;
+  record.flags = GOAL_FLAG_ACTIVE;
+  int slot = goal_store_put(&record);
+  model[last].present = false;
+  model[i].present = true;
+  model[i].record = record;
+  check(refused && slot >= 0 && goal_store_active() == slot && goal_store_flush() && matches_model(),
+        "a full store refuses a new goal, but makes room for the active one");
+  record.flags = 0; // not active any more, for what follows
+  model[i].record = record;
+  goal_store_put(&record);
+  goal_store_flush();
+}
+
+static void out_of_storage(void) {
+  int i = make_room();
+  goal_store_flush();
+  host_persist_stats stats = host_persist_get_stats();
+  host_persist_set_budget(stats.used); // not a byte more
+  goal_record record = make_record(i);
+  int slot = goal_store_put(&record);
+  bool flushed = goal_store_flush();
+  check(slot < 0 && !flushed && matches_model(), "a goal that can't be stored isn't indexed, and the flush says so");
+
+  // changes to goals already stored still fit
+  int changed;
+  for (changed = 0; changed < SLUGS && !model[changed].present; changed++) { }
+  record = make_record(changed);
+  model[changed].record = record;
+  goal_store_put(&record);
+  check(goal_store_flush() && matches_model(), "goals already stored can still change");
+
+  goal_store_init();
+  check(matches_model(), "after a restart, the store is as the last good flush left it");
+  host_persist_set_budget(HOST_PERSIST_BUDGET);
+}
+
+// a record lost from under the index reads as nothing, not as a zeroed goal
+static void lost_record(void) {
+  int i;
+  for (i = 0; i < SLUGS && !model[i].present; i++) { }
+  int slot = goal_store_find(slug(i));
+  goal_store_flush();
+  goal_store_init(); // so it isn't cached
+  persist_delete(PK_GOAL_BASE + slot);
+  const goal_record *record = goal_store_get(slot);
+  model[i].present = false;
+  model_count--;
+  check(record == NULL && goal_store_find(slug(i)) < 0 && matches_model() && goal_store_flush(),
+        "a slot whose record is gone is dropped");
+}
+
+int main(void) {
+  host_persist_reset(HOST_PERSIST_BUDGET);
+  fill_others();
+  goal_store_init();
+  char what[120];
+  snprintf(what, sizeof(what), "%d goals of %d bytes with the rest of the app fit in %d bytes",
+           GOAL_MAX, (int)sizeof(goal_record), HOST_PERSIST_BUDGET);
+  check(OTHERS > 0, what);
+
+  churn();
+  unchanged();
+  orphan();
+  active_when_full();
+  out_of_storage();
+  lost_record();
+
+  host_persist_stats stats = host_persist_get_stats();
+  snprintf(what, sizeof(what), "at most %d bytes used (%u)", HOST_PERSIST_BUDGET, stats.used);
+  check(stats.used <= HOST_PERSIST_BUDGET, what);
+  return failures ? 1 : 0;
+}
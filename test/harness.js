@@ -0,0 +1,763 @@
+// Runs the watch (built for the host, see host/pebble_host.c) against the
+// phone's JavaScript, over a simulated Bluetooth link, on a virtual clock.
+//
+// The phone side is src/js loaded into its own context with fake Pebble,
+// localStorage, timers, Date, XMLHttpRequest and geolocation; web requests
+// go to the stand-in servers in servers.js.  The link carries one AppMessage
+// at a time each way, split into MTU-sized packets that each take some time
+// and may be lost; a lost message, or a lost ack, shows up as a timeout at
+// the sender, as it would on the watch.  Everything runs on the simulated
+// clock, so a day of use takes a second or two, and a seed makes it repeat.
+//
+//   var rig = harness.rig({ loss: 0.1, seed: 1 });
+//   await rig.start();
+//   await rig.run(60 * 60 * 1000);
+//   rig.stats();   // messages, bytes and packets each way
+//   await rig.stop();
+
+"use strict";
+var fs = require("fs");
+var os = require("os");
+var path = require("path");
+var vm = require("vm");
+var child_process = require("child_process");
+var readline = require("readline");
+
+var ROOT = path.join(__dirname, "..");
+var BUILD = path.join(__dirname, "build");
+var appKeys = JSON.parse(fs.readFileSync(path.join(ROOT, "appinfo.json"), "utf8")).appKeys;
+var keyNames = {};
+Object.keys(appKeys).forEach(function(name) { keyNames[appKeys[name]] = name; });
+
+process.env.TZ = "UTC"; // the phone's zone is the fake Date's business
+
+var MINUTE = 60 * 1000;
+var HOUR = 60 * MINUTE;
+var DAY = 24 * HOUR;
+
+// AppMessageResult, as the watch sees it
+var APP_MSG_SEND_TIMEOUT = 2;
+var APP_MSG_NOT_CONNECTED = 8;
+var APP_MSG_APP_NOT_RUNNING = 16;
+
+// ---- the clock
+
+function random(seed) { // mulberry32
+  var a = seed >>> 0;
+  return function() {
+    a = (a + 0x6D2B79F5) >>> 0;
+    var t = a;
+    t = Math.imul(t ^ (t >>> 15), t | 1);
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61);
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296;
+  };
+}
+
+function Sim(start) {
+  this.now = start;
+  this.queue = [];
+  this.order = 0;
+}
+
+// fn runs at now + delay, and may return a promise to wait on
+Sim.prototype.at = function(delay, fn) {
+  var event = { t: this.now + Math.max(0, delay || 0), order: this.order++, fn: fn };
+  var i = this.queue.length;
+  while(i > 0 && (this.queue[i - 1].t > event.t ||
+                  (this.queue[i - 1].t === event.t && this.queue[i - 1].order > event.order))) {
+    i--;
+  }
+  this.queue.splice(i, 0, event);
+  return event;
+};
+
+Sim.prototype.cancel = function(event) {
+  var i = this.queue.indexOf(event);
+  if(i >= 0) { this.queue.splice(i, 1); }
+};
+
+// run events up to until; with done, stop as soon as done() holds (or
+// resolves true), checking after every event
+Sim.prototype.run = async function(until, done) {
+  while(this.queue.length && this.queue[0].t <= until) {
+    if(done && await done()) { return true; }
+    var event = this.queue.shift();
+    this.now = Math.max(this.now, event.t);
+    await event.fn();
+  }
+  if(done && await done()) { return true; }
+  this.now = Math.max(this.now, until);
+  return false;
+};
+
+// ---- dictionaries, as PebbleKit JS and the watch see them
+
+function encodeDict(payload) {
+  var bytes = [0];
+  Object.keys(payload).forEach(function(name) {
+    var key = name in appKeys ? appKeys[name] : Number(name);
+    var value = payload[name], type, data = [];
+    if(isNaN(key)) { throw new Error("no appKey for " + name); }
+    if(Array.isArray(value)) {
+      type = 0;
+      data = value.map(function(b) { return b & 0xFF; });
+    } else if(typeof value === "string") {
+      type = 1;
+      data = Array.from(Buffer.from(value + "\0", "utf8"));
+    } else {
+      type = 3; // ints go as int32, like PebbleKit JS does
+      value = Number(value) | 0;
+      data = [value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, (value >> 24) & 0xFF];
+    }
+    bytes.push(key & 0xFF, (key >> 8) & 0xFF, (key >> 16) & 0xFF, (key >>> 24) & 0xFF,
+               type, data.length & 0xFF, data.length >> 8);
+    bytes = bytes.concat(data);
+    bytes[0]++;
+  });
+  return bytes;
+}
+
+function decodeDict(bytes) {
+  var payload = {}, offset = 1;
+  for(var n = 0; n < bytes[0]; n++) {
+    var key = (bytes[offset] | (bytes[offset+1] << 8) | (bytes[offset+2] << 16) |
+               (bytes[offset+3] << 24)) >>> 0;
+    var type = bytes[offset+4], length = bytes[offset+5] | (bytes[offset+6] << 8);
+    var data = bytes.slice(offset + 7, offset + 7 + length), value;
+    if(type === 0) {
+      value = data;
+    } else if(type === 1) {
+      value = Buffer.from(data).toString("utf8").replace(/\0.*$/, "");
+    } else {
+      value = Buffer.from(data.concat([0, 0, 0, 0])).readUIntLE(0, Math.min(length, 4));
+      if(type === 3 && length && value >= Math.pow(2, 8 * length - 1)) { value -= Math.pow(2, 8 * length); }
+    }
+    payload[key] = value;
+    if(key in keyNames) { payload[keyNames[key]] = value; }
+    offset += 7 + length;
+  }
+  return payload;
+}
+
+function hex(bytes) { return Buffer.from(bytes).toString("hex"); }
+function unhex(text) { return Array.from(Buffer.from(text, "hex")); }
+
+// ---- the watch: build/watch as a child process
+
+function Watch(rig) {
+  this.rig = rig;
+  this.proc = null;
+  this.lines = null;
+  this.waiting = null;
+  this.wake = null;
+  this.inbox = 0;
+  this.outbox = 0;
+  this.screen = [];
+  this.vibes = [];
+  this.log = [];
+  this.firstFrame = null; // persist work before the first frame, see pebble_host.c
+  this.running = false;
+}
+
+Watch.prototype.start = async function() {
+  var rig = this.rig;
+  var env = Object.assign({}, process.env, {
+    HOST_TIME: String(rig.sim.now),
+    HOST_TZ: String(rig.phone.tz(rig.sim.now)),
+    HOST_PERSIST: rig.persistFile,
+    HOST_INBOX: String(rig.options.inbox),
+    HOST_OUTBOX: String(rig.options.outbox),
+    HOST_BT: rig.channel.up ? "1" : "0",
+    HOST_BATTERY: String(rig.options.battery)
+  });
+  this.proc = child_process.spawn(path.join(BUILD, "watch"), [], { env: env,
+                                  stdio: ["pipe", "pipe", "inherit"] });
+  this.lines = [];
+  this.buffered = [];
+  var self = this;
+  readline.createInterface({ input: this.proc.stdout }).on("line", function(line) {
+    self.buffered.push(line);
+    if(line.indexOf("idle ") === 0 && self.waiting) {
+      var resolve = self.waiting;
+      self.waiting = null;
+      var lines = self.buffered;
+      self.buffered = [];
+      resolve(lines);
+    }
+  });
+  this.exited = new Promise(function(resolve) { self.proc.on("exit", resolve); });
+  this.running = true;
+  return this.handle(await new Promise(function(resolve) { self.waiting = resolve; }));
+};
+
+// send one command at the current time, and deal with what comes back
+Watch.prototype.command = async function(text) {
+  if(!this.running) { return []; }
+  var self = this;
+  var reply = new Promise(function(resolve) { self.waiting = resolve; });
+  this.proc.stdin.write(this.rig.sim.now + " " + text + "\n");
+  return this.handle(await reply);
+};
+
+Watch.prototype.handle = function(lines) {
+  var rig = this.rig, self = this, replies = [];
+  lines.forEach(function(line) {
+    var space = line.indexOf(" ");
+    var tag = space < 0 ? line : line.slice(0, space), rest = space < 0 ? "" : line.slice(space + 1);
+    switch(tag) {
+    case "open":
+      self.inbox = Number(rest.split(" ")[0]);
+      self.outbox = Number(rest.split(" ")[1]);
+      break;
+    case "out":
+      rig.channel.fromWatch(unhex(rest));
+      break;
+    case "vibe":
+      self.vibes.push({ t: rig.sim.now, pattern: rest });
+      break;
+    case "first":
+      var n = rest.split(" ").map(Number);
+      self.firstFrame = { reads: n[0], readBytes: n[1], writes: n[2], us: n[3] };
+      break;
+    case "log":
+      self.log.push(rest);
+      if(rig.options.verbose) { console.log("  watch " + rest); }
+      break;
+    case "idle":
+      if(self.wake) { rig.sim.cancel(self.wake); }
+      self.wake = null;
+      var next = Number(rest);
+      if(next >= 0) {
+        self.wake = rig.sim.at(next - rig.sim.now, function() {
+          self.wake = null;
+          return self.command("run");
+        });
+      }
+      break;
+    default: // ack, nack, text, stat: for whoever asked
+      replies.push(line);
+    }
+  });
+  return replies;
+};
+
+// a message from the phone: true if the watch took it
+Watch.prototype.deliver = async function(bytes) {
+  var replies = await this.command("in " + hex(bytes));
+  return replies.indexOf("ack") >= 0;
+};
+
+Watch.prototype.text = async function() {
+  var replies = await this.command("screen");
+  this.screen = replies.filter(function(line) { return line.indexOf("text ") === 0; })
+                       .map(function(line) { return line.slice(5); });
+  return this.screen;
+};
+
+// bytes of persistent storage used, values, writes, refused writes, frames
+// drawn, timers pending, and lookups and bytes read since the watch started
+Watch.prototype.stat = async function() {
+  var line = (await this.command("stat")).filter(function(l) { return l.indexOf("stat ") === 0; })[0];
+  var n = line.split(" ").slice(1).map(Number);
+  return { used: n[0], keys: n[1], writes: n[2], failed: n[3], frames: n[4], timers: n[5],
+           reads: n[6], readBytes: n[7] };
+};
+
+// what the watch has stored under key, as bytes, null if nothing
+Watch.prototype.persist = async function(key) {
+  var line = (await this.command("persist " + key)).filter(function(l) { return l.indexOf("persist ") === 0; })[0];
+  return line === "persist -" ? null : unhex(line.slice(8));
+};
+
+Watch.prototype.persistInt = async function(key) {
+  var bytes = await this.persist(key);
+  return bytes ? Buffer.from(bytes).readInt32LE(0) : null;
+};
+
+Watch.prototype.stop = async function() {
+  if(!this.running) { return; }
+  this.running = false;
+  if(this.wake) { this.rig.sim.cancel(this.wake); }
+  this.wake = null;
+  this.proc.stdin.write(this.rig.sim.now + " quit\n");
+  this.proc.stdin.end();
+  await this.exited;
+};
+
+// ---- the phone: src/js in a context of its own
+
+function Phone(rig) {
+  this.rig = rig;
+  this.storage = {};      // localStorage, kept across restarts of the JS
+  this.offsets = [[-Infinity, rig.options.tz]]; // [from utc ms, minutes west], in order
+  this.position = { latitude: 52.37, longitude: 4.89 };
+  this.context = null;
+  this.listeners = null;
+  this.console = [];
+  this.urls = [];
+  this.received = []; // { t, payload } of every message from the watch
+  this.counts = { requests: 0, positions: 0 };
+}
+
+// the UTC offset at utc_ms, as getTimezoneOffset
+Phone.prototype.tz = function(utc_ms) {
+  var offset = 0;
+  this.offsets.forEach(function(change) { if(utc_ms >= change[0]) { offset = change[1]; } });
+  return offset;
+};
+
+// from utc_ms on, the phone's zone is minutes west
+Phone.prototype.setZone = function(utc_ms, minutes) {
+  this.offsets = this.offsets.filter(function(change) { return change[0] < utc_ms; });
+  this.offsets.push([utc_ms, minutes]);
+};
+
+Phone.prototype.localStorage = function() {
+  var storage = this.storage;
+  return {
+    getItem: function(key) { return key in storage ? storage[key] : null; },
+    setItem: function(key, value) { storage[key] = String(value); },
+    removeItem: function(key) { delete storage[key]; },
+    clear: function() { Object.keys(storage).forEach(function(key) { delete storage[key]; }); },
+    key: function(i) { return Object.keys(storage)[i] || null; },
+    get length() { return Object.keys(storage).length; }
+  };
+};
+
+Phone.prototype.fakeDate = function() {
+  var phone = this, sim = this.rig.sim;
+  function FakeDate() {
+    var args = Array.prototype.slice.call(arguments);
+    var date = args.length ? new (Function.prototype.bind.apply(Date, [null].concat(args)))()
+                           : new Date(sim.now);
+    Object.setPrototypeOf(date, FakeDate.prototype);
+    return date;
+  }
+  FakeDate.prototype = Object.create(Date.prototype);
+  FakeDate.prototype.constructor = FakeDate;
+  FakeDate.prototype.getTimezoneOffset = function() { return phone.tz(this.getTime()); };
+  FakeDate.now = function() { return sim.now; };
+  FakeDate.UTC = Date.UTC;
+  FakeDate.parse = Date.parse;
+  return FakeDate;
+};
+
+Phone.prototype.fakeXhr = function() {
+  var rig = this.rig, phone = this;
+  function XMLHttpRequest() {
+    this.readyState = 0;
+    this.status = 0;
+    this.responseText = "";
+    this.headers = {};
+  }
+  XMLHttpRequest.prototype.open = function(method, url) {
+    this.method = method;
+    this.url = url;
+    this.readyState = 1;
+  };
+  XMLHttpRequest.prototype.setRequestHeader = function(name, value) {
+    this.headers[name] = value;
+  };
+  XMLHttpRequest.prototype.send = function(body) {
+    var req = this, context = phone.context;
+    phone.counts.requests++;
+    var server = rig.servers.filter(function(s) { return s.handles(req.url); })[0];
+    var response = server ? server.handle({ method: req.method, url: req.url, body: body || "",
+                                            headers: req.headers, time: rig.sim.now })
+                          : { status: 404, body: "" };
+    var delay = (response && response.delay) || rig.options.httpLatency;
+    rig.sim.at(response ? delay : rig.options.httpTimeout, function() {
+      if(phone.context !== context) { return; } // the JS was restarted meanwhile
+      req.readyState = 4;
+      if(!response) { // no answer: the connection failed
+        if(req.onerror) { req.onerror({}); }
+        return;
+      }
+      req.status = response.status;
+      req.responseText = typeof response.body === "string" ? response.body : JSON.stringify(response.body);
+      if(req.onreadystatechange) { req.onreadystatechange({}); }
+      if(req.onload) { req.onload({}); }
+    });
+  };
+  return XMLHttpRequest;
+};
+
+Phone.prototype.start = function() {
+  var rig = this.rig, phone = this, sim = rig.sim;
+  var listeners = this.listeners = {};
+  var timers = [];
+  var context;
+  var pebble = {
+    addEventListener: function(name, fn) { (listeners[name] = listeners[name] || []).push(fn); },
+    removeEventListener: function(name, fn) {
+      listeners[name] = (listeners[name] || []).filter(function(f) { return f !== fn; });
+    },
+    sendAppMessage: function(payload, ok, fail) {
+      return rig.channel.fromPhone(payload, context, ok, fail);
+    },
+    openURL: function(url) { phone.urls.push(url); },
+    getAccountToken: function() { return "token"; },
+    getWatchToken: function() { return "watch"; },
+    showSimpleNotificationOnPebble: function() {}
+  };
+  function timeout(fn, ms) {
+    var event = sim.at(ms, function() {
+      timers.splice(timers.indexOf(event), 1);
+      if(phone.context === context) { fn(); }
+    });
+    timers.push(event);
+    return event;
+  }
+  var math = Object.create(Math);
+  math.random = random(rig.options.seed * 7919 + 1);
+  var sandbox = {
+    Pebble: pebble,
+    localStorage: this.localStorage(),
+    console: { log: function() {
+      var line = Array.prototype.join.call(arguments, " ");
+      phone.console.push({ t: sim.now, line: line });
+      if(rig.options.verbose) { console.log("  phone " + line); }
+    } },
+    setTimeout: timeout,
+    clearTimeout: function(event) {
+      if(event && timers.indexOf(event) >= 0) { timers.splice(timers.indexOf(event), 1); sim.cancel(event); }
+    },
+    setInterval: function(fn, ms) {
+      var handle = { event: null };
+      (function again() { handle.event = timeout(function() { again(); fn(); }, ms); })();
+      return handle;
+    },
+    clearInterval: function(handle) { if(handle) { sim.cancel(handle.event); } },
+    Date: this.fakeDate(),
+    Math: math,
+    XMLHttpRequest: this.fakeXhr(),
+    navigator: { geolocation: { getCurrentPosition: function(ok, fail, options) {
+      phone.counts.positions++;
+      var position = phone.position;
+      sim.at(rig.options.gpsTime, function() {
+        if(phone.context !== context) { return; }
+        if(position) {
+          ok({ coords: { latitude: position.latitude, longitude: position.longitude, accuracy: 50 },
+               timestamp: sim.now });
+        } else if(fail) {
+          fail({ code: 3, message: "Timeout" });
+        }
+      });
+    } } }
+  };
+  context = this.context = vm.createContext(sandbox);
+  var scripts = [path.join(BUILD, "messages.auto.js")].concat(
+    fs.readdirSync(path.join(ROOT, "src/js")).filter(function(f) { return /\.js$/.test(f); })
+      .sort().map(function(f) { return path.join(ROOT, "src/js", f); }));
+  scripts.forEach(function(file) {
+    vm.runInContext(fs.readFileSync(file, "utf8"), context, { filename: file });
+  });
+  this.emit("ready", { ready: true, type: "ready" });
+};
+
+Phone.prototype.stop = function() {
+  this.context = null;
+  this.listeners = null;
+};
+
+Phone.prototype.emit = function(name, event) {
+  (this.listeners && this.listeners[name] || []).forEach(function(fn) { fn(event); });
+};
+
+Phone.prototype.running = function() {
+  return this.context !== null;
+};
+
+// the settings page, as the user would save it with changes applied
+Phone.prototype.configure = function(changes) {
+  this.emit("showConfiguration", {});
+  var url = this.urls[this.urls.length - 1];
+  var page = decodeURIComponent(url.slice(url.indexOf(",") + 1));
+  var values = {};
+  var field = /<(input|select) [^>]*name="([^"]+)"([^>]*)>/g, m;
+  while((m = field.exec(page))) {
+    var name = m[2], number = / data-number/.test(m[3]), value;
+    if(m[1] === "input") {
+      value = (/value="([^"]*)"/.exec(m[3]) || [])[1] || "";
+    } else {
+      var rest = page.slice(field.lastIndex, page.indexOf("</select>", field.lastIndex));
+      value = ((/<option value="([^"]*)" selected>/.exec(rest) ||
+                /<option value="([^"]*)"/.exec(rest)) || [])[1];
+    }
+    value = value.replace(/&quot;/g, '"').replace(/&lt;/g, "<").replace(/&gt;/g, ">").replace(/&amp;/g, "&");
+    values[name] = number ? Number(value) : value;
+  }
+  Object.keys(changes || {}).forEach(function(key) { values[key] = changes[key]; });
+  this.emit("webviewclosed", { response: encodeURIComponent(JSON.stringify(values)) });
+  return page;
+};
+
+// ---- the link
+
+function Channel(rig) {
+  this.rig = rig;
+  this.up = true;
+  this.phoneQueue = [];
+  this.phoneBusy = false;
+  this.lastId = 0;
+  this.random = random(rig.options.seed);
+  this.stats = {
+    toWatch:   { messages: 0, delivered: 0, bytes: 0, packets: 0, lost: 0, failed: 0, byType: {} },
+    fromWatch: { messages: 0, delivered: 0, bytes: 0, packets: 0, lost: 0, failed: 0, byType: {} }
+  };
+}
+
+var APPMESSAGE_HEADER = 18; // command, transaction id and app uuid
+var ACK_BYTES = 2;
+
+// messages are a single tuple keyed by their id, anything else is configuration
+Channel.prototype.typeOf = function(bytes) {
+  var key = (bytes[1] | (bytes[2] << 8) | (bytes[3] << 16) | (bytes[4] << 24)) >>> 0;
+  return key >= 100 ? keyNames[key] || String(key) : "config";
+};
+
+// how a message fares on the air: packets sent, how long it takes, whether it arrives
+Channel.prototype.transmit = function(stats, bytes) {
+  var options = this.rig.options;
+  var packets = Math.ceil((bytes.length + APPMESSAGE_HEADER) / options.mtu);
+  var type = this.typeOf(bytes);
+  stats.messages++;
+  stats.packets += packets;
+  stats.bytes += bytes.length + APPMESSAGE_HEADER;
+  stats.byType[type] = (stats.byType[type] || 0) + 1;
+  var lost = false;
+  for(var i = 0; i < packets; i++) {
+    if(this.random() < options.loss) { lost = true; }
+  }
+  if(lost) { stats.lost++; }
+  return { lost: lost, time: options.latency + packets * options.packetTime };
+};
+
+// the ack (or nack) back to the sender: lost or not
+Channel.prototype.transmitAck = function(stats) {
+  stats.packets++;
+  stats.bytes += ACK_BYTES;
+  return this.random() < this.rig.options.loss;
+};
+
+// Pebble.sendAppMessage: PebbleKit sends one message at a time, in order
+Channel.prototype.fromPhone = function(payload, context, ok, fail) {
+  var id = ++this.lastId;
+  this.phoneQueue.push({ payload: payload, context: context, ok: ok, fail: fail, id: id });
+  this.pumpPhone();
+  return id;
+};
+
+Channel.prototype.pumpPhone = function() {
+  if(this.phoneBusy || !this.phoneQueue.length) { return; }
+  var self = this, rig = this.rig, sim = rig.sim, options = rig.options;
+  var message = this.phoneQueue.shift();
+  this.phoneBusy = true;
+  var stats = this.stats.toWatch;
+  function finish(error) {
+    self.phoneBusy = false;
+    var event = { data: { transactionId: message.id } };
+    if(error) {
+      stats.failed++;
+      event.error = { message: error };
+      if(message.fail && rig.phone.context === message.context) { message.fail(event); }
+    } else if(message.ok && rig.phone.context === message.context) {
+      message.ok(event);
+    }
+    self.pumpPhone();
+  }
+  var bytes = encodeDict(message.payload);
+  if(!this.up) {
+    sim.at(options.latency, function() { finish("Not connected"); });
+    return;
+  }
+  var air = this.transmit(stats, bytes);
+  if(air.lost || !rig.watch.running) {
+    sim.at(options.ackTimeout, function() { finish("Timed out"); });
+    return;
+  }
+  sim.at(air.time, async function() {
+    if(!self.up) { sim.at(options.ackTimeout - air.time, function() { finish("Timed out"); }); return; }
+    var taken = await rig.watch.deliver(bytes);
+    if(taken) { stats.delivered++; }
+    if(self.transmitAck(stats)) {
+      sim.at(options.ackTimeout - air.time, function() { finish("Timed out"); });
+    } else {
+      sim.at(options.latency, function() { finish(taken ? null : "Rejected"); });
+    }
+  });
+};
+
+// the watch's app_message_outbox_send: it keeps one in flight itself
+Channel.prototype.fromWatch = function(bytes) {
+  var self = this, rig = this.rig, sim = rig.sim, options = rig.options;
+  var stats = this.stats.fromWatch;
+  function result(text) {
+    return function() {
+      if(text !== "sent") { stats.failed++; }
+      return rig.watch.command(text);
+    };
+  }
+  if(!this.up) {
+    sim.at(options.latency, result("failed " + APP_MSG_NOT_CONNECTED));
+    return;
+  }
+  var air = this.transmit(stats, bytes);
+  if(air.lost) {
+    sim.at(options.ackTimeout, result("failed " + APP_MSG_SEND_TIMEOUT));
+    return;
+  }
+  sim.at(air.time, function() {
+    if(!self.up) { sim.at(options.ackTimeout - air.time, result("failed " + APP_MSG_SEND_TIMEOUT)); return; }
+    var running = rig.phone.running();
+    if(running) {
+      stats.delivered++;
+      rig.phone.received.push({ t: sim.now, payload: decodeDict(bytes) });
+      rig.phone.emit("appmessage", { payload: decodeDict(bytes), type: "appmessage" });
+    }
+    if(self.transmitAck(stats)) {
+      sim.at(options.ackTimeout - air.time, result("failed " + APP_MSG_SEND_TIMEOUT));
+    } else {
+      sim.at(options.latency, result(running ? "sent" : "failed " + APP_MSG_APP_NOT_RUNNING));
+    }
+  });
+};
+
+// ---- the whole setup
+
+var defaults = {
+  start: Date.UTC(2026, 2, 2, 9, 0, 0), // a Monday morning
+  tz: 0,               // the phone's minutes west of UTC, as getTimezoneOffset
+  loss: 0,             // chance of losing each packet, either way
+  latency: 40,         // ms one way
+  mtu: 158,            // bytes per packet
+  packetTime: 8,       // ms per packet
+  ackTimeout: 3000,    // ms before a sender gives up on an ack
+  inbox: 656,          // app_message_inbox_size_maximum
+  outbox: 656,
+  battery: 80,
+  httpLatency: 300,    // ms for a web request
+  httpTimeout: 10000,  // ms before an unanswered request fails
+  gpsTime: 2000,       // ms for a position fix
+  seed: 1,
+  verbose: !!process.env.HARNESS_VERBOSE
+};
+
+function Rig(options) {
+  this.options = Object.assign({}, defaults, options || {});
+  this.sim = new Sim(this.options.start);
+  this.servers = [];
+  this.phone = new Phone(this);
+  this.channel = new Channel(this);
+  this.watch = new Watch(this);
+  this.persistFile = path.join(fs.mkdtempSync(path.join(os.tmpdir(), "pebblebee-")), "persist");
+}
+
+Rig.prototype.start = async function() {
+  await this.watch.start();
+  this.phone.start();
+};
+
+Rig.prototype.stop = async function() {
+  this.phone.stop();
+  await this.watch.stop();
+  fs.rmSync(path.dirname(this.persistFile), { recursive: true, force: true });
+};
+
+// let ms of simulated time pass; with done, stop once it holds.
+// Returns how long it took, or -1 if done never held.
+Rig.prototype.run = async function(ms, done) {
+  var from = this.sim.now;
+  var met = await this.sim.run(from + ms, done);
+  return done ? (met ? this.sim.now - from : -1) : ms;
+};
+
+// wait for fn to hold (or resolve true), for at most ms
+Rig.prototype.until = function(fn, ms) {
+  return this.run(ms || DAY, fn);
+};
+
+// wait until some text on the watch's screen matches pattern
+Rig.prototype.untilScreen = function(pattern, ms) {
+  var rig = this;
+  return this.until(async function() {
+    return (await rig.watch.text()).some(function(text) { return pattern.test(text); });
+  }, ms);
+};
+
+Rig.prototype.restartWatch = async function() {
+  await this.watch.stop();
+  this.watch = new Watch(this);
+  await this.watch.start();
+};
+
+Rig.prototype.restartPhone = function() {
+  this.phone.stop();
+  this.phone.start();
+};
+
+Rig.prototype.setLink = async function(up) {
+  this.channel.up = up;
+  await this.watch.command("bt " + (up ? 1 : 0));
+};
+
+Rig.prototype.setZone = async function(minutes) {
+  this.phone.setZone(this.sim.now, minutes);
+  await this.watch.command("tz " + minutes);
+};
+
+Rig.prototype.stats = function() {
+  var s = this.channel.stats;
+  return { messages: s.toWatch.messages + s.fromWatch.messages,
+           bytes: s.toWatch.bytes + s.fromWatch.bytes,
+           packets: s.toWatch.packets + s.fromWatch.packets,
+           toWatch: s.toWatch, fromWatch: s.fromWatch };
+};
+
+// counters from here on
+Rig.prototype.mark = function() {
+  var before = JSON.parse(JSON.stringify(this.stats())), rig = this, t = this.sim.now;
+  return function() {
+    var now = rig.stats();
+    return { messages: now.messages - before.messages, bytes: now.bytes - before.bytes,
+             packets: now.packets - before.packets, ms: rig.sim.now - t };
+  };
+};
+
+// ---- reporting
+
+function check(condition, what) {
+  if(!condition) {
+    console.log("FAIL " + what);
+    process.exitCode = 1;
+  } else {
+    console.log("ok   " + what);
+  }
+}
+
+function table(rows) {
+  var columns = Object.keys(rows[0]);
+  var widths = columns.map(function(c) {
+    return Math.max.apply(null, [c.length].concat(rows.map(function(r) { return String(r[c]).length; })));
+  });
+  function line(values) {
+    return values.map(function(v, i) { return String(v).padStart(widths[i]); }).join("  ");
+  }
+  console.log(line(columns));
+  rows.forEach(function(r) { console.log(line(columns.map(function(c) { return r[c]; }))); });
+}
+
+function seconds(ms) {
+  return ms < 0 ? "never" : (ms / 1000).toFixed(ms < 10000 ? 2 : 1) + " s";
+}
+
+module.exports = {
+  rig: function(options) { return new Rig(options); },
+  encodeDict: encodeDict,
+  decodeDict: decodeDict,
+  check: check,
+  random: random,
+  table: table,
+  seconds: seconds,
+  MINUTE: MINUTE, HOUR: HOUR, DAY: DAY
+};
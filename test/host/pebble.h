@@ -0,0 +1,283 @@
+// The parts of the Pebble SDK the watch code uses, for building it on the
+// host (see pebble_host.c).  Types and signatures follow the SDK; the
+// dictionary layout is the real one, so message sizes are what the watch
+// would see.  Time is virtual and driven by the harness.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// time() is the watch's local time, on the harness's clock
+time_t host_time(time_t *t);
+struct tm *host_localtime(const time_t *t);
+#define time(t) host_time(t)
+#define localtime(t) host_localtime(t)
+uint16_t time_ms(time_t *t, uint16_t *ms);
+bool clock_is_24h_style(void);
+
+// status codes
+typedef enum {
+  S_SUCCESS = 0, E_ERROR = -1, E_UNKNOWN = -2, E_INTERNAL = -3, E_INVALID_ARGUMENT = -4,
+  E_OUT_OF_MEMORY = -5, E_OUT_OF_STORAGE = -6, E_OUT_OF_RESOURCES = -7, E_RANGE = -8,
+  E_DOES_NOT_EXIST = -9, E_INVALID_OPERATION = -10, E_BUSY = -11,
+} StatusCode;
+
+// logging
+typedef enum { APP_LOG_LEVEL_ERROR = 1, APP_LOG_LEVEL_WARNING = 50, APP_LOG_LEVEL_INFO = 100,
+               APP_LOG_LEVEL_DEBUG = 200, APP_LOG_LEVEL_DEBUG_VERBOSE = 255 } AppLogLevel;
+void app_log(uint8_t level, const char *file, int line, const char *fmt, ...)
+  __attribute__((format(printf, 4, 5)));
+
+// persistent storage
+#define PERSIST_DATA_MAX_LENGTH 256
+bool persist_exists(uint32_t key);
+int persist_read_data(uint32_t key, void *buffer, size_t size);
+int32_t persist_read_int(uint32_t key);
+int persist_write_data(uint32_t key, const void *data, size_t size);
+int persist_write_int(uint32_t key, int32_t value);
+int persist_delete(uint32_t key);
+
+// dictionaries
+typedef enum { TUPLE_BYTE_ARRAY = 0, TUPLE_CSTRING = 1, TUPLE_UINT = 2, TUPLE_INT = 3 } TupleType;
+
+typedef struct __attribute__((__packed__)) Tuple {
+  uint32_t key;
+  TupleType type:8;
+  uint16_t length;
+  union {
+    uint8_t data[0];
+    char cstring[0];
+    uint8_t uint8;
+    uint16_t uint16;
+    uint32_t uint32;
+    int8_t int8;
+    int16_t int16;
+    int32_t int32;
+  } value[];
+} Tuple;
+
+typedef struct __attribute__((__packed__)) Dictionary {
+  uint8_t count;
+  Tuple head[];
+} Dictionary;
+
+typedef struct DictionaryIterator {
+  Dictionary *dictionary;
+  const void *end;
+  Tuple *cursor;
+} DictionaryIterator;
+
+typedef enum { DICT_OK = 0, DICT_NOT_ENOUGH_STORAGE = 2, DICT_INVALID_ARGS = 4,
+               DICT_INTERNAL_INCONSISTENCY = 8, DICT_MALLOC_FAILED = 16 } DictionaryResult;
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *buffer, uint16_t size);
+DictionaryResult dict_write_data(DictionaryIterator *iter, uint32_t key, const uint8_t *data, uint16_t size);
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, uint32_t key, const char *cstring);
+DictionaryResult dict_write_int(DictionaryIterator *iter, uint32_t key, const void *integer,
+                                uint8_t width, bool is_signed);
+uint32_t dict_write_end(DictionaryIterator *iter);
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *buffer, uint16_t size);
+Tuple *dict_read_first(DictionaryIterator *iter);
+Tuple *dict_read_next(DictionaryIterator *iter);
+Tuple *dict_find(const DictionaryIterator *iter, uint32_t key);
+
+// AppMessage
+typedef enum {
+  APP_MSG_OK = 0, APP_MSG_SEND_TIMEOUT = 2, APP_MSG_SEND_REJECTED = 4, APP_MSG_NOT_CONNECTED = 8,
+  APP_MSG_APP_NOT_RUNNING = 16, APP_MSG_INVALID_ARGS = 32, APP_MSG_BUSY = 64,
+  APP_MSG_BUFFER_OVERFLOW = 128, APP_MSG_ALREADY_RELEASED = 512, APP_MSG_CALLBACK_ALREADY_REGISTERED = 1024,
+  APP_MSG_CALLBACK_NOT_REGISTERED = 2048, APP_MSG_OUT_OF_MEMORY = 4096, APP_MSG_CLOSED = 8192,
+  APP_MSG_INTERNAL_ERROR = 16384, APP_MSG_INVALID_STATE = 32768,
+} AppMessageResult;
+
+typedef void (*AppMessageInboxReceived)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageInboxDropped)(AppMessageResult reason, void *context);
+typedef void (*AppMessageOutboxSent)(DictionaryIterator *iterator, void *context);
+typedef void (*AppMessageOutboxFailed)(DictionaryIterator *iterator, AppMessageResult reason, void *context);
+
+AppMessageResult app_message_open(uint32_t size_inbound, uint32_t size_outbound);
+uint32_t app_message_inbox_size_maximum(void);
+uint32_t app_message_outbox_size_maximum(void);
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived handler);
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped handler);
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent handler);
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed handler);
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator);
+AppMessageResult app_message_outbox_send(void);
+
+// timers
+typedef struct AppTimer AppTimer;
+typedef void (*AppTimerCallback)(void *data);
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *data);
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms);
+void app_timer_cancel(AppTimer *timer);
+
+// event services
+typedef enum { SECOND_UNIT = 1, MINUTE_UNIT = 2, HOUR_UNIT = 4, DAY_UNIT = 8,
+               MONTH_UNIT = 16, YEAR_UNIT = 32 } TimeUnits;
+typedef void (*TickHandler)(struct tm *tick_time, TimeUnits units_changed);
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler);
+void tick_timer_service_unsubscribe(void);
+
+typedef struct BatteryChargeState {
+  uint8_t charge_percent;
+  bool is_charging;
+  bool is_plugged;
+} BatteryChargeState;
+typedef void (*BatteryStateHandler)(BatteryChargeState charge);
+void battery_state_service_subscribe(BatteryStateHandler handler);
+void battery_state_service_unsubscribe(void);
+BatteryChargeState battery_state_service_peek(void);
+
+typedef void (*BluetoothConnectionHandler)(bool connected);
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler);
+void bluetooth_connection_service_unsubscribe(void);
+bool bluetooth_connection_service_peek(void);
+
+typedef enum { ACCEL_AXIS_X = 0, ACCEL_AXIS_Y = 1, ACCEL_AXIS_Z = 2 } AccelAxisType;
+typedef void (*AccelTapHandler)(AccelAxisType axis, int32_t direction);
+void accel_tap_service_subscribe(AccelTapHandler handler);
+void accel_tap_service_unsubscribe(void);
+
+// background worker
+typedef struct AppWorkerMessage {
+  uint16_t data0;
+  uint16_t data1;
+  uint16_t data2;
+} AppWorkerMessage;
+typedef void (*AppWorkerMessageHandler)(uint16_t type, AppWorkerMessage *data);
+typedef enum { APP_WORKER_RESULT_SUCCESS = 0, APP_WORKER_RESULT_NO_WORKER = 1,
+               APP_WORKER_RESULT_DIFFERENT_APP = 2, APP_WORKER_RESULT_NOT_RUNNING = 3,
+               APP_WORKER_RESULT_ALREADY_RUNNING = 4, APP_WORKER_RESULT_ASKING_CONFIRMATION = 5 } AppWorkerResult;
+bool app_worker_message_subscribe(AppWorkerMessageHandler handler);
+bool app_worker_message_unsubscribe(void);
+void app_worker_send_message(uint8_t type, AppWorkerMessage *data);
+bool app_worker_is_running(void);
+AppWorkerResult app_worker_launch(void);
+AppWorkerResult app_worker_kill(void);
+
+// vibes
+typedef struct VibePattern {
+  const uint32_t *durations;
+  uint32_t num_segments;
+} VibePattern;
+void vibes_cancel(void);
+void vibes_short_pulse(void);
+void vibes_long_pulse(void);
+void vibes_double_pulse(void);
+void vibes_enqueue_custom_pattern(VibePattern pattern);
+
+// graphics, black and white (the harness builds the aplite layout)
+typedef struct GColor8 { uint8_t argb; } GColor8;
+typedef GColor8 GColor;
+#define GColorBlack ((GColor){0xC0})
+#define GColorWhite ((GColor){0xFF})
+#define GColorClear ((GColor){0x00})
+
+typedef struct GPoint { int16_t x; int16_t y; } GPoint;
+typedef struct GSize { int16_t w; int16_t h; } GSize;
+typedef struct GRect { GPoint origin; GSize size; } GRect;
+#define GRect(x, y, w, h) ((GRect){{(x), (y)}, {(w), (h)}})
+
+typedef enum { GCompOpAssign, GCompOpAssignInverted, GCompOpOr, GCompOpAnd, GCompOpClear, GCompOpSet } GCompOp;
+typedef enum { GBitmapFormat1Bit, GBitmapFormat8Bit, GBitmapFormat1BitPalette,
+               GBitmapFormat2BitPalette, GBitmapFormat4BitPalette } GBitmapFormat;
+typedef enum { GTextAlignmentLeft, GTextAlignmentCenter, GTextAlignmentRight } GTextAlignment;
+typedef enum { GTextOverflowModeWordWrap, GTextOverflowModeTrailingEllipsis, GTextOverflowModeFill } GTextOverflowMode;
+typedef enum { GCornerNone = 0, GCornersAll = 15 } GCornerMask;
+
+typedef struct GContext GContext;
+typedef struct GBitmap GBitmap;
+typedef struct GFontInfo *GFont;
+typedef struct GTextAttributes GTextAttributes;
+
+#define FONT_KEY_GOTHIC_14             "RESOURCE_ID_GOTHIC_14"
+#define FONT_KEY_GOTHIC_18             "RESOURCE_ID_GOTHIC_18"
+#define FONT_KEY_GOTHIC_18_BOLD        "RESOURCE_ID_GOTHIC_18_BOLD"
+#define FONT_KEY_GOTHIC_24             "RESOURCE_ID_GOTHIC_24"
+#define FONT_KEY_GOTHIC_28_BOLD        "RESOURCE_ID_GOTHIC_28_BOLD"
+#define FONT_KEY_ROBOTO_BOLD_SUBSET_49 "RESOURCE_ID_ROBOTO_BOLD_SUBSET_49"
+GFont fonts_get_system_font(const char *font_key);
+
+// resource ids, as appinfo.json's media would generate them
+enum {
+  RESOURCE_ID_IMAGE_MENU_ICON_DARK = 1,
+  RESOURCE_ID_IMAGE_BT_NOLINK_ICON,
+  RESOURCE_ID_IMAGE_BT_LINKED_ICON,
+  RESOURCE_ID_IMAGE_CHARGING_ICON,
+  RESOURCE_ID_IMAGE_HOURVIBE_ICON,
+  RESOURCE_ID_IMAGE_WEATHER_ATLAS,
+};
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id);
+GBitmap *gbitmap_create_as_sub_bitmap(const GBitmap *base, GRect sub_rect);
+void gbitmap_destroy(GBitmap *bitmap);
+GColor *gbitmap_get_palette(const GBitmap *bitmap);
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap);
+
+void graphics_context_set_stroke_color(GContext *ctx, GColor color);
+void graphics_context_set_fill_color(GContext *ctx, GColor color);
+void graphics_context_set_text_color(GContext *ctx, GColor color);
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode);
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask);
+void graphics_draw_rect(GContext *ctx, GRect rect);
+void graphics_draw_text(GContext *ctx, const char *text, GFont const font, const GRect box,
+                        const GTextOverflowMode overflow_mode, const GTextAlignment alignment,
+                        GTextAttributes *text_attributes);
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect);
+
+// layers and windows
+typedef struct Layer Layer;
+typedef struct TextLayer TextLayer;
+typedef struct BitmapLayer BitmapLayer;
+typedef struct Window Window;
+typedef void (*LayerUpdateProc)(Layer *layer, GContext *ctx);
+
+Layer *layer_create(GRect frame);
+void layer_destroy(Layer *layer);
+void layer_mark_dirty(Layer *layer);
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc);
+void layer_set_frame(Layer *layer, GRect frame);
+GRect layer_get_frame(const Layer *layer);
+GRect layer_get_bounds(const Layer *layer);
+void layer_add_child(Layer *parent, Layer *child);
+void layer_remove_from_parent(Layer *child);
+void layer_set_hidden(Layer *layer, bool hidden);
+bool layer_get_hidden(const Layer *layer);
+
+TextLayer *text_layer_create(GRect frame);
+void text_layer_destroy(TextLayer *text_layer);
+Layer *text_layer_get_layer(TextLayer *text_layer);
+void text_layer_set_text(TextLayer *text_layer, const char *text);
+const char *text_layer_get_text(TextLayer *text_layer);
+void text_layer_set_background_color(TextLayer *text_layer, GColor color);
+void text_layer_set_text_color(TextLayer *text_layer, GColor color);
+void text_layer_set_font(TextLayer *text_layer, GFont font);
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment);
+
+BitmapLayer *bitmap_layer_create(GRect frame);
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer);
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer);
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap);
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode);
+
+typedef void (*WindowHandler)(Window *window);
+typedef struct WindowHandlers {
+  WindowHandler load;
+  WindowHandler appear;
+  WindowHandler disappear;
+  WindowHandler unload;
+} WindowHandlers;
+Window *window_create(void);
+void window_destroy(Window *window);
+void window_set_window_handlers(Window *window, WindowHandlers handlers);
+void window_set_background_color(Window *window, GColor background_color);
+Layer *window_get_root_layer(const Window *window);
+void window_stack_push(Window *window, bool animated);
+
+// event loops
+void app_event_loop(void);
+void worker_event_loop(void) __attribute__((noreturn)); // on the host, jumps back into app_worker_launch()
@@ -0,0 +1,988 @@
+// A host implementation of the SDK in pebble.h, enough to run the face and
+// its worker as an ordinary process for the harness (see ../harness.js).
+//
+// Nothing here runs on its own clock: app_event_loop() reads one command per
+// line from stdin, each stamped with the harness's time in UTC milliseconds,
+// fires whatever timers and ticks fall due up to then, carries out the
+// command and answers on stdout, always ending with "idle <next>", the time
+// of the next timer or tick (-1 if none), so the harness knows when to come
+// back.  Commands:
+//
+//   <ms> run                    just let the time pass
+//   <ms> in <hex>               a message from the phone (dictionary bytes);
+//                               answered "ack", or "nack <reason>" if dropped
+//   <ms> sent | failed <reason> what became of the message we last sent out
+//   <ms> bt <0|1>               the link went down or came up
+//   <ms> tz <minutes west>      the phone set the watch's clock to a new zone
+//   <ms> battery <pct> <charging> <plugged>
+//   <ms> tap                    an accelerometer tap
+//   <ms> screen                 "text <s>" for each text on the last frame
+//   <ms> persist <key>          "persist <hex>" of what's stored, "persist -" if nothing
+//   <ms> stat                   "stat <persist bytes> <keys> <writes> <failed> <frames> <timers>
+//                               <reads> <bytes read>"
+//   <ms> quit                   return from the event loop (and save storage)
+//
+// and on its own the watch prints "open <inbox> <outbox>", "out <hex>" for a
+// message to the phone, "vibe <pattern>", "log <file:line> <text>", and once,
+// "first <reads> <bytes read> <writes> <us>": the persistent storage work done
+// before the first frame, and the real time it took to get there.
+//
+// Set up through the environment: HOST_TIME (UTC ms), HOST_TZ (minutes west
+// of UTC, as getTimezoneOffset), HOST_PERSIST (file kept across runs),
+// HOST_INBOX / HOST_OUTBOX (app_message_*_size_maximum), HOST_BT (0 or 1)
+// and HOST_BATTERY (percent).
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <setjmp.h>
+#include <time.h>
+#include "pebble_host.h"
+
+int worker_main(void) __attribute__((weak)); // only when the worker is linked in
+
+// ---- clock
+
+static int64_t clock_ms = 0;
+static struct timespec started; // real time, for the first frame's "first" line
+static int32_t tz_west = 0; // minutes
+
+static time_t local_seconds(int64_t utc_ms) {
+  return (time_t)(utc_ms / 1000) - tz_west * 60;
+}
+
+static int64_t utc_ms_of_local(time_t local) {
+  return ((int64_t)local + tz_west * 60) * 1000;
+}
+
+time_t host_time(time_t *t) {
+  time_t now = local_seconds(clock_ms);
+  if (t != NULL) { *t = now; }
+  return now;
+}
+
+struct tm *host_localtime(const time_t *t) {
+  static struct tm tm;
+  return gmtime_r(t, &tm); // the watch's seconds are already local
+}
+
+uint16_t time_ms(time_t *t, uint16_t *ms) {
+  uint16_t part = clock_ms % 1000;
+  host_time(t);
+  if (ms != NULL) { *ms = part; }
+  return part;
+}
+
+bool clock_is_24h_style(void) {
+  return true;
+}
+
+void host_set_clock(int64_t utc_ms, int32_t tz_minutes_west) {
+  clock_ms = utc_ms;
+  tz_west = tz_minutes_west;
+}
+
+int64_t host_clock(void) {
+  return clock_ms;
+}
+
+// ---- output
+
+void app_log(uint8_t level, const char *file, int line, const char *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  printf("log %s:%d ", file, line);
+  vprintf(fmt, args);
+  printf("\n");
+  va_end(args);
+}
+
+static void print_hex(const char *tag, const uint8_t *data, size_t size) {
+  printf("%s ", tag);
+  for (size_t i = 0; i < size; i++) { printf("%02x", data[i]); }
+  printf("\n");
+}
+
+static size_t parse_hex(const char *hex, uint8_t *out, size_t max) {
+  size_t n = 0;
+  while (hex[0] && hex[1] && n < max) {
+    unsigned int byte;
+    if (sscanf(hex, "%2x", &byte) != 1) { break; }
+    out[n++] = byte;
+    hex += 2;
+  }
+  return n;
+}
+
+// ---- persistent storage
+
+#define PERSIST_KEYS 256
+
+typedef struct persist_value {
+  uint32_t key;
+  uint16_t length;
+  bool used;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} persist_value;
+
+static persist_value store[PERSIST_KEYS];
+static uint32_t persist_budget = HOST_PERSIST_BUDGET;
+static host_persist_stats persist_stats;
+
+static persist_value *persist_find(uint32_t key) {
+  for (int i = 0; i < PERSIST_KEYS; i++) {
+    if (store[i].used && store[i].key == key) { return &store[i]; }
+  }
+  return NULL;
+}
+
+void host_persist_reset(uint32_t budget) {
+  memset(store, 0, sizeof(store));
+  memset(&persist_stats, 0, sizeof(persist_stats));
+  persist_budget = budget;
+}
+
+void host_persist_set_budget(uint32_t budget) {
+  persist_budget = budget;
+}
+
+host_persist_stats host_persist_get_stats(void) {
+  return persist_stats;
+}
+
+bool persist_exists(uint32_t key) {
+  persist_stats.reads++;
+  return persist_find(key) != NULL;
+}
+
+int persist_read_data(uint32_t key, void *buffer, size_t size) {
+  persist_stats.reads++;
+  persist_value *value = persist_find(key);
+  if (value == NULL) { return E_DOES_NOT_EXIST; }
+  size_t length = value->length < size ? value->length : size;
+  memcpy(buffer, value->data, length);
+  persist_stats.read_bytes += length;
+  return length;
+}
+
+int32_t persist_read_int(uint32_t key) {
+  int32_t value = 0;
+  persist_read_data(key, &value, sizeof(value));
+  return value;
+}
+
+int persist_write_data(uint32_t key, const void *data, size_t size) {
+  if (size > PERSIST_DATA_MAX_LENGTH) { return E_RANGE; }
+  persist_value *value = persist_find(key);
+  uint32_t used = persist_stats.used - (value != NULL ? value->length : 0) + size;
+  if (used > persist_budget) {
+    persist_stats.failed++;
+    return E_OUT_OF_STORAGE;
+  }
+  if (value == NULL) {
+    for (int i = 0; i < PERSIST_KEYS && value == NULL; i++) {
+      if (!store[i].used) { value = &store[i]; }
+    }
+    if (value == NULL) {
+      persist_stats.failed++;
+      return E_OUT_OF_RESOURCES;
+    }
+    value->used = true;
+    value->key = key;
+    persist_stats.keys++;
+  }
+  memcpy(value->data, data, size);
+  value->length = size;
+  persist_stats.used = used;
+  persist_stats.writes++;
+  return size;
+}
+
+int persist_write_int(uint32_t key, int32_t value) {
+  return persist_write_data(key, &value, sizeof(value));
+}
+
+int persist_delete(uint32_t key) {
+  persist_value *value = persist_find(key);
+  if (value == NULL) { return E_DOES_NOT_EXIST; }
+  persist_stats.used -= value->length;
+  persist_stats.keys--;
+  persist_stats.writes++;
+  value->used = false;
+  return S_SUCCESS;
+}
+
+void host_persist_load(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) { return; }
+  uint32_t key;
+  uint16_t length;
+  uint8_t data[PERSIST_DATA_MAX_LENGTH];
+  while (fread(&key, sizeof(key), 1, f) == 1 && fread(&length, sizeof(length), 1, f) == 1 &&
+         length <= sizeof(data) && fread(data, 1, length, f) == length) {
+    persist_write_data(key, data, length);
+  }
+  fclose(f);
+  persist_stats.writes = 0;
+  persist_stats.reads = 0;
+  persist_stats.read_bytes = 0;
+}
+
+void host_persist_save(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) { return; }
+  for (int i = 0; i < PERSIST_KEYS; i++) {
+    if (!store[i].used) { continue; }
+    fwrite(&store[i].key, sizeof(store[i].key), 1, f);
+    fwrite(&store[i].length, sizeof(store[i].length), 1, f);
+    fwrite(store[i].data, 1, store[i].length, f);
+  }
+  fclose(f);
+}
+
+// ---- dictionaries
+
+#define TUPLE_HEADER 7 // key, type, length
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t *buffer, uint16_t size) {
+  if (iter == NULL || buffer == NULL || size < 1) { return DICT_INVALID_ARGS; }
+  iter->dictionary = (Dictionary *)buffer;
+  iter->dictionary->count = 0;
+  iter->cursor = iter->dictionary->head;
+  iter->end = buffer + size;
+  return DICT_OK;
+}
+
+static DictionaryResult dict_write(DictionaryIterator *iter, uint32_t key, TupleType type,
+                                   const void *data, uint16_t size) {
+  if (iter == NULL || iter->cursor == NULL) { return DICT_INVALID_ARGS; }
+  if ((uint8_t *)iter->cursor + TUPLE_HEADER + size > (uint8_t *)iter->end) {
+    return DICT_NOT_ENOUGH_STORAGE;
+  }
+  iter->cursor->key = key;
+  iter->cursor->type = type;
+  iter->cursor->length = size;
+  memcpy(iter->cursor->value->data, data, size);
+  iter->dictionary->count++;
+  iter->cursor = (Tuple *)((uint8_t *)iter->cursor + TUPLE_HEADER + size);
+  return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, uint32_t key, const uint8_t *data, uint16_t size) {
+  return dict_write(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, uint32_t key, const char *cstring) {
+  return dict_write(iter, key, TUPLE_CSTRING, cstring, strlen(cstring) + 1);
+}
+
+DictionaryResult dict_write_int(DictionaryIterator *iter, uint32_t key, const void *integer,
+                                uint8_t width, bool is_signed) {
+  return dict_write(iter, key, is_signed ? TUPLE_INT : TUPLE_UINT, integer, width);
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+  iter->end = iter->cursor;
+  return (uint8_t *)iter->cursor - (uint8_t *)iter->dictionary;
+}
+
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t *buffer, uint16_t size) {
+  iter->dictionary = (Dictionary *)buffer;
+  iter->end = buffer + size;
+  return dict_read_first(iter);
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter) {
+  iter->cursor = iter->dictionary->head;
+  if (iter->dictionary->count == 0 ||
+      (uint8_t *)iter->cursor + TUPLE_HEADER > (uint8_t *)iter->end) {
+    return NULL;
+  }
+  return iter->cursor;
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter) {
+  Tuple *next = (Tuple *)((uint8_t *)iter->cursor + TUPLE_HEADER + iter->cursor->length);
+  if ((uint8_t *)next + TUPLE_HEADER > (uint8_t *)iter->end) {
+    return NULL;
+  }
+  iter->cursor = next;
+  return next;
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, uint32_t key) {
+  DictionaryIterator copy = *iter;
+  for (Tuple *tuple = dict_read_first(&copy); tuple != NULL; tuple = dict_read_next(&copy)) {
+    if (tuple->key == key) { return tuple; }
+  }
+  return NULL;
+}
+
+// ---- AppMessage
+
+static uint32_t inbox_maximum = 656;
+static uint32_t outbox_maximum = 656;
+static uint32_t inbox_size = 0;
+static uint32_t outbox_size = 0;
+static uint8_t *inbox = NULL;
+static uint8_t *outbox = NULL;
+static uint8_t *outbox_done = NULL; // what was sent, for the sent/failed handlers
+static uint32_t outbox_done_size = 0;
+static DictionaryIterator outbox_iter;
+static enum { OUTBOX_IDLE, OUTBOX_WRITING, OUTBOX_SENDING } outbox_state = OUTBOX_IDLE;
+static AppMessageInboxReceived inbox_received = NULL;
+static AppMessageInboxDropped inbox_dropped = NULL;
+static AppMessageOutboxSent outbox_sent = NULL;
+static AppMessageOutboxFailed outbox_failed = NULL;
+
+AppMessageResult app_message_open(uint32_t size_inbound, uint32_t size_outbound) {
+  if (inbox != NULL) { return APP_MSG_INVALID_STATE; }
+  inbox_size = size_inbound < inbox_maximum ? size_inbound : inbox_maximum;
+  outbox_size = size_outbound < outbox_maximum ? size_outbound : outbox_maximum;
+  inbox = malloc(inbox_size);
+  outbox = malloc(outbox_size);
+  outbox_done = malloc(outbox_size);
+  printf("open %u %u\n", inbox_size, outbox_size);
+  return APP_MSG_OK;
+}
+
+uint32_t app_message_inbox_size_maximum(void) {
+  return inbox_maximum;
+}
+
+uint32_t app_message_outbox_size_maximum(void) {
+  return outbox_maximum;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived handler) {
+  AppMessageInboxReceived old = inbox_received;
+  inbox_received = handler;
+  return old;
+}
+
+AppMessageInboxDropped app_message_register_inbox_dropped(AppMessageInboxDropped handler) {
+  AppMessageInboxDropped old = inbox_dropped;
+  inbox_dropped = handler;
+  return old;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent handler) {
+  AppMessageOutboxSent old = outbox_sent;
+  outbox_sent = handler;
+  return old;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed handler) {
+  AppMessageOutboxFailed old = outbox_failed;
+  outbox_failed = handler;
+  return old;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+  *iterator = NULL;
+  if (outbox == NULL) { return APP_MSG_INVALID_STATE; }
+  if (outbox_state == OUTBOX_SENDING) { return APP_MSG_BUSY; }
+  dict_write_begin(&outbox_iter, outbox, outbox_size);
+  outbox_state = OUTBOX_WRITING;
+  *iterator = &outbox_iter;
+  return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void) {
+  if (outbox_state != OUTBOX_WRITING) { return APP_MSG_INVALID_STATE; }
+  outbox_done_size = dict_write_end(&outbox_iter);
+  memcpy(outbox_done, outbox, outbox_done_size);
+  outbox_state = OUTBOX_SENDING;
+  print_hex("out", outbox, outbox_done_size);
+  return APP_MSG_OK;
+}
+
+static void outbox_result(bool ok, AppMessageResult reason) {
+  if (outbox_state != OUTBOX_SENDING) { return; }
+  outbox_state = OUTBOX_IDLE;
+  DictionaryIterator iter;
+  dict_read_begin_from_buffer(&iter, outbox_done, outbox_done_size);
+  if (ok && outbox_sent != NULL) {
+    outbox_sent(&iter, NULL);
+  } else if (!ok && outbox_failed != NULL) {
+    outbox_failed(&iter, reason, NULL);
+  }
+}
+
+static void inbox_deliver(const uint8_t *data, size_t size) {
+  if (inbox == NULL || size > inbox_size) {
+    printf("nack %d\n", APP_MSG_BUFFER_OVERFLOW);
+    if (inbox_dropped != NULL) { inbox_dropped(APP_MSG_BUFFER_OVERFLOW, NULL); }
+    return;
+  }
+  printf("ack\n");
+  memcpy(inbox, data, size);
+  DictionaryIterator iter;
+  dict_read_begin_from_buffer(&iter, inbox, size);
+  if (inbox_received != NULL) { inbox_received(&iter, NULL); }
+}
+
+// ---- timers
+
+struct AppTimer {
+  int64_t due;
+  uint64_t order;
+  AppTimerCallback callback;
+  void *data;
+};
+
+#define TIMERS_MAX 64
+
+static AppTimer *timers[TIMERS_MAX]; // pending, in no particular order
+static int timer_count = 0;
+static uint64_t timer_order = 0;
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *data) {
+  if (timer_count == TIMERS_MAX) { return NULL; }
+  // fired and cancelled timers are never freed, so a stale handle stays harmless
+  AppTimer *timer = malloc(sizeof(AppTimer));
+  *timer = (AppTimer) { .due = clock_ms + timeout_ms, .order = timer_order++,
+                        .callback = callback, .data = data };
+  timers[timer_count++] = timer;
+  return timer;
+}
+
+static int timer_index(AppTimer *timer) {
+  for (int i = 0; i < timer_count; i++) {
+    if (timers[i] == timer) { return i; }
+  }
+  return -1;
+}
+
+bool app_timer_reschedule(AppTimer *timer, uint32_t new_timeout_ms) {
+  if (timer == NULL || timer_index(timer) < 0) { return false; }
+  timer->due = clock_ms + new_timeout_ms;
+  timer->order = timer_order++;
+  return true;
+}
+
+void app_timer_cancel(AppTimer *timer) {
+  int i = timer_index(timer);
+  if (i >= 0) { timers[i] = timers[--timer_count]; }
+}
+
+static AppTimer *timer_next(void) {
+  AppTimer *next = NULL;
+  for (int i = 0; i < timer_count; i++) {
+    if (next == NULL || timers[i]->due < next->due ||
+        (timers[i]->due == next->due && timers[i]->order < next->order)) {
+      next = timers[i];
+    }
+  }
+  return next;
+}
+
+// ---- event services, one set for the face and one for the worker
+
+typedef struct services {
+  TimeUnits tick_units;
+  TickHandler tick;
+  time_t tick_last;
+  BatteryStateHandler battery;
+  BluetoothConnectionHandler bluetooth;
+  AppWorkerMessageHandler worker_message;
+} services;
+
+static services app_services;
+static services worker_services;
+static AccelTapHandler tap_handler = NULL;
+static BatteryChargeState battery = { .charge_percent = 80 };
+static bool connected = true;
+static bool worker_running = false;
+static jmp_buf worker_return;
+
+static void tick_subscribe(services *s, TimeUnits units, TickHandler handler) {
+  s->tick_units = units;
+  s->tick = handler;
+  s->tick_last = host_time(NULL);
+}
+
+void tick_timer_service_subscribe(TimeUnits units, TickHandler handler) { tick_subscribe(&app_services, units, handler); }
+void tick_timer_service_unsubscribe(void) { app_services.tick = NULL; }
+void worker_tick_timer_service_subscribe(TimeUnits units, TickHandler handler) { tick_subscribe(&worker_services, units, handler); }
+void worker_tick_timer_service_unsubscribe(void) { worker_services.tick = NULL; }
+
+static time_t tick_granularity(TimeUnits units) {
+  if (units & SECOND_UNIT) { return 1; }
+  if (units & MINUTE_UNIT) { return 60; }
+  if (units & HOUR_UNIT)   { return 3600; }
+  return 86400; // DAY_UNIT and up: local midnight
+}
+
+static int64_t tick_next(const services *s) {
+  if (s->tick == NULL) { return -1; }
+  time_t step = tick_granularity(s->tick_units);
+  return utc_ms_of_local((s->tick_last / step + 1) * step);
+}
+
+static void tick_fire(services *s, time_t local) {
+  struct tm before, now;
+  gmtime_r(&s->tick_last, &before);
+  gmtime_r(&local, &now);
+  TimeUnits changed = 0;
+  if (now.tm_sec != before.tm_sec)   { changed |= SECOND_UNIT; }
+  if (now.tm_min != before.tm_min)   { changed |= MINUTE_UNIT; }
+  if (now.tm_hour != before.tm_hour) { changed |= HOUR_UNIT; }
+  if (now.tm_mday != before.tm_mday) { changed |= DAY_UNIT; }
+  if (now.tm_mon != before.tm_mon)   { changed |= MONTH_UNIT; }
+  if (now.tm_year != before.tm_year) { changed |= YEAR_UNIT; }
+  s->tick_last = local;
+  s->tick(&now, changed);
+}
+
+void battery_state_service_subscribe(BatteryStateHandler handler) { app_services.battery = handler; }
+void battery_state_service_unsubscribe(void) { app_services.battery = NULL; }
+void worker_battery_state_service_subscribe(BatteryStateHandler handler) { worker_services.battery = handler; }
+void worker_battery_state_service_unsubscribe(void) { worker_services.battery = NULL; }
+BatteryChargeState battery_state_service_peek(void) { return battery; }
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) { app_services.bluetooth = handler; }
+void bluetooth_connection_service_unsubscribe(void) { app_services.bluetooth = NULL; }
+void worker_bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) { worker_services.bluetooth = handler; }
+void worker_bluetooth_connection_service_unsubscribe(void) { worker_services.bluetooth = NULL; }
+bool bluetooth_connection_service_peek(void) { return connected; }
+
+void accel_tap_service_subscribe(AccelTapHandler handler) { tap_handler = handler; }
+void accel_tap_service_unsubscribe(void) { tap_handler = NULL; }
+
+// worker messages go through the event loop, as they do on the watch
+
+typedef struct worker_delivery {
+  services *to;
+  uint16_t type;
+  AppWorkerMessage message;
+} worker_delivery;
+
+static void worker_deliver(void *data) {
+  worker_delivery *delivery = data;
+  if (delivery->to->worker_message != NULL &&
+      (delivery->to == &app_services || worker_running)) {
+    delivery->to->worker_message(delivery->type, &delivery->message);
+  }
+  free(delivery);
+}
+
+static void worker_post(services *to, uint8_t type, AppWorkerMessage *data) {
+  worker_delivery *delivery = malloc(sizeof(worker_delivery));
+  *delivery = (worker_delivery) { .to = to, .type = type, .message = *data };
+  app_timer_register(0, &worker_deliver, delivery);
+}
+
+bool app_worker_message_subscribe(AppWorkerMessageHandler handler) { app_services.worker_message = handler; return true; }
+bool app_worker_message_unsubscribe(void) { app_services.worker_message = NULL; return true; }
+bool worker_app_worker_message_subscribe(AppWorkerMessageHandler handler) { worker_services.worker_message = handler; return true; }
+bool worker_app_worker_message_unsubscribe(void) { worker_services.worker_message = NULL; return true; }
+
+void app_worker_send_message(uint8_t type, AppWorkerMessage *data) {
+  if (worker_running) { worker_post(&worker_services, type, data); }
+}
+
+void worker_app_worker_send_message(uint8_t type, AppWorkerMessage *data) {
+  worker_post(&app_services, type, data);
+}
+
+bool app_worker_is_running(void) {
+  return worker_running;
+}
+
+AppWorkerResult app_worker_launch(void) {
+  if (worker_running) { return APP_WORKER_RESULT_ALREADY_RUNNING; }
+  if (worker_main == NULL) { return APP_WORKER_RESULT_NO_WORKER; }
+  worker_running = true;
+  // the worker's main runs its init, then worker_event_loop() jumps back here;
+  // from then on its handlers are called from our event loop
+  if (setjmp(worker_return) == 0) {
+    worker_main();
+  }
+  return APP_WORKER_RESULT_SUCCESS;
+}
+
+void worker_event_loop(void) {
+  longjmp(worker_return, 1);
+}
+
+AppWorkerResult app_worker_kill(void) {
+  if (!worker_running) { return APP_WORKER_RESULT_NOT_RUNNING; }
+  worker_running = false;
+  memset(&worker_services, 0, sizeof(worker_services));
+  return APP_WORKER_RESULT_SUCCESS;
+}
+
+// ---- vibes
+
+void vibes_cancel(void) { }
+void vibes_short_pulse(void) { printf("vibe short\n"); }
+void vibes_long_pulse(void) { printf("vibe long\n"); }
+void vibes_double_pulse(void) { printf("vibe double\n"); }
+
+void vibes_enqueue_custom_pattern(VibePattern pattern) {
+  printf("vibe custom");
+  for (uint32_t i = 0; i < pattern.num_segments; i++) { printf(" %u", pattern.durations[i]); }
+  printf("\n");
+}
+
+// ---- graphics: nothing is drawn, but the text of each frame is kept
+
+#define FRAME_TEXTS 64
+
+struct GContext { int unused; };
+struct GBitmap {
+  GBitmapFormat format;
+  GColor palette[16];
+};
+
+static struct GContext context;
+static char frame_text[FRAME_TEXTS][64];
+static int frame_texts = 0;
+static uint32_t frames = 0;
+static bool screen_dirty = false;
+
+static void frame_add_text(const char *text) {
+  if (text != NULL && text[0] && frame_texts < FRAME_TEXTS) {
+    snprintf(frame_text[frame_texts++], sizeof(frame_text[0]), "%s", text);
+  }
+}
+
+GFont fonts_get_system_font(const char *font_key) { return (GFont)font_key; }
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id) {
+  GBitmap *bitmap = calloc(1, sizeof(GBitmap));
+  bitmap->format = GBitmapFormat1Bit;
+  return bitmap;
+}
+
+GBitmap *gbitmap_create_as_sub_bitmap(const GBitmap *base, GRect sub_rect) {
+  GBitmap *bitmap = malloc(sizeof(GBitmap));
+  *bitmap = *base;
+  return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) { free(bitmap); }
+GColor *gbitmap_get_palette(const GBitmap *bitmap) { return (GColor *)bitmap->palette; }
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap) { return bitmap->format; }
+
+void graphics_context_set_stroke_color(GContext *ctx, GColor color) { }
+void graphics_context_set_fill_color(GContext *ctx, GColor color) { }
+void graphics_context_set_text_color(GContext *ctx, GColor color) { }
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode) { }
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) { }
+void graphics_draw_rect(GContext *ctx, GRect rect) { }
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) { }
+
+void graphics_draw_text(GContext *ctx, const char *text, GFont const font, const GRect box,
+                        const GTextOverflowMode overflow_mode, const GTextAlignment alignment,
+                        GTextAttributes *text_attributes) {
+  frame_add_text(text);
+}
+
+// ---- layers and windows
+
+enum { LAYER_PLAIN, LAYER_TEXT, LAYER_BITMAP };
+
+struct Layer {
+  GRect frame;
+  bool hidden;
+  int kind;
+  LayerUpdateProc update;
+  Layer *parent;
+  Layer *children;
+  Layer *next;
+};
+
+struct TextLayer {
+  Layer layer; // first, so layer_destroy() frees the whole thing
+  const char *text;
+};
+
+struct BitmapLayer {
+  Layer layer;
+  const GBitmap *bitmap;
+};
+
+struct Window {
+  Layer root;
+  WindowHandlers handlers;
+};
+
+static Window *top_window = NULL;
+
+static void layer_init(Layer *layer, GRect frame, int kind) {
+  memset(layer, 0, sizeof(Layer));
+  layer->frame = frame;
+  layer->kind = kind;
+}
+
+Layer *layer_create(GRect frame) {
+  Layer *layer = malloc(sizeof(Layer));
+  layer_init(layer, frame, LAYER_PLAIN);
+  return layer;
+}
+
+void layer_remove_from_parent(Layer *child) {
+  if (child->parent == NULL) { return; }
+  for (Layer **at = &child->parent->children; *at != NULL; at = &(*at)->next) {
+    if (*at == child) {
+      *at = child->next;
+      break;
+    }
+  }
+  child->parent = NULL;
+  child->next = NULL;
+  screen_dirty = true;
+}
+
+void layer_destroy(Layer *layer) {
+  if (layer == NULL) { return; }
+  layer_remove_from_parent(layer);
+  while (layer->children != NULL) {
+    layer_remove_from_parent(layer->children);
+  }
+  free(layer);
+}
+
+void layer_mark_dirty(Layer *layer) { screen_dirty = true; }
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) { layer->update = update_proc; }
+void layer_set_frame(Layer *layer, GRect frame) { layer->frame = frame; screen_dirty = true; }
+GRect layer_get_frame(const Layer *layer) { return layer->frame; }
+GRect layer_get_bounds(const Layer *layer) { return GRect(0, 0, layer->frame.size.w, layer->frame.size.h); }
+bool layer_get_hidden(const Layer *layer) { return layer->hidden; }
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+  if (layer->hidden != hidden) {
+    layer->hidden = hidden;
+    screen_dirty = true;
+  }
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+  layer_remove_from_parent(child);
+  Layer **at = &parent->children;
+  while (*at != NULL) { at = &(*at)->next; }
+  *at = child;
+  child->parent = parent;
+  screen_dirty = true;
+}
+
+TextLayer *text_layer_create(GRect frame) {
+  TextLayer *text_layer = malloc(sizeof(TextLayer));
+  layer_init(&text_layer->layer, frame, LAYER_TEXT);
+  text_layer->text = NULL;
+  return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) { layer_destroy(&text_layer->layer); }
+Layer *text_layer_get_layer(TextLayer *text_layer) { return &text_layer->layer; }
+const char *text_layer_get_text(TextLayer *text_layer) { return text_layer->text; }
+void text_layer_set_text(TextLayer *text_layer, const char *text) { text_layer->text = text; screen_dirty = true; }
+void text_layer_set_background_color(TextLayer *text_layer, GColor color) { }
+void text_layer_set_text_color(TextLayer *text_layer, GColor color) { screen_dirty = true; }
+void text_layer_set_font(TextLayer *text_layer, GFont font) { }
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment) { }
+
+BitmapLayer *bitmap_layer_create(GRect frame) {
+  BitmapLayer *bitmap_layer = malloc(sizeof(BitmapLayer));
+  layer_init(&bitmap_layer->layer, frame, LAYER_BITMAP);
+  bitmap_layer->bitmap = NULL;
+  return bitmap_layer;
+}
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer) { layer_destroy(&bitmap_layer->layer); }
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer) { return (Layer *)&bitmap_layer->layer; }
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap) { bitmap_layer->bitmap = bitmap; screen_dirty = true; }
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode) { screen_dirty = true; }
+
+Window *window_create(void) {
+  Window *window = calloc(1, sizeof(Window));
+  layer_init(&window->root, GRect(0, 0, 144, 168), LAYER_PLAIN);
+  return window;
+}
+
+void window_destroy(Window *window) {
+  if (window == top_window) {
+    if (window->handlers.unload != NULL) { window->handlers.unload(window); }
+    top_window = NULL;
+  }
+  free(window);
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) { window->handlers = handlers; }
+void window_set_background_color(Window *window, GColor background_color) { screen_dirty = true; }
+Layer *window_get_root_layer(const Window *window) { return (Layer *)&window->root; }
+
+void window_stack_push(Window *window, bool animated) {
+  top_window = window;
+  if (window->handlers.load != NULL) { window->handlers.load(window); }
+  screen_dirty = true;
+}
+
+static void render_layer(Layer *layer) {
+  if (layer->hidden) { return; }
+  if (layer->update != NULL) { layer->update(layer, &context); }
+  if (layer->kind == LAYER_TEXT) { frame_add_text(((TextLayer *)layer)->text); }
+  for (Layer *child = layer->children; child != NULL; child = child->next) {
+    render_layer(child);
+  }
+}
+
+// draw a frame if anything changed, as the watch does after each event
+static void render(void) {
+  if (!screen_dirty || top_window == NULL) { return; }
+  screen_dirty = false;
+  frame_texts = 0;
+  frames++;
+  render_layer(&top_window->root);
+  if (frames == 1) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("first %u %u %u %lld\n", persist_stats.reads, persist_stats.read_bytes, persist_stats.writes,
+           (long long)(now.tv_sec - started.tv_sec) * 1000000 + (now.tv_nsec - started.tv_nsec) / 1000);
+  }
+}
+
+// ---- the event loop
+
+void host_run_until(int64_t utc_ms) {
+  render();
+  while (true) {
+    AppTimer *timer = timer_next();
+    int64_t due = timer != NULL ? timer->due : -1;
+    services *ticking = NULL;
+    int64_t app_tick = tick_next(&app_services);
+    int64_t worker_tick = worker_running ? tick_next(&worker_services) : -1;
+    if (app_tick >= 0 && (due < 0 || app_tick < due)) {
+      due = app_tick;
+      ticking = &app_services;
+    }
+    if (worker_tick >= 0 && (due < 0 || worker_tick < due)) {
+      due = worker_tick;
+      ticking = &worker_services;
+    }
+    if (due < 0 || due > utc_ms) {
+      break;
+    }
+    if (due > clock_ms) { clock_ms = due; }
+    if (ticking != NULL) {
+      tick_fire(ticking, local_seconds(due));
+    } else {
+      app_timer_cancel(timer);
+      timer->callback(timer->data);
+    }
+    render();
+  }
+  if (utc_ms > clock_ms) { clock_ms = utc_ms; }
+}
+
+static int64_t next_event(void) {
+  int64_t next = -1;
+  AppTimer *timer = timer_next();
+  int64_t candidates[3] = { timer != NULL ? timer->due : -1, tick_next(&app_services),
+                            worker_running ? tick_next(&worker_services) : -1 };
+  for (int i = 0; i < 3; i++) {
+    if (candidates[i] >= 0 && (next < 0 || candidates[i] < next)) { next = candidates[i]; }
+  }
+  return next;
+}
+
+static void set_battery(uint8_t percent, bool charging, bool plugged) {
+  battery = (BatteryChargeState) { .charge_percent = percent, .is_charging = charging,
+                                   .is_plugged = plugged };
+  if (app_services.battery != NULL) { app_services.battery(battery); }
+  if (worker_running && worker_services.battery != NULL) { worker_services.battery(battery); }
+}
+
+static void set_connected(bool up) {
+  connected = up;
+  if (app_services.bluetooth != NULL) { app_services.bluetooth(up); }
+  if (worker_running && worker_services.bluetooth != NULL) { worker_services.bluetooth(up); }
+}
+
+static void command(char *line) {
+  char *rest = NULL;
+  int64_t at = strtoll(line, &rest, 10);
+  char name[16] = "";
+  int used = 0;
+  sscanf(rest, " %15s %n", name, &used);
+  char *args = rest + used;
+  host_run_until(at);
+
+  if (strcmp(name, "in") == 0) {
+    size_t size = strlen(args) / 2;
+    uint8_t *data = malloc(size + 1);
+    inbox_deliver(data, parse_hex(args, data, size));
+    free(data);
+  } else if (strcmp(name, "sent") == 0) {
+    outbox_result(true, APP_MSG_OK);
+  } else if (strcmp(name, "failed") == 0) {
+    outbox_result(false, atoi(args));
+  } else if (strcmp(name, "tz") == 0) {
+    tz_west = atoi(args);
+    // the clock jumped: ticks go on every unit from the new time
+    app_services.tick_last = worker_services.tick_last = local_seconds(clock_ms);
+  } else if (strcmp(name, "bt") == 0) {
+    set_connected(atoi(args));
+  } else if (strcmp(name, "battery") == 0) {
+    int percent = 0, charging = 0, plugged = 0;
+    sscanf(args, "%d %d %d", &percent, &charging, &plugged);
+    set_battery(percent, charging, plugged);
+  } else if (strcmp(name, "tap") == 0) {
+    if (tap_handler != NULL) { tap_handler(ACCEL_AXIS_Z, 1); }
+  } else if (strcmp(name, "screen") == 0) {
+    render();
+    for (int i = 0; i < frame_texts; i++) { printf("text %s\n", frame_text[i]); }
+  } else if (strcmp(name, "persist") == 0) {
+    persist_value *value = persist_find(strtoul(args, NULL, 10));
+    if (value != NULL) {
+      print_hex("persist", value->data, value->length);
+    } else {
+      printf("persist -\n");
+    }
+  } else if (strcmp(name, "stat") == 0) {
+    printf("stat %u %u %u %u %u %d %u %u\n", persist_stats.used, persist_stats.keys,
+           persist_stats.writes, persist_stats.failed, frames, timer_count,
+           persist_stats.reads, persist_stats.read_bytes);
+  }
+  host_run_until(at); // whatever the command set off right away
+}
+
+static const char *persist_path = NULL;
+
+static void save_storage(void) {
+  if (persist_path != NULL) { host_persist_save(persist_path); }
+}
+
+__attribute__((constructor))
+static void host_setup(void) {
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  const char *value;
+  if ((value = getenv("HOST_TIME")) != NULL)    { clock_ms = strtoll(value, NULL, 10); }
+  if ((value = getenv("HOST_TZ")) != NULL)      { tz_west = atoi(value); }
+  if ((value = getenv("HOST_INBOX")) != NULL)   { inbox_maximum = atoi(value); }
+  if ((value = getenv("HOST_OUTBOX")) != NULL)  { outbox_maximum = atoi(value); }
+  if ((value = getenv("HOST_BT")) != NULL)      { connected = atoi(value); }
+  if ((value = getenv("HOST_BATTERY")) != NULL) { battery.charge_percent = atoi(value); }
+  if ((persist_path = getenv("HOST_PERSIST")) != NULL) {
+    host_persist_load(persist_path);
+    atexit(&save_storage);
+  }
+}
+
+void app_event_loop(void) {
+  char *line = NULL;
+  size_t size = 0;
+  host_run_until(clock_ms);
+  printf("idle %lld\n", (long long)next_event());
+  fflush(stdout);
+  while (getline(&line, &size, stdin) > 0) {
+    line[strcspn(line, "\n")] = '\0';
+    if (strstr(line, " quit") != NULL) {
+      break;
+    }
+    command(line);
+    printf("idle %lld\n", (long long)next_event());
+    fflush(stdout);
+  }
+  free(line);
+}
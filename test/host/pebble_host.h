@@ -0,0 +1,28 @@
+// Host-only hooks into pebble_host.c, for test programs that drive the
+// watch code directly rather than through the harness's command loop.
+#pragma once
+#include "pebble.h"
+
+#define HOST_PERSIST_BUDGET 4096 // bytes of persistent storage an app gets
+
+typedef struct host_persist_stats {
+  uint32_t used;       // bytes stored now
+  uint32_t keys;       // values stored now
+  uint32_t writes;     // successful writes (data, int and delete)
+  uint32_t failed;     // writes refused for lack of room
+  uint32_t reads;      // lookups (exists, read data and int)
+  uint32_t read_bytes; // bytes those read
+} host_persist_stats;
+
+// forget everything stored, and allow budget bytes from now on
+void host_persist_reset(uint32_t budget);
+void host_persist_set_budget(uint32_t budget);
+host_persist_stats host_persist_get_stats(void);
+void host_persist_load(const char *path);
+void host_persist_save(const char *path);
+
+// the virtual clock, in UTC milliseconds, and the watch's offset from it
+void host_set_clock(int64_t utc_ms, int32_t tz_minutes_west);
+int64_t host_clock(void);
+// fire timers and ticks due up to utc_ms, in order
+void host_run_until(int64_t utc_ms);
@@ -0,0 +1,27 @@
+// The worker's view of the SDK on the host.  The worker is linked into the
+// same process as the face, so its services are renamed to the worker side
+// of pebble_host.c, and its main() is started by app_worker_launch().
+#pragma once
+#include "pebble.h"
+
+#define main                                     worker_main
+#define tick_timer_service_subscribe             worker_tick_timer_service_subscribe
+#define tick_timer_service_unsubscribe           worker_tick_timer_service_unsubscribe
+#define battery_state_service_subscribe          worker_battery_state_service_subscribe
+#define battery_state_service_unsubscribe        worker_battery_state_service_unsubscribe
+#define bluetooth_connection_service_subscribe   worker_bluetooth_connection_service_subscribe
+#define bluetooth_connection_service_unsubscribe worker_bluetooth_connection_service_unsubscribe
+#define app_worker_message_subscribe             worker_app_worker_message_subscribe
+#define app_worker_message_unsubscribe           worker_app_worker_message_unsubscribe
+#define app_worker_send_message                  worker_app_worker_send_message
+
+int worker_main(void);
+void worker_tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler);
+void worker_tick_timer_service_unsubscribe(void);
+void worker_battery_state_service_subscribe(BatteryStateHandler handler);
+void worker_battery_state_service_unsubscribe(void);
+void worker_bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler);
+void worker_bluetooth_connection_service_unsubscribe(void);
+bool worker_app_worker_message_subscribe(AppWorkerMessageHandler handler);
+bool worker_app_worker_message_unsubscribe(void);
+void worker_app_worker_send_message(uint8_t type, AppWorkerMessage *data);
@@ -0,0 +1,128 @@
+// Stand-ins for the web services the phone talks to, for harness.js.
+// A server says which URLs it handles and answers a request with
+// { status, body } or null for no answer at all (the connection failed).
+
+"use strict";
+
+function query(url) {
+  var out = {};
+  (url.split("?")[1] || "").split("&").forEach(function(pair) {
+    var kv = pair.split("=");
+    if(kv[0]) { out[decodeURIComponent(kv[0])] = decodeURIComponent(kv[1] || ""); }
+  });
+  return out;
+}
+
+function form(body) {
+  return query("?" + body.replace(/\+/g, " "));
+}
+
+// The parts of the Beeminder API the phone uses: the goal list, and
+// create_all for datapoints, which like the real one skips a datapoint
+// whose requestid it has already seen.
+//
+// failNext / loseNext make that many requests fail with a 500, or be carried
+// out with the reply lost; failRate / loseRate do it at random.
+function Beeminder(options) {
+  options = options || {};
+  this.user = options.user || "alice";
+  this.token = options.token || "secret";
+  this.goals = options.goals || [];
+  this.datapoints = [];  // as created, { slug, value, timestamp, requestid }
+  this.requests = 0;
+  this.duplicates = 0;   // datapoints not created again thanks to their requestid
+  this.failNext = 0;
+  this.loseNext = 0;
+  this.failRate = options.failRate || 0;
+  this.loseRate = options.loseRate || 0;
+  this.random = options.random || Math.random;
+}
+
+Beeminder.prototype.handles = function(url) {
+  return url.indexOf("https://www.beeminder.com/api/v1/") === 0;
+};
+
+Beeminder.prototype.handle = function(req) {
+  this.requests++;
+  if(this.failNext > 0 || this.random() < this.failRate) {
+    if(this.failNext > 0) { this.failNext--; }
+    return { status: 500, body: "{}" };
+  }
+  var route = req.url.slice("https://www.beeminder.com/api/v1".length).split("?")[0];
+  var users = "/users/" + encodeURIComponent(this.user);
+  var params = req.method === "GET" ? query(req.url) : form(req.body);
+  if(params.auth_token !== this.token) {
+    return { status: 401, body: { errors: "bad token" } };
+  }
+  var reply;
+  var m = new RegExp("^" + users + "/goals/([^/]+)/datapoints/create_all.json$").exec(route);
+  if(req.method === "GET" && route === users + "/goals.json") {
+    reply = { status: 200, body: this.goals };
+  } else if(req.method === "POST" && m) {
+    var slug = decodeURIComponent(m[1]), self = this;
+    var created = JSON.parse(params.datapoints).map(function(dp) {
+      var existing = self.datapoints.filter(function(d) { return d.requestid === dp.requestid; })[0];
+      if(existing) {
+        self.duplicates++;
+        return existing;
+      }
+      var datapoint = { slug: slug, value: dp.value, timestamp: dp.timestamp,
+                        requestid: dp.requestid, comment: dp.comment };
+      self.datapoints.push(datapoint);
+      return datapoint;
+    });
+    reply = { status: 200, body: created };
+  } else {
+    return { status: 404, body: "{}" };
+  }
+  if(this.loseNext > 0 || this.random() < this.loseRate) {
+    if(this.loseNext > 0) { this.loseNext--; }
+    return null; // done, but the phone never hears so
+  }
+  return reply;
+};
+
+// sum of the values created for slug
+Beeminder.prototype.total = function(slug) {
+  return this.datapoints.filter(function(d) { return d.slug === slug; })
+                        .reduce(function(sum, d) { return sum + d.value; }, 0);
+};
+
+// Open-Meteo's forecast endpoint, with the current weather and the day's
+// range.  weather(lat, lon, time) says what it's like; by default a mild day
+// that warms up until mid-afternoon.
+function Weather(options) {
+  options = options || {};
+  this.requests = 0;
+  this.cells = {};   // requests per "lat,lon"
+  this.failNext = 0;
+  this.weather = options.weather || function(lat, lon, time) {
+    var hour = new Date(time).getUTCHours();
+    return { temperature: 10 + Math.round(6 * Math.sin((hour - 9) / 24 * 2 * Math.PI)),
+             code: hour < 12 ? 2 : 61, max: 16, min: 4 };
+  };
+}
+
+Weather.prototype.handles = function(url) {
+  return url.indexOf("https://api.open-meteo.com/v1/forecast") === 0;
+};
+
+Weather.prototype.handle = function(req) {
+  this.requests++;
+  if(this.failNext > 0) {
+    this.failNext--;
+    return { status: 503, body: "{}" };
+  }
+  var params = query(req.url);
+  var cell = params.latitude + "," + params.longitude;
+  this.cells[cell] = (this.cells[cell] || 0) + 1;
+  var w = this.weather(Number(params.latitude), Number(params.longitude), req.time);
+  function units(c) { return params.temperature_unit === "fahrenheit" ? c * 9 / 5 + 32 : c; }
+  return { status: 200, body: {
+    latitude: Number(params.latitude), longitude: Number(params.longitude),
+    current_weather: { temperature: units(w.temperature), weathercode: w.code },
+    daily: { temperature_2m_max: [units(w.max)], temperature_2m_min: [units(w.min)] }
+  } };
+};
+
+module.exports = { Beeminder: Beeminder, Weather: Weather };
@@ -0,0 +1,67 @@
+// The battery log after the worker has lapped the face: three days with
+// the phone out of reach, then back.  Only records the worker hasn't
+// started clearing may go out (BATTLOG_VALID), all in order, none blank.
+// Then the watch app is reinstalled: its log starts over below what the
+// phone has seen, and the phone takes the new records all the same.
+
+"use strict";
+var fs = require("fs");
+var harness = require("./harness");
+var MINUTE = harness.MINUTE, HOUR = harness.HOUR, DAY = harness.DAY;
+
+var PK_LOG_HEAD = 4; // see battlog.h
+var BATTLOG_VALID = 224;
+var BATTLOG_BATCH = 16;  // see pebblebee.c
+
+(async function() {
+  var rig = harness.rig({ seed: 3 });
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ track_battery: 1 });
+  await rig.run(10 * MINUTE);
+  await rig.setLink(false);
+  await rig.run(3 * DAY + 7 * 15 * MINUTE); // part way into a block
+  var head = await rig.watch.persistInt(PK_LOG_HEAD);
+  var from = rig.phone.received.length;
+  await rig.setLink(true);
+  await rig.run(2 * HOUR);
+
+  var records = [];
+  rig.phone.received.slice(from).forEach(function(message) {
+    var msg = rig.phone.context.messageDecode(message.payload);
+    if(msg.type !== "log_data" && msg.type !== "hello_reply") { return; }
+    var count = msg.type === "hello_reply" ? msg.log_count : msg.records.length / 8; // flight records follow
+    for(var i = 0; i < count * 8; i += 8) {
+      records.push({ seq: msg.seq + i / 8,
+                     time: Buffer.from(msg.records.slice(i, i + 4)).readUInt32LE(0) });
+    }
+  });
+  var seqs = records.map(function(r) { return r.seq; });
+  harness.check(head % 32 !== 0 && head > 256, "the worker lapped the log, mid-block (head " + head + ")");
+  harness.check(records.length > 0 && seqs[0] >= head - BATTLOG_VALID,
+                "the upload starts inside the valid window (from " + seqs[0] + ")");
+  harness.check(records.every(function(r) { return r.time !== 0; }), "no cleared records sent");
+  harness.check(seqs.every(function(seq, i) { return i === 0 || seq === seqs[i - 1] + 1; }),
+                "records sent in order, without gaps");
+  harness.check(Number(rig.phone.storage.battery_log_seq) + 1 >= head, "the phone caught up");
+
+  var seen = Number(rig.phone.storage.battery_log_seq);
+  var stored = rig.phone.context.batteryStore().query(0, Infinity, "raw").length;
+  await rig.watch.stop();
+  fs.rmSync(rig.persistFile, { force: true }); // reinstalled
+  await rig.watch.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ track_battery: 1 });
+  rig.restartPhone();
+  await rig.run(6 * HOUR);
+  head = await rig.watch.persistInt(PK_LOG_HEAD);
+  var after = rig.phone.context.batteryStore().query(0, Infinity, "raw").length;
+  harness.check(head > 0 && head <= seen, "after a reinstall the watch's log starts over (head " + head + ")");
+  var taken = Number(rig.phone.storage.battery_log_seq) + 1;
+  harness.check(taken > head - BATTLOG_BATCH && taken <= head && after > stored,
+                "and the phone takes the new records (" + taken + " of " + head + ", the rest go with the next batch)");
+  await rig.stop();
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,110 @@
+// Datapoints logged with a double tap reach Beeminder exactly once, through
+// a lossy link, link drops, restarts of either end and a flaky server that
+// sometimes fails and sometimes does the work but loses the reply.
+
+"use strict";
+var harness = require("./harness");
+var servers = require("./servers");
+var MINUTE = harness.MINUTE, HOUR = harness.HOUR;
+
+var PK_DP_QUEUE = 7; // see pebblebee.c; the count is the third byte
+
+function setup(options) {
+  var rig = harness.rig(options);
+  var beeminder = new servers.Beeminder({
+    goals: [{ slug: "pushups", losedate: rig.sim.now / 1000 + 3 * 86400,
+              updated_at: 1, rate: 1, safebuf: 3, runits: "d" }],
+    failRate: options.failRate || 0, loseRate: options.loseRate || 0,
+    random: Math.random
+  });
+  rig.servers.push(beeminder);
+  return { rig: rig, beeminder: beeminder };
+}
+
+async function configure(rig) {
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ buser: "alice", btoken: "secret", bgoal: "pushups", dp_tap: 1 });
+  await rig.run(MINUTE);
+}
+
+async function doubleTap(rig) {
+  await rig.watch.command("tap");
+  await rig.run(500);
+  await rig.watch.command("tap");
+}
+
+async function queued(rig) {
+  var bytes = await rig.watch.persist(PK_DP_QUEUE);
+  return bytes ? bytes[2] : 0;
+}
+
+// one ack timer per batch in flight, gone once the phone acks
+async function ackTimer() {
+  var s = setup({ seed: 5 });
+  var rig = s.rig;
+  await configure(rig);
+  await rig.run(10 * 1000);
+  var idle = (await rig.watch.stat()).timers;
+  var most = idle;
+  for(var i = 0; i < 10; i++) {
+    await doubleTap(rig);
+    await rig.run(2000);
+    most = Math.max(most, (await rig.watch.stat()).timers);
+  }
+  var acked = await rig.until(async function() { return await queued(rig) === 0; }, MINUTE);
+  await rig.run(1000);
+  var after = (await rig.watch.stat()).timers;
+  harness.check(acked >= 0, "every batch acked");
+  harness.check(most <= idle + 1, "at most one ack timer at a time (" + (most - idle) + " extra timers)");
+  harness.check(after === idle, "no ack timer left once acked (" + after + " timers, " + idle + " before)");
+  harness.check(s.beeminder.total("pushups") === 10, "10 datapoints on Beeminder");
+  await rig.stop();
+}
+
+async function rough(seed) {
+  var s = setup({ seed: seed, loss: 0.2, failRate: 0.2, loseRate: 0.2 });
+  var rig = s.rig, beeminder = s.beeminder;
+  Math.random = harness.random(seed); // the stand-in's failures repeat too
+  await configure(rig);
+  var taps = 0;
+  for(var i = 0; i < 30; i++) {
+    await doubleTap(rig);
+    taps++;
+    await rig.run(20 * 1000);
+    if(i % 8 === 3) { // out of range for a few minutes, tapping away
+      await rig.setLink(false);
+      await doubleTap(rig);
+      taps++;
+      await rig.run(3 * MINUTE);
+      await rig.setLink(true);
+    }
+    if(i === 15) { await rig.restartWatch(); }
+    if(i === 22) { rig.restartPhone(); }
+  }
+  await rig.run(10 * MINUTE);
+  rig.restartPhone(); // whatever the server refused goes on the next launch
+  await rig.until(async function() {
+    return beeminder.total("pushups") === taps && await queued(rig) === 0 &&
+           JSON.parse(rig.phone.storage.dp_pending || "[]").length === 0;
+  }, HOUR);
+  harness.check(beeminder.total("pushups") === taps,
+                "seed " + seed + ": " + taps + " taps, " + beeminder.total("pushups") + " on Beeminder, " +
+                beeminder.duplicates + " resends deduped");
+  harness.check(await queued(rig) === 0, "seed " + seed + ": nothing left on the watch");
+  harness.check(JSON.parse(rig.phone.storage.dp_pending || "[]").length === 0,
+                "seed " + seed + ": nothing left on the phone");
+  await rig.stop();
+}
+
+(async function() {
+  var random = Math.random;
+  await ackTimer();
+  for(var seed = 1; seed <= 3; seed++) {
+    await rough(seed);
+  }
+  Math.random = random;
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,161 @@
+// Goals from a Beeminder stand-in reach the watch's goal store and stay in
+// step with it: a goal deleted on the server is deleted on the watch even
+// when the phone lost track of what the watch has, fetches asked for while
+// one is running wait their turn, more goals than the watch holds still
+// leave it the active one, a derail alert is stored as soon as it fires, and
+// the start-up hello brings the flight log along instead of asking for it
+// separately.
+
+"use strict";
+var harness = require("./harness");
+var servers = require("./servers");
+var MINUTE = harness.MINUTE;
+
+var PK_GOALS_VERSION = 14;  // see pebblebee.c
+var PK_GOAL_BASE = 64;      // see goal_store.h
+var GOAL_MAX = 32;
+var GOAL_FLAGS = 39;           // offsetof(goal_record, flags)
+var GOAL_FLAG_WARNED = 0x04;
+
+function goal(slug, updated) {
+  return { slug: slug, losedate: 1900000000, updated_at: updated || 1, rate: 1, safebuf: 3, runits: "d" };
+}
+
+// the slugs in the watch's goal store, sorted
+async function watchSlugs(rig) {
+  var slugs = [];
+  for(var slot = 0; slot < GOAL_MAX; slot++) {
+    var bytes = await rig.watch.persist(PK_GOAL_BASE + slot);
+    if(!bytes) { continue; }
+    var end = bytes.indexOf(0);
+    slugs.push(Buffer.from(bytes.slice(0, end < 0 ? 24 : end)).toString());
+  }
+  return slugs.sort().join(" ");
+}
+
+// the watch's goals version is the one the phone thinks it has
+async function inStep(rig) {
+  var sent = JSON.parse(rig.phone.storage.goals_sent || "{}");
+  return (await rig.watch.persistInt(PK_GOALS_VERSION)) >>> 0 === rig.phone.context.goalsVersion(sent);
+}
+
+function count(rig, direction, type) {
+  return rig.stats()[direction].byType[type] || 0;
+}
+
+(async function() {
+  var rig = harness.rig();
+  var beeminder = new servers.Beeminder({ goals: [goal("pushups"), goal("reading"), goal("water")] });
+  rig.servers.push(beeminder);
+  await rig.start();
+  await rig.run(MINUTE);
+  rig.phone.configure({ buser: "alice", btoken: "secret", bgoal: "pushups" });
+  await rig.run(MINUTE);
+  harness.check((await watchSlugs(rig)) === "pushups reading water" && await inStep(rig),
+                "the watch has every goal: " + await watchSlugs(rig));
+
+  // the phone forgets what it sent (say it was reinstalled) while a goal is
+  // deleted on the server: the watch's reply to its hello says so, and the
+  // full list it gets back drops the deleted goal
+  beeminder.goals = [goal("pushups"), goal("water", 2)];
+  delete rig.phone.storage.goals_sent;
+  rig.restartPhone();
+  await rig.run(MINUTE);
+  harness.check((await watchSlugs(rig)) === "pushups water" && await inStep(rig),
+                "a goal deleted while the phone lost track is gone from the watch: " + await watchSlugs(rig));
+
+  // and a restart once they're in step sends none
+  var streams = count(rig, "toWatch", "stream_chunk");
+  rig.restartPhone();
+  await rig.run(MINUTE);
+  harness.check(count(rig, "toWatch", "stream_chunk") === streams, "in step, a restart sends no goals");
+
+  // fetches asked for while one is running: one more runs after it, and
+  // sees the change made meanwhile
+  var requests = beeminder.requests;
+  rig.phone.context.fetchGoals();
+  beeminder.goals = [goal("pushups", 3)];
+  rig.phone.context.fetchGoals();
+  rig.phone.context.fetchGoals();
+  await rig.run(MINUTE);
+  harness.check(beeminder.requests - requests === 2, "three fetches at once took two requests (" +
+                (beeminder.requests - requests) + ")");
+  harness.check((await watchSlugs(rig)) === "pushups" && await inStep(rig),
+                "and the watch ended up with the server's goals: " + await watchSlugs(rig));
+
+  // more goals than the watch holds, from a phone that doesn't know to stop
+  // at what fits: the active one still makes it onto the watch, and what the
+  // watch refused isn't taken as sent
+  var many = [];
+  for(var i = 0; i < GOAL_MAX + 8; i++) { many.push(goal("goal-" + (i < 10 ? "0" : "") + i, 4)); }
+  many.push(goal("situps", 4));
+  beeminder.goals = many;
+  rig.phone.context.goalMax = 2 * GOAL_MAX;
+  rig.phone.configure({ bgoal: "situps" });
+  await rig.run(MINUTE);
+  var held = (await watchSlugs(rig)).split(" ");
+  var sent = JSON.parse(rig.phone.storage.goals_sent || "{}");
+  var refused = many.filter(function(g) { return held.indexOf(g.slug) < 0; });
+  harness.check(held.length <= GOAL_MAX && held.indexOf("situps") >= 0,
+                "with " + many.length + " goals, the watch holds " + held.length + ", the active one among them");
+  harness.check(refused.every(function(g) { return !sent[g.slug]; }) && await inStep(rig),
+                "and the phone doesn't count the " + refused.length + " it refused as sent");
+
+  // the phone as it is sends the active goal and the ones due soonest, as
+  // many as fit, whether or not it's replacing what the watch has; a goal
+  // due sooner than those takes the place of the one due last
+  rig.phone.context.goalMax = GOAL_MAX;
+  rig.phone.context.fetchGoals();
+  await rig.run(MINUTE);
+  var inOrder = many.slice(0, GOAL_MAX - 1).map(function(g) { return g.slug; }).concat("situps").sort().join(" ");
+  harness.check((await watchSlugs(rig)) === inOrder && await inStep(rig) &&
+                Object.keys(JSON.parse(rig.phone.storage.goals_sent)).sort().join(" ") === inOrder,
+                "capped, the watch holds the " + GOAL_MAX + " the phone counts as sent");
+  var soon = goal("abs", 4);
+  soon.losedate -= 86400;
+  beeminder.goals = many.concat(soon);
+  rig.phone.context.fetchGoals();
+  await rig.run(MINUTE);
+  var slugs = (await watchSlugs(rig)).split(" ");
+  harness.check(slugs.length === GOAL_MAX && slugs.indexOf("abs") >= 0 && slugs.indexOf("situps") >= 0 &&
+                slugs.indexOf(many[GOAL_MAX - 2].slug) < 0 && await inStep(rig),
+                "a goal due sooner takes the place of the one due last");
+
+  // a goal coming up on the warning (a day ahead, by default): once it fires,
+  // its flag is in flash at once, not only in the store's cache
+  var close = goal("plank");
+  close.losedate = Math.floor(rig.sim.now / 1000) + 24 * 3600 + 10 * 60;
+  beeminder.goals = many.concat(close);
+  rig.phone.context.fetchGoals();
+  await rig.run(MINUTE);
+  var slot = -1;
+  for(var k = 0; k < GOAL_MAX && slot < 0; k++) {
+    var bytes = await rig.watch.persist(PK_GOAL_BASE + k);
+    if(bytes && Buffer.from(bytes.slice(0, bytes.indexOf(0))).toString() === "plank") { slot = k; }
+  }
+  var quiet = ((await rig.watch.persist(PK_GOAL_BASE + slot)) || [])[GOAL_FLAGS] & GOAL_FLAG_WARNED;
+  rig.watch.vibes = [];
+  await rig.run(15 * MINUTE);
+  var warned = ((await rig.watch.persist(PK_GOAL_BASE + slot)) || [])[GOAL_FLAGS] & GOAL_FLAG_WARNED;
+  harness.check(slot >= 0 && !quiet && rig.watch.vibes.length === 1 && warned,
+                "a goal's warning, once it fires, is stored straight away");
+
+  // the flight log comes with the hello's reply, without a request of its own
+  var requested = count(rig, "toWatch", "flightrec_request");
+  var hellos = count(rig, "toWatch", "hello"), replies = count(rig, "fromWatch", "hello_reply");
+  var seq = Number(rig.phone.storage.flight_seq || 0);
+  await rig.restartWatch(); // logs a start
+  rig.restartPhone();
+  await rig.run(MINUTE);
+  harness.check(count(rig, "toWatch", "hello") - hellos === 1 && count(rig, "fromWatch", "hello_reply") - replies === 1,
+                "one hello, one reply");
+  harness.check(Number(rig.phone.storage.flight_seq) > seq &&
+                /start/.test(JSON.parse(rig.phone.storage.flight_log).slice(-3).join(" ")),
+                "the watch's flight log came with its reply");
+  harness.check(count(rig, "toWatch", "flightrec_request") === requested, "without a flightrec_request");
+
+  await rig.stop();
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,45 @@
+// Each vibe pattern the configuration page offers (see vibePatterns in
+// config-page.js) plays exactly its own segments on the watch, and nothing
+// of the next one's: set as the "phone lost" vibe, then the link dropped.
+
+"use strict";
+var harness = require("./harness");
+var MINUTE = harness.MINUTE;
+
+// generate_vibe's patterns, as the host prints them
+var expected = {
+  0: [],
+  1: ["short"],
+  2: ["double"],
+  3: ["custom 200 100 200 100 200"],
+  4: ["long"],
+  5: ["custom 50 200 50 200 50 200 50"],
+  6: ["custom 100 200 100 200 100 200 100"],
+  7: ["custom 500 250 500 250 500 250 500"]
+};
+
+(async function() {
+  var rig = harness.rig();
+  await rig.start();
+  await rig.run(MINUTE);
+  var offered = rig.phone.context.vibePatterns.map(function(p) { return p[0]; });
+  harness.check(offered.join() === Object.keys(expected).join(), "the page offers patterns " + offered.join(" "));
+
+  for(var i = 0; i < offered.length; i++) {
+    var pattern = offered[i];
+    rig.phone.configure({ vibe_pat_disconnect: pattern, vibe_pat_connect: 0 });
+    await rig.run(MINUTE);
+    rig.watch.vibes = [];
+    await rig.setLink(false);
+    await rig.run(10 * 1000);
+    var played = rig.watch.vibes.map(function(v) { return v.pattern; });
+    await rig.setLink(true);
+    await rig.run(MINUTE);
+    harness.check(played.join("|") === expected[pattern].join("|"),
+                  "pattern " + pattern + ": " + (played.join(", ") || "nothing"));
+  }
+  await rig.stop();
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
@@ -0,0 +1,92 @@
+// The weather slot against an Open-Meteo stand-in: the watch shows what the
+// server says, positions are cached per ~10km cell, a failed fetch keeps the
+// old weather, and weather the phone hasn't refreshed for hours is blanked.
+
+"use strict";
+var harness = require("./harness");
+var servers = require("./servers");
+var MINUTE = harness.MINUTE, HOUR = harness.HOUR;
+
+async function setup() {
+  var rig = harness.rig();
+  var weather = new servers.Weather({ weather: function(lat, lon, time) {
+    // warmer the further south, so a move shows
+    return { temperature: Math.round(60 - lat), code: 3, max: Math.round(64 - lat), min: Math.round(55 - lat) };
+  } });
+  rig.servers.push(weather);
+  await rig.start();
+  await rig.run(MINUTE);
+  return { rig: rig, weather: weather };
+}
+
+(async function() {
+  var s = await setup(), rig = s.rig, weather = s.weather;
+  var ms;
+
+  harness.check(weather.requests === 0 && rig.phone.counts.positions === 0,
+                "no weather fetched while the slot shows the calendar");
+
+  rig.phone.configure({ slot_bot: 2 });
+  ms = await rig.untilScreen(/^8°$/, MINUTE);
+  harness.check(ms >= 0 && (await rig.watch.text()).indexOf("H 12  L 3") >= 0,
+                "the watch shows the temperature and the day's range (" + harness.seconds(ms) + ")");
+  harness.check(weather.requests === 1 && rig.phone.counts.positions === 1, "one position fix, one fetch");
+
+  // a restart of the phone within the cache's lifetime costs nothing: the
+  // watch's weather is recent enough that it doesn't ask (HELLO_NEED_WEATHER)
+  var messages = rig.stats().toWatch.byType.weather || 0;
+  await rig.run(10 * MINUTE);
+  rig.restartPhone();
+  await rig.run(MINUTE);
+  harness.check(weather.requests === 1 && rig.phone.counts.positions === 1 &&
+                (rig.stats().toWatch.byType.weather || 0) === messages,
+                "a restart reuses the position and the weather, and sends nothing new");
+
+  // moving about town, within a cell: a new fix once the old one is too old,
+  // but the same cell's weather
+  await rig.run(HOUR);
+  var requests = weather.requests, positions = rig.phone.counts.positions;
+  rig.phone.position = { latitude: 52.38, longitude: 4.91 };
+  rig.restartPhone();
+  await rig.run(MINUTE);
+  harness.check(rig.phone.counts.positions === positions + 1, "an hour on, a new position fix");
+  harness.check(Object.keys(weather.cells).length === 1, "within the same cell: " + Object.keys(weather.cells).join(" "));
+
+  // the server down: the watch keeps what it has, however often it asks
+  weather.failNext = 5;
+  rig.phone.storage.weather_cache = "{}";
+  requests = weather.requests;
+  await rig.run(HOUR);
+  rig.restartPhone();
+  await rig.run(MINUTE);
+  harness.check(weather.requests > requests && (await rig.watch.text()).indexOf("8°") >= 0,
+                "a failed fetch leaves the watch's weather as it was");
+  weather.failNext = 0;
+
+  // somewhere else
+  rig.phone.position = { latitude: 48.85, longitude: 2.35 };
+  await rig.run(HOUR);
+  rig.restartPhone();
+  ms = await rig.untilScreen(/^11°$/, 5 * MINUTE);
+  harness.check(ms >= 0 && weather.cells["48.9,2.4"] >= 1, "moved: the new cell's weather (" + harness.seconds(ms) + ")");
+
+  // degrees Fahrenheit from the same server
+  rig.phone.configure({ wunits: "f" });
+  ms = await rig.untilScreen(/^52°$/, 5 * MINUTE);
+  harness.check(ms >= 0, "Fahrenheit when configured");
+
+  // out of touch: after three hours without fresh weather the watch blanks it
+  await rig.setLink(false);
+  ms = await rig.untilScreen(/^--°$/, 4 * HOUR);
+  harness.check(ms > 2 * HOUR && ms <= 3 * HOUR + 2 * MINUTE,
+                "old weather blanked after about 3 hours (" + harness.seconds(ms) + ")");
+  await rig.setLink(true);
+  rig.restartPhone();
+  ms = await rig.untilScreen(/^52°$/, 5 * MINUTE);
+  harness.check(ms >= 0, "back once the phone's in touch");
+
+  await rig.stop();
+})().catch(function(err) {
+  console.log(err.stack);
+  process.exit(1);
+});
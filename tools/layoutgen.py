@@ -0,0 +1,69 @@
+#
+# Generates a platform's screen layout from layouts.json, as plain #defines.
+#
+# Each platform names one of the "layouts" (screens of the same size share
+# one) and whether it has a color screen.  The build generates layout.auto.h
+# into each platform's build directory, so every binary is compiled against
+# only its own constants, and code that differs between black and white and
+# color screens is chosen with #if LAYOUT_COLOR rather than at run time.
+#
+# Used as a waf rule by the wscript (the task generator carries `platform`),
+# or run directly (see the end of this file).
+#
+
+import json
+from collections import OrderedDict
+
+
+def load(path):
+    with open(path) as f:
+        schema = json.load(f, object_pairs_hook=OrderedDict) # keep the file's order
+    names = None
+    for name, layout in schema['layouts'].items():
+        if names is not None and set(layout) != names:
+            raise ValueError('layout %s: constants differ from the other layouts' % name)
+        names = set(layout)
+    for platform, entry in schema['platforms'].items():
+        if entry['layout'] not in schema['layouts']:
+            raise ValueError('%s: unknown layout %s' % (platform, entry['layout']))
+    return schema
+
+
+def c_header(schema, platform):
+    entry = schema['platforms'][platform]
+    layout = schema['layouts'][entry['layout']]
+    docs = schema.get('docs', {})
+    out = ['// Generated from layouts.json by tools/layoutgen.py for %s, do not edit.' % platform,
+           '#pragma once',
+           '',
+           '#define LAYOUT_PLATFORM "%s"' % platform,
+           '#define LAYOUT_COLOR %d' % (1 if entry['color'] else 0),
+           '']
+    for name, value in layout.items():
+        line = '#define %-22s %4d' % (name, value)
+        if name in docs:
+            line += ' // ' + docs[name]
+        out.append(line)
+    return '\n'.join(out) + '\n'
+
+
+# waf rule, input is layouts.json
+
+def generate(task):
+    schema = load(task.inputs[0].abspath())
+    task.outputs[0].write(c_header(schema, task.generator.platform))
+
+
+# Outside the build:
+#   python tools/layoutgen.py layouts.json <platform> <outdir>
+
+if __name__ == '__main__':
+    import os
+    import sys
+    if len(sys.argv) != 4:
+        sys.exit('usage: %s layouts.json platform outdir' % sys.argv[0])
+    schema = load(sys.argv[1])
+    if sys.argv[2] not in schema['platforms']:
+        sys.exit('unknown platform %s' % sys.argv[2])
+    with open(os.path.join(sys.argv[3], 'layout.auto.h'), 'w') as f:
+        f.write(c_header(schema, sys.argv[2]))
@@ -0,0 +1,279 @@
+#
+# Generates the watch and phone message codecs from messages.json.
+#
+# "keys" are plain dictionary keys (the configuration page sends those), and
+# become AK_* defines.  Each of the "messages" travels as a single byte array
+# tuple whose key is the message id, so a message is one dict_write_data on
+# the way out and one dict_read_first on the way in.  Fields are packed
+# little-endian in order; a "char" field is a NUL padded string of fixed
+# size, and a "data" field is a variable length byte run, which must be the
+# last field, of at most the given size.
+#
+# "records" use the same field types but aren't messages of their own; they
+# get a struct and a decoder for use inside other payloads (e.g. streams).
+#
+# Used as waf rules by the wscript, or run directly (see the end of this
+# file); either way it fails if appinfo.json's appKeys don't match the schema.
+#
+
+import json
+
+SIZES = { 'int8': 1, 'uint8': 1, 'int16': 2, 'uint16': 2, 'int32': 4, 'uint32': 4 }
+
+
+def load(path):
+    with open(path) as f:
+        schema = json.load(f)
+    schema.setdefault('records', {})
+    messages = sorted(schema['messages'].items(), key=lambda item: item[1]['id'])
+    messages += sorted(schema['records'].items())
+    for name, message in messages:
+        for i, field in enumerate(message['fields']):
+            if field[1] == 'data' and i != len(message['fields']) - 1:
+                raise ValueError('%s.%s: data fields must come last' % (name, field[0]))
+            if field[1] not in SIZES and field[1] not in ('char', 'data'):
+                raise ValueError('%s.%s: unknown type %s' % (name, field[0], field[1]))
+    return schema, messages
+
+
+def app_keys(schema):
+    keys = dict(schema['keys'])
+    for name, message in schema['messages'].items():
+        keys[name] = message['id']
+    return keys
+
+
+def fixed_size(message):
+    size = 0
+    for field in message['fields']:
+        if field[1] == 'char':
+            size += field[2]
+        elif field[1] != 'data':
+            size += SIZES[field[1]]
+    return size
+
+
+def max_size(message):
+    size = fixed_size(message)
+    for field in message['fields']:
+        if field[1] == 'data':
+            size += field[2]
+    return size
+
+
+def c_header(schema, messages):
+    out = ['// Generated from messages.json by tools/msgschema.py, do not edit.',
+           '#pragma once',
+           '#include <pebble.h>',
+           '',
+           '// dictionary keys, sent as separate tuples']
+    for name, key in sorted(schema['keys'].items(), key=lambda item: item[1]):
+        out.append('#define AK_%-22s %3d' % (name.upper(), key))
+    out += ['',
+            'static inline uint32_t msg_get(const uint8_t *p, uint8_t size) {',
+            '  uint32_t value = 0;',
+            '  while (size--) { value = (value << 8) | p[size]; }',
+            '  return value;',
+            '}',
+            '',
+            'static inline void msg_put(uint8_t *p, uint32_t value, uint8_t size) {',
+            '  for (uint8_t i = 0; i < size; i++) { p[i] = value >> (8 * i); }',
+            '}']
+    for name, message in messages:
+        upper = name.upper()
+        out += ['', '// %s' % message.get('doc', name)]
+        if 'id' in message:
+            out.append('#define MSG_%s %d' % (upper, message['id']))
+        out += ['#define MSG_%s_SIZE %d' % (upper, fixed_size(message)),
+                '#define MSG_%s_MAX %d' % (upper, max_size(message)),
+                '',
+                'typedef struct msg_%s {' % name]
+        for field in message['fields']:
+            if field[1] == 'char':
+                out.append('  char %s[%d];' % (field[0], field[2]))
+            elif field[1] == 'data':
+                out.append('  const uint8_t *%s;' % field[0])
+                out.append('  uint16_t %s_length;' % field[0])
+            else:
+                out.append('  %s_t %s;' % (field[1], field[0]))
+        out += ['} msg_%s;' % name,
+                '',
+                'static inline bool msg_%s_decode(const uint8_t *p, uint16_t length, msg_%s *msg) {' % (name, name)]
+        if fixed_size(message):
+            out.append('  if (length < MSG_%s_SIZE || length > MSG_%s_MAX) {' % (upper, upper))
+        else: # no lower bound, and length < 0 would be always false (-Wtype-limits)
+            out.append('  if (length > MSG_%s_MAX) {' % upper)
+        out += ['    return false;',
+                '  }']
+        offset = 0
+        for field in message['fields']:
+            if field[1] == 'char':
+                out.append('  memcpy(msg->%s, p + %d, %d);' % (field[0], offset, field[2]))
+                out.append('  msg->%s[%d] = \'\\0\';' % (field[0], field[2] - 1))
+                offset += field[2]
+            elif field[1] == 'data':
+                out.append('  msg->%s = p + %d;' % (field[0], offset))
+                out.append('  msg->%s_length = length - %d;' % (field[0], offset))
+            else:
+                out.append('  msg->%s = (%s_t)msg_get(p + %d, %d);' %
+                           (field[0], field[1], offset, SIZES[field[1]]))
+                offset += SIZES[field[1]]
+        out += ['  return true;',
+                '}']
+        if 'id' not in message:
+            continue
+        out += ['',
+                'static inline bool msg_%s_unpack(const Tuple *tuple, msg_%s *msg) {' % (name, name),
+                '  if (tuple == NULL || tuple->key != MSG_%s || tuple->type != TUPLE_BYTE_ARRAY) {' % upper,
+                '    return false;',
+                '  }',
+                '  return msg_%s_decode(tuple->value->data, tuple->length, msg);' % name,
+                '}',
+                '',
+                'static inline DictionaryResult msg_%s_write(DictionaryIterator *iter, const msg_%s *msg) {' % (name, name),
+                '  uint8_t buffer[MSG_%s_MAX];' % upper,
+                '  uint16_t length = MSG_%s_SIZE;' % upper]
+        offset = 0
+        for field in message['fields']:
+            if field[1] == 'char':
+                out.append('  strncpy((char *)buffer + %d, msg->%s, %d);' % (offset, field[0], field[2]))
+                offset += field[2]
+            elif field[1] == 'data':
+                out.append('  length += msg->%s_length < %d ? msg->%s_length : %d;' %
+                           (field[0], field[2], field[0], field[2]))
+                out.append('  memcpy(buffer + %d, msg->%s, length - %d);' % (offset, field[0], offset))
+            else:
+                out.append('  msg_put(buffer + %d, (uint32_t)msg->%s, %d);' %
+                           (offset, field[0], SIZES[field[1]]))
+                offset += SIZES[field[1]]
+        out += ['  return dict_write_data(iter, MSG_%s, buffer, length);' % upper,
+                '}']
+    return '\n'.join(out) + '\n'
+
+
+JS_CODEC = '''
+// Pack a message or record into bytes
+function recordEncode(name, msg) {
+  var bytes = [];
+  messageSchema[name].fields.forEach(function(field) {
+    var value = msg[field[0]], i;
+    if(field[1] === "char") {
+      value = value || "";
+      for(i = 0; i < field[2]; i++) {
+        bytes.push(i < value.length && i < field[2] - 1 ? value.charCodeAt(i) & 0xFF : 0);
+      }
+    } else if(field[1] === "data") {
+      bytes = bytes.concat((value || []).slice(0, field[2]));
+    } else {
+      for(i = 0; i < messageSizes[field[1]]; i++) {
+        bytes.push(((value || 0) >> (8 * i)) & 0xFF);
+      }
+    }
+  });
+  return bytes;
+}
+
+// Pack a message into the payload for Pebble.sendAppMessage
+function messageEncode(name, msg) {
+  var payload = {};
+  payload[name] = recordEncode(name, msg);
+  return payload;
+}
+
+// Unpack a message or record from bytes
+function recordDecode(name, bytes) {
+  var msg = { type: name }, offset = 0;
+  messageSchema[name].fields.forEach(function(field) {
+    var i;
+    if(field[1] === "char") {
+      msg[field[0]] = "";
+      for(i = 0; i < field[2] && bytes[offset + i]; i++) {
+        msg[field[0]] += String.fromCharCode(bytes[offset + i]);
+      }
+      offset += field[2];
+    } else if(field[1] === "data") {
+      msg[field[0]] = bytes.slice(offset);
+    } else {
+      var size = messageSizes[field[1]], value = 0;
+      for(i = size - 1; i >= 0; i--) { value = value * 256 + (bytes[offset + i] || 0); }
+      if(field[1].charAt(0) === "i" && value >= Math.pow(2, 8 * size - 1)) {
+        value -= Math.pow(2, 8 * size);
+      }
+      msg[field[0]] = value;
+      offset += size;
+    }
+  });
+  return msg;
+}
+
+// Unpack whichever message an appmessage payload carries, null if none
+function messageDecode(payload) {
+  for(var name in messageSchema) {
+    if(messageSchema[name].id === undefined) { continue; } // a record
+    var bytes = payload[name] || payload[messageSchema[name].id];
+    if(bytes) { return recordDecode(name, bytes); }
+  }
+  return null;
+}
+'''
+
+
+def js_codec(schema, messages):
+    out = ['// Generated from messages.json by tools/msgschema.py, do not edit.',
+           'var messageSizes = %s;' % json.dumps(SIZES, sort_keys=True),
+           'var messageSchema = {']
+    entries = []
+    for name, message in messages:
+        if 'id' in message:
+            entries.append('  %s: { id: %d, fields: %s }' %
+                           (name, message['id'], json.dumps(message['fields'])))
+        else:
+            entries.append('  %s: { fields: %s }' % (name, json.dumps(message['fields'])))
+    out.append(',\n'.join(entries))
+    out.append('};')
+    return '\n'.join(out) + '\n' + JS_CODEC
+
+
+def check_app_keys(schema, appinfo_path):
+    with open(appinfo_path) as f:
+        declared = json.load(f)['appKeys']
+    expected = app_keys(schema)
+    if declared != expected:
+        missing = sorted(set(expected.items()) - set(declared.items()))
+        extra = sorted(set(declared.items()) - set(expected.items()))
+        return 'appinfo.json appKeys differ from messages.json: missing %s, unexpected %s' % (missing, extra)
+    return None
+
+
+# waf rules, inputs are [messages.json, appinfo.json]
+
+def generate_c(task):
+    schema, messages = load(task.inputs[0].abspath())
+    error = check_app_keys(schema, task.inputs[1].abspath())
+    if error:
+        print(error)
+        return 1
+    task.outputs[0].write(c_header(schema, messages))
+
+
+def generate_js(task):
+    schema, messages = load(task.inputs[0].abspath())
+    task.outputs[0].write(js_codec(schema, messages))
+
+
+# Outside the build, e.g. to load the codecs into a host-side harness:
+#   python tools/msgschema.py messages.json appinfo.json <outdir>
+
+if __name__ == '__main__':
+    import os
+    import sys
+    if len(sys.argv) != 4:
+        sys.exit('usage: %s messages.json appinfo.json outdir' % sys.argv[0])
+    schema, messages = load(sys.argv[1])
+    error = check_app_keys(schema, sys.argv[2])
+    if error:
+        sys.exit(error)
+    with open(os.path.join(sys.argv[3], 'messages.auto.h'), 'w') as f:
+        f.write(c_header(schema, messages))
+    with open(os.path.join(sys.argv[3], 'messages.auto.js'), 'w') as f:
+        f.write(js_codec(schema, messages))
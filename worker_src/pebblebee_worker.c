@@ -0,0 +1,100 @@
+#include <pebble_worker.h>
+#include "../src/battlog.h"
+#define DEBUGLOG 0
+
+// Samples battery and link state into the shared battery log (see battlog.h)
+// while the face isn't running, so the history has no gaps.
+
+static uint32_t log_head = 0;
+static battlog_record log_block[BATTLOG_BLOCK_RECORDS];
+static uint8_t features = 0;
+static bool bluetooth_connected = false;
+static BatteryChargeState logged_charge;
+
+static void log_append(uint8_t reason) {
+  BatteryChargeState charge = battery_state_service_peek();
+  uint32_t slot = log_head % BATTLOG_BLOCK_RECORDS;
+  if (slot == 0) {
+    memset(log_block, 0, sizeof(log_block)); // starting a fresh block
+  }
+  log_block[slot] = (battlog_record) {
+    .time     = time(0),
+    .percent  = charge.charge_percent,
+    .state    = (charge.is_charging ? BATTLOG_CHARGING : 0)
+              | (charge.is_plugged  ? BATTLOG_PLUGGED  : 0)
+              | (bluetooth_connected ? BATTLOG_LINKED  : 0),
+    .features = features,
+    .reason   = reason,
+  };
+  // the block goes first, so the face never sees a head past what's stored;
+  // if it didn't make it, the next sample takes the same slot
+  if (persist_write_data(BATTLOG_BLOCK_KEY(log_head), log_block, sizeof(log_block)) < 0) {
+    return;
+  }
+  log_head++;
+  persist_write_int(PK_LOG_HEAD, log_head);
+  logged_charge = charge;
+
+  AppWorkerMessage msg = { .data0 = reason };
+  app_worker_send_message(BATTLOG_MSG_APPENDED, &msg);
+  if (DEBUGLOG) { app_log(APP_LOG_LEVEL_DEBUG, __FILE__, __LINE__,
+                          "logged %d%% (reason %d)", charge.charge_percent, reason); }
+}
+
+static void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
+  if (tick_time->tm_min % BATTLOG_INTERVAL_MIN == 0) {
+    log_append(BATTLOG_REASON_INTERVAL);
+  }
+}
+
+static void handle_battery(BatteryChargeState charge_state) {
+  if (  (charge_state.charge_percent == logged_charge.charge_percent)
+     && (charge_state.is_charging    == logged_charge.is_charging)
+     && (charge_state.is_plugged     == logged_charge.is_plugged)) {
+    return; // nothing new, the interval samples will cover it
+  }
+  log_append(BATTLOG_REASON_BATTERY);
+}
+
+static void handle_bluetooth(bool connected) {
+  bluetooth_connected = connected;
+  log_append(BATTLOG_REASON_LINK);
+}
+
+static void handle_face_message(uint16_t type, AppWorkerMessage *data) {
+  if (type == BATTLOG_MSG_FEATURES) {
+    features = data->data0; // the face also persists it, for our next start
+  }
+}
+
+static void init(void) {
+  if (persist_exists(PK_LOG_HEAD)) {
+    log_head = persist_read_int(PK_LOG_HEAD);
+  }
+  if (log_head % BATTLOG_BLOCK_RECORDS != 0) {
+    persist_read_data(BATTLOG_BLOCK_KEY(log_head), log_block, sizeof(log_block));
+  }
+  if (persist_exists(PK_LOG_FEATURES)) {
+    features = persist_read_int(PK_LOG_FEATURES);
+  }
+  bluetooth_connected = bluetooth_connection_service_peek();
+
+  app_worker_message_subscribe(handle_face_message);
+  tick_timer_service_subscribe(MINUTE_UNIT, &handle_minute_tick);
+  battery_state_service_subscribe(&handle_battery);
+  bluetooth_connection_service_subscribe(&handle_bluetooth);
+  log_append(BATTLOG_REASON_START);
+}
+
+static void deinit(void) {
+  bluetooth_connection_service_unsubscribe();
+  battery_state_service_unsubscribe();
+  tick_timer_service_unsubscribe();
+  app_worker_message_unsubscribe();
+}
+
+int main(void) {
+  init();
+  worker_event_loop();
+  deinit();
+}